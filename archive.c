@@ -0,0 +1,893 @@
+/* archive.c: scanning Maildirs inside tar archives, plain, gzipped or
+ * zstd-compressed, without extracting them. See maildirtree.c for full
+ * copyright.
+ * (C) 2003 by Joshua Kwan. */
+
+#include "config.h"
+
+#include "libmaildirtree.h"
+#include "snprintf.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#define WITH_GZIP
+#include <zlib.h>
+#endif
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#define WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#define BLOCK 512
+#define BUFFER (64 * 1024)
+
+enum { RAW, GZIP, ZSTD };
+
+/* The archive, decompressed, read through one buffer. Message bodies
+ * are mostly smaller than that buffer and are skipped within it; bigger
+ * ones are seeked over in a plain tar, and decompressed and dropped in
+ * a compressed one. */
+struct source
+{
+  int fd, kind;
+  unsigned char *buf;
+  size_t pos, len;
+#ifdef WITH_GZIP
+  gzFile gz;
+#endif
+#ifdef WITH_ZSTD
+  ZSTD_DStream *zs;
+  ZSTD_inBuffer in;
+  unsigned char *inbuf;
+  bool eof;                    /* all of the file is in */
+#endif
+};
+
+/* Every directory that might be a folder, by its path in the archive */
+#define HAS_CUR 0x01
+#define HAS_NEW 0x02
+
+struct archive
+{
+  const struct mdt_options *opts;
+  time_t now;
+
+  char *names;
+  size_t names_len, names_alloc;
+
+  unsigned int *name;          /* offset of each directory's path */
+  unsigned int *read, *unread;
+  unsigned char *flags;
+  struct mdt_ages *ages;
+  size_t count, alloc;
+
+  unsigned int *hash;          /* path -> directory + 1, 0 is free */
+  size_t hash_size;
+
+  int error;                   /* sticky ENOMEM */
+};
+
+static int read_archive (struct archive *, const char *, const struct mdt_options *);
+static int walk (struct archive *, const char *,
+                 int (*) (void *, const char *, const struct mdt_counts *), void *);
+static int read_headers (struct archive *, struct source *);
+static void add_entry (struct archive *, char *, char);
+static unsigned int directory (struct archive *, const char *, size_t);
+static int grow (struct archive *);
+static inline size_t hash_path (const char *, size_t);
+static unsigned int find_root (struct archive *);
+static int is_child (struct archive *, unsigned int, unsigned int, const char **);
+static void archive_free (struct archive *);
+static uint64_t tar_number (const unsigned char *, size_t);
+static int tar_checksum (const unsigned char *);
+static int src_open (struct source *, const char *);
+static long src_read (struct source *, void *, size_t);
+static int src_skip (struct source *, uint64_t);
+static long src_fill (struct source *);
+static void src_close (struct source *);
+static int add_folder (void *, const char *, const struct mdt_counts *);
+static void warn (const struct mdt_options *, const char *, const char *);
+
+static struct mdt_options default_options;
+
+int mdt_walk_archive (const char *path, const struct mdt_options *opts,
+                      int (*fn) (void *arg, const char *name,
+                                 const struct mdt_counts *counts),
+                      void *arg)
+{
+  struct archive a;
+  int r;
+
+  if (read_archive(&a, path, opts) != 0)
+    return -1;
+
+  r = walk (&a, path, fn, arg);
+  archive_free (&a);
+  return r;
+}
+
+struct mdt_tree * mdt_scan_archive (const char *path, const struct mdt_options *opts)
+{
+  struct archive a;
+  struct mdt_builder *b;
+  static const char *suffixes[] = { ".tar", ".tar.gz", ".tgz", ".tar.zst", ".tzst", NULL };
+  char name [NAME_MAX + 1];
+  const char *base, *end;
+  size_t len, i, n;
+  unsigned int root;
+
+  if (read_archive(&a, path, opts) != 0)
+    return NULL;
+
+  /* The root is named after its directory in the archive, as it would
+   * be once extracted... */
+  root = find_root(&a);
+  base = (root != MDT_NONE) ? a.names + a.name[root] : "";
+  if ((end = strrchr(base, '/')) != NULL)
+    base = end + 1;
+
+  /* ...or after the archive itself, if it holds the Maildir's insides. */
+  if (*base == '\0' || !strcmp(base, "."))
+  {
+    base = (end = strrchr(path, '/')) ? end + 1 : path;
+    len = strlen(base);
+
+    /* Only what ends the name: my.thing.tar is my.thing */
+    for (i = 0; suffixes[i]; i++)
+    {
+      n = strlen(suffixes[i]);
+      if (len > n && !strcmp(base + len - n, suffixes[i]))
+      {
+        len -= n;
+        break;
+      }
+    }
+
+    snprintf (name, sizeof(name), "%.*s", (int) len, base);
+  }
+  else
+    snprintf (name, sizeof(name), "%s", base);
+
+  b = mdt_builder_new(name, (a.opts->ages ? MDT_AGES : 0) |
+                            (a.opts->stamps ? MDT_STAMPS : 0));
+  if (b == NULL)
+  {
+    archive_free (&a);
+    errno = ENOMEM;
+    return NULL;
+  }
+  mdt_builder_sort (b, a.opts->sort);
+
+  walk (&a, path, &add_folder, b);
+  archive_free (&a);
+
+  return mdt_finish (b);
+}
+
+static int add_folder (void *arg, const char *name, const struct mdt_counts *c)
+{
+  mdt_insert ((struct mdt_builder *) arg, name, c);
+  return 0;
+}
+
+/* walk: hand the root and the folders right below it to fn(), with the
+ * same warnings a scan of the extracted archive would give. */
+static int walk (struct archive *a, const char *path,
+                 int (*fn) (void *, const char *, const struct mdt_counts *), void *arg)
+{
+  struct mdt_counts c;
+  unsigned int root, i;
+  const char *child;
+  int r;
+
+  root = find_root(a);
+
+  memset (&c, 0, sizeof(c));
+  mdt_clear_ages (&c.ages);
+
+  if (root != MDT_NONE)
+  {
+    c.read = a->read[root];
+    c.unread = a->unread[root];
+    if (a->ages)
+      c.ages = a->ages[root];
+  }
+
+  if (root == MDT_NONE || (a->flags[root] & (HAS_CUR | HAS_NEW)) != (HAS_CUR | HAS_NEW))
+    warn(a->opts, "%s does not look like a complete Maildir", path);
+
+  if ((r = fn(arg, "", &c)) != 0)
+    return r;
+
+  for (i = 0; root != MDT_NONE && i < a->count; i++)
+  {
+    if (!is_child(a, root, i, &child))
+      continue;
+
+    if ((a->flags[i] & (HAS_CUR | HAS_NEW)) != (HAS_CUR | HAS_NEW))
+    {
+      warn(a->opts, "%s is missing cur or new; ignoring!", child);
+      continue;
+    }
+
+    c.read = a->read[i];
+    c.unread = a->unread[i];
+    if (a->ages)
+      c.ages = a->ages[i];
+
+    if ((r = fn(arg, child, &c)) != 0)
+      return r;
+  }
+
+  return 0;
+}
+
+/* read_archive: note down every directory in the archive at 'path' with
+ * what it holds, in one pass over the headers. */
+static int read_archive (struct archive *a, const char *path, const struct mdt_options *opts)
+{
+  struct source src;
+  int r, err;
+
+  memset (a, 0, sizeof(*a));
+  a->opts = opts ? opts : &default_options;
+  a->now = a->opts->now ? a->opts->now : time(NULL);
+
+  if (src_open(&src, path) != 0)
+    return -1;
+
+  r = read_headers (a, &src);
+  err = errno;
+  src_close (&src);
+
+  if (r == 0 && a->error)
+  {
+    r = -1;
+    err = ENOMEM;
+  }
+
+  if (r != 0)
+  {
+    archive_free (a);
+    errno = err;
+  }
+
+  return r;
+}
+
+static int read_headers (struct archive *a, struct source *src)
+{
+  unsigned char hdr [BLOCK];
+  char *name = NULL, *longname = NULL;
+  size_t alloc = 0;
+  uint64_t size;
+  long got;
+  bool first = true;
+  char type;
+
+  for (;;)
+  {
+    if ((got = src_read(src, hdr, BLOCK)) < 0)
+      goto fail;
+
+    /* A missing end-of-archive marker is forgiven, as GNU tar does. */
+    if (got < BLOCK && first)
+    {
+      errno = EINVAL;
+      goto fail;
+    }
+    if (got < BLOCK || hdr[0] == '\0')
+      break;
+
+    if (!tar_checksum(hdr))
+    {
+      errno = first ? EINVAL : EIO;
+      goto fail;
+    }
+    first = false;
+
+    size = tar_number(hdr + 124, 12);
+    type = (char) hdr[156];
+
+    /* Long names, GNU and POSIX style, apply to the next entry. */
+    if (type == 'L' || type == 'x')
+    {
+      char *data;
+      size_t len = (size_t) size;
+
+      if (size > 1024 * 1024 || (data = (char *) malloc (len + 1)) == NULL)
+        goto fail;
+      if (src_read(src, data, len) < (long) len ||
+          src_skip(src, (BLOCK - len % BLOCK) % BLOCK) != 0)
+      {
+        free (data);
+        errno = EIO;
+        goto fail;
+      }
+      data[len] = '\0';
+
+      free (longname);
+      longname = NULL;
+
+      if (type == 'L')
+        longname = data;
+      else
+      {
+        /* Records of "<length> <key>=<value>\n" */
+        char *p = data, *end;
+        size_t rec;
+
+        while (p < data + len && (rec = strtoul(p, &end, 10)) > 0 &&
+               p + rec <= data + len)
+        {
+          if (!strncmp(end, " path=", 6))
+          {
+            p[rec - 1] = '\0';
+            free (longname);
+            longname = strdup(end + 6);
+            break;
+          }
+          p += rec;
+        }
+        free (data);
+      }
+      continue;
+    }
+
+    if (longname)
+    {
+      free (name);
+      name = longname;
+      alloc = strlen(name) + 1;
+      longname = NULL;
+    }
+    else
+    {
+      size_t need = 155 + 1 + 100 + 1;
+
+      if (alloc < need)
+      {
+        free (name);
+        if ((name = (char *) malloc (need)) == NULL)
+          goto fail;
+        alloc = need;
+      }
+
+      /* ustar splits long names in a prefix and the rest */
+      if (!memcmp(hdr + 257, "ustar", 5) && hdr[345] != '\0')
+        snprintf (name, need, "%.155s/%.100s", (char *) hdr + 345, (char *) hdr);
+      else
+        snprintf (name, need, "%.100s", (char *) hdr);
+    }
+
+    if (type != 'K' && type != 'g')
+      add_entry (a, name, type);
+
+    if (src_skip(src, (size + BLOCK - 1) / BLOCK * BLOCK) != 0)
+      goto fail;
+  }
+
+  free (name);
+  free (longname);
+  return 0;
+
+fail:
+  free (name);
+  free (longname);
+  return -1;
+}
+
+/* add_entry: file one archive member under the directory it belongs to.
+ *
+ * D/cur/F and D/new/F are messages of folder D, D/cur and D/new say that
+ * D has them; any other directory might be a folder missing both. */
+static void add_entry (struct archive *a, char *path, char type)
+{
+  char *p, *last, *prev;
+  size_t len;
+  unsigned int d;
+  bool is_new;
+
+  /* ./Maildir/cur/ -> Maildir/cur */
+  while (path[0] == '.' && path[1] == '/')
+    path += 2;
+  while (path[0] == '/')
+    path++;
+  len = strlen(path);
+  while (len > 0 && path[len - 1] == '/')
+    path[--len] = '\0';
+  if (len == 0)
+    return;
+
+  last = strrchr(path, '/');
+  p = last ? last + 1 : path;
+
+  /* D/cur, D/new, D/tmp */
+  if (!strcmp(p, "cur") || !strcmp(p, "new") || !strcmp(p, "tmp"))
+  {
+    if ((d = directory(a, path, p - path - (last != NULL))) == MDT_NONE)
+      return;
+
+    if (*p == 'c')
+      a->flags[d] |= HAS_CUR;
+    else if (*p == 'n')
+      a->flags[d] |= HAS_NEW;
+    return;
+  }
+
+  if (last != NULL)
+  {
+    for (prev = last; prev > path && prev[-1] != '/'; prev--)
+      ;
+
+    /* D/cur/F, D/new/F */
+    if ((last - prev == 3) && (!strncmp(prev, "cur", 3) || !strncmp(prev, "new", 3)))
+    {
+      if (*p == '.')
+        return;
+
+      is_new = (*prev == 'n');
+      if ((d = directory(a, path, prev - path - (prev > path))) == MDT_NONE)
+        return;
+
+      a->flags[d] |= is_new ? HAS_NEW : HAS_CUR;
+      if (is_new)
+        a->unread[d]++;
+      else
+        a->read[d]++;
+
+      if (a->ages)
+        mdt_age_message (&a->ages[d], p, a->now);
+      return;
+    }
+  }
+
+  if (type == '5')
+    directory (a, path, len);
+  else if (last != NULL)
+    directory (a, path, last - path);
+}
+
+/* directory: the index of the directory with the 'len' bytes of 'path'
+ * as its path, added if it was not there yet. */
+static unsigned int directory (struct archive *a, const char *path, size_t len)
+{
+  size_t h, mask;
+  unsigned int d;
+
+  if (a->error)
+    return MDT_NONE;
+
+  if (a->count >= a->hash_size / 2 && grow(a) != 0)
+  {
+    a->error = ENOMEM;
+    return MDT_NONE;
+  }
+
+  mask = a->hash_size - 1;
+  for (h = hash_path(path, len) & mask; a->hash[h] != 0; h = (h + 1) & mask)
+  {
+    d = a->hash[h] - 1;
+    if (!strncmp(a->names + a->name[d], path, len) && a->names[a->name[d] + len] == '\0')
+      return d;
+  }
+
+  if (a->names_len + len + 1 > a->names_alloc)
+  {
+    size_t want = a->names_alloc ? a->names_alloc * 2 : 4096;
+    char *n;
+
+    while (want < a->names_len + len + 1)
+      want *= 2;
+    if ((n = (char *) realloc (a->names, want)) == NULL)
+    {
+      a->error = ENOMEM;
+      return MDT_NONE;
+    }
+    a->names = n;
+    a->names_alloc = want;
+  }
+
+  d = a->count++;
+  a->name[d] = a->names_len;
+  memcpy (a->names + a->names_len, path, len);
+  a->names[a->names_len + len] = '\0';
+  a->names_len += len + 1;
+
+  a->read[d] = a->unread[d] = 0;
+  a->flags[d] = 0;
+  if (a->ages)
+    mdt_clear_ages (&a->ages[d]);
+
+  a->hash[h] = d + 1;
+  return d;
+}
+
+/* grow: double the directory arrays and the hash table along with them. */
+static int grow (struct archive *a)
+{
+  size_t want = a->alloc ? a->alloc * 2 : 256, h, i, mask;
+  unsigned int *hash, d;
+  const char *name;
+
+#define GROW(field, type) \
+  do { \
+    type *n = (type *) realloc (a->field, want * sizeof(type)); \
+    if (n == NULL) \
+      return -1; \
+    a->field = n; \
+  } while (0)
+
+  GROW(name, unsigned int);
+  GROW(read, unsigned int);
+  GROW(unread, unsigned int);
+  GROW(flags, unsigned char);
+  if (a->opts->ages)
+    GROW(ages, struct mdt_ages);
+
+#undef GROW
+
+  a->alloc = want;
+
+  if ((hash = (unsigned int *) calloc (2 * want, sizeof(unsigned int))) == NULL)
+    return -1;
+
+  mask = 2 * want - 1;
+  for (i = 0; i < a->count; i++)
+  {
+    name = a->names + a->name[i];
+    for (h = hash_path(name, strlen(name)) & mask; hash[h] != 0; h = (h + 1) & mask)
+      ;
+    d = (unsigned int) i;
+    hash[h] = d + 1;
+  }
+
+  free (a->hash);
+  a->hash = hash;
+  a->hash_size = 2 * want;
+  return 0;
+}
+
+static inline size_t hash_path (const char *path, size_t len)
+{
+  size_t h = 2166136261u, i;
+
+  for (i = 0; i < len; i++)
+  {
+    h ^= (unsigned char) path[i];
+    h *= 16777619u;
+  }
+
+  return h ^ (h >> 15);
+}
+
+/* find_root: the Maildir is the shallowest directory with a cur/ or
+ * new/ in it, the first one in the archive if there are several. */
+static unsigned int find_root (struct archive *a)
+{
+  unsigned int best = MDT_NONE, depth, best_depth = UINT_MAX;
+  const char *p;
+  size_t i;
+
+  for (i = 0; i < a->count; i++)
+  {
+    if (!(a->flags[i] & (HAS_CUR | HAS_NEW)))
+      continue;
+
+    for (depth = 0, p = a->names + a->name[i]; *p; p++)
+      depth += (*p == '/');
+    depth += (a->names[a->name[i]] != '\0');
+
+    if (depth < best_depth)
+    {
+      best = (unsigned int) i;
+      best_depth = depth;
+    }
+  }
+
+  return best;
+}
+
+/* is_child: whether directory i sits right below the root, as readdir()
+ * of the extracted root would find it; its name goes in *name. */
+static int is_child (struct archive *a, unsigned int root, unsigned int i, const char **name)
+{
+  const char *r = a->names + a->name[root], *p = a->names + a->name[i];
+  size_t rlen = strlen(r);
+
+  if (i == root)
+    return 0;
+
+  if (rlen > 0)
+  {
+    if (strncmp(p, r, rlen) != 0 || p[rlen] != '/')
+      return 0;
+    p += rlen + 1;
+  }
+
+  if (*p == '\0' || strchr(p, '/') != NULL)
+    return 0;
+
+  *name = p;
+  return 1;
+}
+
+static void archive_free (struct archive *a)
+{
+  free (a->names);
+  free (a->name);
+  free (a->read);
+  free (a->unread);
+  free (a->flags);
+  free (a->ages);
+  free (a->hash);
+  memset (a, 0, sizeof(*a));
+}
+
+/* tar_number: an octal field, or a big-endian binary one if the high
+ * bit of its first byte is set (GNU, for sizes of 8GB and up). */
+static uint64_t tar_number (const unsigned char *p, size_t n)
+{
+  uint64_t v = 0;
+  size_t i = 0;
+
+  if (p[0] & 0x80)
+  {
+    v = p[0] & 0x7f;
+    for (i = 1; i < n; i++)
+      v = (v << 8) | p[i];
+    return v;
+  }
+
+  while (i < n && (p[i] == ' ' || p[i] == '\0'))
+    i++;
+  for (; i < n && p[i] >= '0' && p[i] <= '7'; i++)
+    v = v * 8 + (p[i] - '0');
+
+  return v;
+}
+
+/* tar_checksum: the sum of the header bytes, with the checksum field
+ * itself counting as spaces. */
+static int tar_checksum (const unsigned char *hdr)
+{
+  unsigned long sum = 0;
+  int i;
+
+  for (i = 0; i < BLOCK; i++)
+    sum += (i >= 148 && i < 156) ? ' ' : hdr[i];
+
+  return sum == tar_number(hdr + 148, 8);
+}
+
+/* src_open: open 'path', telling compressed archives by their magic. */
+static int src_open (struct source *src, const char *path)
+{
+  unsigned char magic [4];
+  ssize_t got;
+
+  memset (src, 0, sizeof(*src));
+
+  if ((src->fd = open(path, O_RDONLY)) < 0)
+    return -1;
+
+  got = pread(src->fd, magic, sizeof(magic), 0);
+
+  if (got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    src->kind = GZIP;
+  else if (got >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 &&
+           magic[2] == 0x2f && magic[3] == 0xfd)
+    src->kind = ZSTD;
+  else
+    src->kind = RAW;
+
+  if ((src->buf = (unsigned char *) malloc (BUFFER)) == NULL)
+    goto fail;
+
+  switch (src->kind)
+  {
+    case GZIP:
+#ifdef WITH_GZIP
+      if ((src->gz = gzdopen(src->fd, "rb")) == NULL)
+        goto fail;
+      gzbuffer (src->gz, BUFFER);
+      break;
+#else
+      errno = ENOTSUP;
+      goto fail;
+#endif
+
+    case ZSTD:
+#ifdef WITH_ZSTD
+      if ((src->zs = ZSTD_createDStream()) == NULL ||
+          (src->inbuf = (unsigned char *) malloc (ZSTD_DStreamInSize())) == NULL)
+        goto fail;
+      ZSTD_initDStream (src->zs);
+      src->in.src = src->inbuf;
+      break;
+#else
+      errno = ENOTSUP;
+      goto fail;
+#endif
+  }
+
+  return 0;
+
+fail:
+  src_close (src);
+  return -1;
+}
+
+/* src_read: read n bytes; fewer only at the end of the archive. */
+static long src_read (struct source *src, void *buf, size_t n)
+{
+  size_t done = 0, take;
+  long got;
+
+  while (done < n)
+  {
+    if (src->pos == src->len)
+    {
+      if ((got = src_fill(src)) < 0)
+        return -1;
+      if (got == 0)
+        break;
+    }
+
+    take = src->len - src->pos;
+    if (take > n - done)
+      take = n - done;
+    memcpy ((char *) buf + done, src->buf + src->pos, take);
+    src->pos += take;
+    done += take;
+  }
+
+  return (long) done;
+}
+
+static int src_skip (struct source *src, uint64_t n)
+{
+  size_t take;
+  long got;
+
+  take = src->len - src->pos;
+  if (take > n)
+    take = (size_t) n;
+  src->pos += take;
+  n -= take;
+
+  if (n == 0)
+    return 0;
+
+  /* Only whole buffers left to skip */
+  if (src->kind == RAW && lseek(src->fd, (off_t) n, SEEK_CUR) != (off_t) -1)
+    return 0;
+
+  while (n > 0)
+  {
+    if ((got = src_fill(src)) < 0)
+      return -1;
+    if (got == 0)
+      return 0;
+
+    take = (got > 0 && (uint64_t) got > n) ? (size_t) n : (size_t) got;
+    src->pos = take;
+    n -= take;
+  }
+
+  return 0;
+}
+
+/* src_fill: replace the buffer with the next stretch of the archive. */
+static long src_fill (struct source *src)
+{
+  long got = 0;
+
+  src->pos = src->len = 0;
+
+  switch (src->kind)
+  {
+    case RAW:
+      do
+        got = read(src->fd, src->buf, BUFFER);
+      while (got < 0 && errno == EINTR);
+      break;
+
+#ifdef WITH_GZIP
+    case GZIP:
+      got = gzread(src->gz, src->buf, BUFFER);
+      break;
+#endif
+
+#ifdef WITH_ZSTD
+    case ZSTD:
+    {
+      ZSTD_outBuffer out;
+      size_t r;
+      ssize_t in;
+
+      out.dst = src->buf;
+      out.size = BUFFER;
+      out.pos = 0;
+
+      /* A block can decode to more than the buffer holds, so zstd may
+       * still have output once the file is all read; it is asked again
+       * with no input until it has none left. */
+      for (;;)
+      {
+        if (src->in.pos == src->in.size && !src->eof)
+        {
+          do
+            in = read(src->fd, src->inbuf, ZSTD_DStreamInSize());
+          while (in < 0 && errno == EINTR);
+
+          if (in < 0)
+            return -1;
+          src->eof = (in == 0);
+          src->in.size = (size_t) in;
+          src->in.pos = 0;
+        }
+
+        r = ZSTD_decompressStream(src->zs, &out, &src->in);
+        if (ZSTD_isError(r))
+        {
+          errno = EIO;
+          return -1;
+        }
+
+        if (out.pos > 0 || src->eof)
+          break;
+      }
+
+      got = (long) out.pos;
+      break;
+    }
+#endif
+  }
+
+  if (got > 0)
+    src->len = (size_t) got;
+
+  return got;
+}
+
+static void src_close (struct source *src)
+{
+#ifdef WITH_GZIP
+  if (src->gz)
+    gzclose (src->gz);  /* closes fd as well */
+  else
+#endif
+  if (src->fd >= 0)
+    close (src->fd);
+
+#ifdef WITH_ZSTD
+  if (src->zs)
+    ZSTD_freeDStream (src->zs);
+  free (src->inbuf);
+#endif
+
+  free (src->buf);
+}
+
+static void warn (const struct mdt_options *opts, const char *fmt, const char *what)
+{
+  char msg [PATH_MAX + 64];
+
+  if (opts->warn == NULL)
+    return;
+
+  snprintf (msg, sizeof(msg), fmt, what);
+  opts->warn (opts->warn_arg, msg);
+}
@@ -0,0 +1,453 @@
+/* browse.c: --interactive, a terminal browser of the folder tree that
+ * only counts what is on the screen. See maildirtree.c for full
+ * copyright.
+ *
+ * Listing the folders takes one readdir() of the root; counting them
+ * takes two more per folder, and on a big archive mailbox that is where
+ * the minutes go. So the tree is laid out from the names alone, and a
+ * folder is only counted once its row is shown, by a few worker threads
+ * that take folders off a stack (so that the rows shown last, which are
+ * the ones being looked at, come first). Counts are kept until the
+ * browser exits, or until asked for again with 'r'. */
+
+#include "config.h"
+
+#include "maildirtree.h"
+#include "snprintf.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <dirent.h>
+#include <errno.h>
+
+#ifdef HAVE_CURSES
+#include <curses.h>
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#include <pthread.h>
+#define WORKERS 4
+#define LOCK(b)   pthread_mutex_lock (&(b)->lock)
+#define UNLOCK(b) pthread_mutex_unlock (&(b)->lock)
+#else
+#define LOCK(b)
+#define UNLOCK(b)
+#endif
+
+/* How often the screen is brought up to date while counts come in, in
+ * milliseconds */
+#define REDRAW_INTERVAL 100
+
+enum { UNCOUNTED, QUEUED, COUNTED };
+
+struct browser
+{
+  const char *dir;
+  struct mdt_tree *t;        /* the folders; counts filled in as we go */
+  unsigned char *state;      /* of each folder */
+  bool *open;                /* whether its subfolders are shown */
+
+  unsigned int *rows;        /* folders shown, top to bottom */
+  size_t nrows, top, cur;    /* first row on the screen, selected row */
+
+  /* Folders waiting to be counted */
+  unsigned int *stack;
+  size_t queued;
+  unsigned int pending;      /* queued, or being counted */
+
+#ifdef WORKERS
+  pthread_mutex_t lock;      /* of all the above that workers touch */
+  pthread_cond_t work;
+#endif
+};
+
+static struct mdt_tree * list_folders (const char *);
+static void lay_out (struct browser *);
+static void draw (struct browser *);
+static void draw_row (struct browser *, int, unsigned int);
+static void push (struct browser *, unsigned int);
+static void count_one (struct browser *, unsigned int);
+#ifdef WORKERS
+static void * worker (void *);
+#endif
+
+/* browse_main: browse the Maildir at 'dir' until the user quits. */
+int browse_main (const char *dir)
+{
+  struct browser b;
+  struct mdt_tree *t;
+  unsigned int i;
+  bool quit = false;
+  int key, page;
+#ifdef WORKERS
+  pthread_t thread;
+  int w;
+#endif
+
+  if ((t = list_folders(dir)) == NULL)
+  {
+    printf ("maildirtree: %s: %s\n", dir, strerror(errno));
+    return 1;
+  }
+
+  memset (&b, 0, sizeof(b));
+  b.dir = dir;
+  b.t = t;
+  b.state = (unsigned char *) calloc (t->count, 1);
+  b.open = (bool *) calloc (t->count, sizeof(bool));
+  b.rows = (unsigned int *) malloc (t->count * sizeof(unsigned int));
+  b.stack = (unsigned int *) malloc (t->count * sizeof(unsigned int));
+  if (!b.state || !b.open || !b.rows || !b.stack)
+  {
+    printf ("maildirtree: out of memory\n");
+    return 1;
+  }
+
+  /* The root starts out open, everything below it closed. */
+  b.open[0] = true;
+  lay_out (&b);
+
+#ifdef WORKERS
+  pthread_mutex_init (&b.lock, NULL);
+  pthread_cond_init (&b.work, NULL);
+  for (w = 0; w < WORKERS; w++)
+    if (pthread_create(&thread, NULL, &worker, &b) == 0)
+      pthread_detach (thread);
+#endif
+
+  initscr ();
+  cbreak ();
+  noecho ();
+  keypad (stdscr, TRUE);
+  curs_set (0);
+
+  while (!quit)
+  {
+    draw (&b);
+
+    /* Wait for a key, looking in now and then while counting goes on.
+     * Without threads, the counting is done here, one folder at a time. */
+    LOCK(&b);
+#ifdef WORKERS
+    timeout (b.pending > 0 ? REDRAW_INTERVAL : -1);
+#else
+    timeout (b.pending > 0 ? 0 : -1);
+#endif
+    UNLOCK(&b);
+
+    if ((key = getch()) == ERR)
+    {
+#ifndef WORKERS
+      if (b.queued > 0)
+        count_one (&b, b.stack[--b.queued]);
+#endif
+      continue;
+    }
+
+    page = (LINES > 2) ? LINES - 2 : 1;
+    i = b.rows[b.cur];
+
+    switch (key)
+    {
+      case 'q':
+        quit = true;
+        break;
+
+      case KEY_UP: case 'k':
+        if (b.cur > 0)
+          b.cur--;
+        break;
+
+      case KEY_DOWN: case 'j':
+        if (b.cur + 1 < b.nrows)
+          b.cur++;
+        break;
+
+      case KEY_PPAGE:
+        b.cur = (b.cur > (size_t) page) ? b.cur - page : 0;
+        break;
+
+      case KEY_NPAGE:
+        b.cur = (b.cur + page < b.nrows) ? b.cur + page : b.nrows - 1;
+        break;
+
+      case KEY_HOME: case 'g':
+        b.cur = 0;
+        break;
+
+      case KEY_END: case 'G':
+        b.cur = b.nrows - 1;
+        break;
+
+      case KEY_RIGHT: case 'l':
+        if (t->size[i] > 1 && !b.open[i])
+        {
+          b.open[i] = true;
+          lay_out (&b);
+        }
+        break;
+
+      case '\n': case ' ': case KEY_ENTER:
+        if (t->size[i] > 1)
+        {
+          b.open[i] = !b.open[i];
+          lay_out (&b);
+        }
+        break;
+
+      case KEY_LEFT: case 'h':
+        /* Close it, or else go up to its parent */
+        if (b.open[i] && t->size[i] > 1)
+          b.open[i] = false;
+        else if (i > 0)
+          while (b.cur > 0 && b.rows[b.cur] != t->parent[i])
+            b.cur--;
+        lay_out (&b);
+        break;
+
+      case 'r':
+        LOCK(&b);
+        if (b.state[i] == COUNTED)
+          b.state[i] = UNCOUNTED;
+        UNLOCK(&b);
+        break;
+    }
+  }
+
+  endwin ();
+
+  /* Workers may still be counting; they go away with us. */
+  return 0;
+}
+
+/* list_folders: the folders of the Maildir at 'dir', as one readdir()
+ * finds them, without counting any. Entries readdir() says nothing
+ * about are stat()ed, which is as far as we go. */
+static struct mdt_tree * list_folders (const char *dir)
+{
+  struct mdt_builder *b;
+  struct mdt_counts c;
+  struct dirent *e;
+  struct stat st;
+  char name [NAME_MAX + 1], *path;
+  size_t len = strlen(dir) + NAME_MAX + 2;
+  bool is_dir, is_file;
+  DIR *d;
+
+  if ((d = opendir(dir)) == NULL)
+    return NULL;
+
+  b = mdt_builder_new(mdt_root_name(dir, name, sizeof(name)), 0);
+  path = (char *) malloc (len);
+  if (b == NULL || path == NULL)
+  {
+    closedir (d);
+    mdt_builder_free (b);
+    free (path);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  memset (&c, 0, sizeof(c));
+  mdt_insert (b, "", &c);
+
+  while ((e = readdir(d)) != NULL)
+  {
+    if (!strcmp(e->d_name, ".") ||
+        !strcmp(e->d_name, "..") ||
+        !strcmp(e->d_name, "cur") ||
+        !strcmp(e->d_name, "new") ||
+        !strcmp(e->d_name, "tmp"))
+      continue;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+    is_dir = e->d_type == DT_DIR;
+    is_file = e->d_type == DT_REG;
+    if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK)
+#endif
+    {
+      snprintf (path, len, "%s/%s", dir, e->d_name);
+      if (stat(path, &st) != 0)
+        continue;
+      is_dir = S_ISDIR(st.st_mode);
+      is_file = S_ISREG(st.st_mode);
+    }
+
+    /* Whether an mbox really is one is left for its turn to count. */
+    if (is_dir || (is_file && options.mbox))
+    {
+      c.flags = is_dir ? 0 : MDT_MBOX;
+      mdt_insert (b, e->d_name, &c);
+    }
+  }
+
+  closedir (d);
+  free (path);
+
+  return mdt_finish (b);
+}
+
+/* lay_out: which folders are shown, given which are open. */
+static void lay_out (struct browser *b)
+{
+  const struct mdt_tree *t = b->t;
+  unsigned int sel = b->nrows ? b->rows[b->cur] : 0;
+  size_t i;
+
+  b->nrows = 0;
+  for (i = 0; i < t->count; i += b->open[i] ? 1 : t->size[i])
+    b->rows[b->nrows++] = i;
+
+  /* Stay on the same folder, or the nearest one above it still shown */
+  for (b->cur = b->nrows - 1; b->cur > 0 && b->rows[b->cur] > sel; b->cur--)
+    ;
+}
+
+static void draw (struct browser *b)
+{
+  const struct mdt_tree *t = b->t;
+  unsigned int total_read = 0, total_unread = 0;
+  size_t i, height = (LINES > 1) ? LINES - 1 : 1;
+  int y;
+
+  /* Keep the selection on the screen */
+  if (b->cur < b->top)
+    b->top = b->cur;
+  if (b->cur >= b->top + height)
+    b->top = b->cur - height + 1;
+
+  erase ();
+  LOCK(b);
+
+  /* Bottom up, so that the top rows are counted first */
+  for (y = height - 1; y >= 0; y--)
+    if (b->top + y < b->nrows && b->state[b->rows[b->top + y]] == UNCOUNTED &&
+        !(t->flags[b->rows[b->top + y]] & MDT_DUMMY))
+      push (b, b->rows[b->top + y]);
+
+  for (y = 0; (size_t) y < height && b->top + y < b->nrows; y++)
+    draw_row (b, y, b->rows[b->top + y]);
+
+  for (i = 0; i < t->count; i++)
+    if (b->state[i] == COUNTED)
+    {
+      total_read += t->read[i];
+      total_unread += t->unread[i];
+    }
+
+  mvprintw (LINES - 1, 0, "%s: %u/%u counted so far", b->dir, total_unread,
+            total_read + total_unread);
+  if (b->pending > 0)
+    printw (", %u folder%s to go", b->pending, b->pending > 1 ? "s" : "");
+  printw ("  [enter] open [r] recount [q] quit");
+
+  UNLOCK(b);
+  refresh ();
+}
+
+/* draw_row: folder i on line y, indented by its depth, with a + or - in
+ * front if it has subfolders. Called with the lock held. */
+static void draw_row (struct browser *b, int y, unsigned int i)
+{
+  const struct mdt_tree *t = b->t;
+  int x;
+
+  mvprintw (y, 0, "%*s%c %s", (int) t->depth[i] * INDENT_LEN, "",
+            t->size[i] > 1 ? (b->open[i] ? '-' : '+') : ' ',
+            t->names + t->name[i]);
+
+  getyx (stdscr, y, x);
+  if (x < COUNT_START)
+    move (y, COUNT_START);
+  else
+    addch (' ');
+
+  /* Dummies have nothing to count */
+  if (!(t->flags[i] & MDT_DUMMY))
+  {
+    if (b->state[i] != COUNTED)
+      addstr ("(...)");
+    else
+    {
+      if (t->unread[i] > 0)
+        attron (A_BOLD);
+      printw ("(%u/%u)", t->unread[i], t->read[i] + t->unread[i]);
+      attroff (A_BOLD);
+    }
+  }
+
+  if (b->rows[b->cur] == i)
+    mvchgat (y, 0, -1, A_REVERSE, 0, NULL);
+}
+
+/* push: queue folder i for counting. Called with the lock held. */
+static void push (struct browser *b, unsigned int i)
+{
+  b->state[i] = QUEUED;
+  b->stack[b->queued++] = i;
+  b->pending++;
+
+#ifdef WORKERS
+  pthread_cond_signal (&b->work);
+#endif
+}
+
+/* count_one: count folder i, without the lock. */
+static void count_one (struct browser *b, unsigned int i)
+{
+  const struct mdt_tree *t = b->t;
+  struct mdt_counts c;
+  size_t len = strlen(b->dir) + strlen(t->names + t->path[i]) + 2;
+  char *path;
+
+  if ((path = (char *) malloc (len)) != NULL)
+  {
+    snprintf (path, len, "%s/%s", b->dir, t->names + t->path[i]);
+    mdt_count_folder (path, &options, &c);
+    free (path);
+  }
+  else
+    memset (&c, 0, sizeof(c));
+
+  LOCK(b);
+  t->read[i] = c.read;
+  t->unread[i] = c.unread;
+  b->state[i] = COUNTED;
+  b->pending--;
+  UNLOCK(b);
+}
+
+#ifdef WORKERS
+static void * worker (void *arg)
+{
+  struct browser *b = (struct browser *) arg;
+  unsigned int i;
+
+  for (;;)
+  {
+    LOCK(b);
+    while (b->queued == 0)
+      pthread_cond_wait (&b->work, &b->lock);
+    i = b->stack[--b->queued];
+    UNLOCK(b);
+
+    count_one (b, i);
+  }
+
+  return NULL;
+}
+#endif
+
+#else /* no curses */
+
+int browse_main (const char *dir)
+{
+  (void) dir;
+  printf ("maildirtree: --interactive needs curses, which this build lacks\n");
+  return 1;
+}
+
+#endif
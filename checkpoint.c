@@ -0,0 +1,902 @@
+/* checkpoint.c: --checkpoint and --resume, so that a long run over many
+ * maildirs can pick up where it was stopped. See maildirtree.c for full
+ * copyright.
+ *
+ * Whatever has been counted goes into a journal, a text file that is
+ * only ever appended to, one record per line with tab-separated fields
+ * (tabs, newlines and backslashes in names are escaped C-style):
+ *
+ *   maildirtree checkpoint 1 <options>   first line; the options that
+ *                                        change counts must match
+ *   S <id> <path>                        starting on a maildir
+ *   F <id> <folder> <flags> <read> <unread> [<oldest> <newest> <buckets>]
+ *     [<digest>]                         one folder of it, as .Foo.Bar;
+ *                                        ages and digest (in hex) only
+ *                                        if the options asked for them
+ *   R <id> <name>                        all of it done; the root's name
+ *
+ * Records are collected in memory and written out whole lines at a time
+ * by a single write(), at least every FLUSH_INTERVAL seconds and at the
+ * end of every maildir, then synced to disk. A run that is killed can
+ * only leave the last line short, which --resume cuts off before
+ * appending to it.
+ *
+ * On resume, a maildir with an R record is not looked at again at all,
+ * and of one without, only the folders not yet recorded are counted.
+ * Either way the tree is laid out afresh from the counts, so the output
+ * is the same as that of a run that was never stopped.
+ *
+ * With --shard K/N, the journal is the part file of shard K: it has the
+ * shard in its first line, and only the folders whose top-level folder
+ * hashes to K, but the S and R records of every maildir. --merge loads
+ * the parts of all N shards together and prints what they add up to.
+ * Maildirs are told apart, and folders split among the shards, by the
+ * path as given on the command line, so every shard has to be given
+ * the same one: Mail and /home/joe/Mail are different maildirs here. */
+
+#include "config.h"
+
+#include "maildirtree.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#define JOURNAL_MAGIC  "maildirtree checkpoint 1"
+
+/* When to write out what has been collected */
+#define FLUSH_SIZE     (64 * 1024)
+#define FLUSH_INTERVAL 1
+
+struct root
+{
+  char *path;
+  char *name;              /* from the R record; NULL until then */
+  unsigned int first;      /* its first folder, chained by 'next' */
+  unsigned int id;         /* in the S record of this run, or MDT_NONE */
+  unsigned int parts;      /* how many part files have its R record */
+  int last_part;           /* the last of them */
+};
+
+struct folder
+{
+  unsigned int root, next;
+  char *name;
+  struct mdt_counts c;
+};
+
+/* What one checkpoint_scan() hands its callbacks */
+struct run
+{
+  const char *path;
+  unsigned int root;
+  struct mdt_builder *b;
+  bool whole;              /* an archive; whoever reads it takes all */
+};
+
+static struct
+{
+  int fd;
+  char *buf;
+  size_t len, alloc;
+  time_t flushed;
+  bool failed;
+
+  struct root *roots;
+  size_t nroots, roots_alloc;
+  struct folder *folders;
+  size_t nfolders, folders_alloc;
+
+  /* Open-addressed hashes of the above by path, and by root and name;
+   * 0 is a free slot, everything else an index plus one. */
+  unsigned int *root_hash, *folder_hash;
+  size_t root_hash_size, folder_hash_size;
+
+  /* Journal ids to roots, for reading it; ids of this run follow on. */
+  unsigned int *ids;
+  size_t nids;
+} j;
+
+static const char * header (void);
+static off_t load (FILE *, bool, int);
+static bool part_header (const char *, int);
+static bool mine (const char *, const char *);
+static bool parse_folder (char **, int, struct mdt_counts *);
+static unsigned int find_root (const char *, bool);
+static unsigned int find_folder (unsigned int, const char *);
+static unsigned int add_folder (unsigned int, const char *, const struct mdt_counts *);
+static struct mdt_tree * replay (unsigned int);
+static unsigned int columns (void);
+static bool lookup (void *, const char *, struct mdt_counts *);
+static int record (void *, const char *, const struct mdt_counts *);
+static void put_folder (unsigned int, const char *, const struct mdt_counts *);
+static void put_field (const char *);
+static void put (const char *, size_t);
+static void flush (bool);
+static int split (char *, char **, int);
+static void unescape (char *);
+static inline size_t hash_str (unsigned int, const char *);
+
+/* checkpoint_open: start journalling to 'file', first reading what is
+ * in it already if we are to resume. */
+int checkpoint_open (const char *file, bool resume)
+{
+  FILE *fp;
+  off_t good = 0;
+
+  j.fd = -1;
+
+  if (resume && (fp = fopen(file, "r")) != NULL)
+  {
+    good = load (fp, false, 0);
+    fclose (fp);
+
+    if (good < 0)
+    {
+      printf ("maildirtree: %s: not a checkpoint, or one made with other options\n", file);
+      return -1;
+    }
+  }
+
+  if ((j.fd = open(file, O_WRONLY | O_CREAT | O_APPEND | (resume ? 0 : O_TRUNC), 0644)) < 0 ||
+      ftruncate(j.fd, good) != 0)
+  {
+    printf ("maildirtree: %s: %s\n", file, strerror(errno));
+    return -1;
+  }
+
+  if (good == 0)
+  {
+    put (header(), strlen(header()));
+    put ("\n", 1);
+    flush (true);
+  }
+
+  j.flushed = time(NULL);
+  return 0;
+}
+
+void checkpoint_close (void)
+{
+  if (j.fd < 0)
+    return;
+
+  flush (true);
+  close (j.fd);
+  j.fd = -1;
+}
+
+/* checkpoint_scan: mdt_scan() of 'path', journalled, and skipping what
+ * the journal has already. */
+struct mdt_tree * checkpoint_scan (const char *path)
+{
+  struct mdt_options opts = options;
+  struct mdt_tree *t;
+  struct run run;
+  struct stat st;
+  char name [NAME_MAX + 1], id [16];
+  unsigned int r;
+  size_t i;
+  int err;
+
+  if ((r = find_root(path, true)) == MDT_NONE)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  if (j.roots[r].name)
+    return replay (r);
+
+  if (j.roots[r].id == MDT_NONE)
+  {
+    j.roots[r].id = j.nids++;
+    snprintf (id, sizeof(id), "S\t%u\t", j.roots[r].id);
+    put (id, strlen(id));
+    put_field (path);
+    put ("\n", 1);
+  }
+
+  run.path = path;
+  run.root = r;
+  run.b = NULL;
+  run.whole = stat(path, &st) == 0 && S_ISREG(st.st_mode);
+
+  if (run.whole && !mine(path, ""))
+  {
+    /* Another shard's archive; its name is for that one to say. */
+    if ((run.b = mdt_builder_new("", 0)) == NULL || (t = mdt_finish(run.b)) == NULL)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+  }
+  else if (run.whole)
+  {
+    /* An archive is all or nothing. */
+    if ((t = mdt_scan(path, &options)) == NULL)
+      return NULL;
+
+    for (i = 0; i < t->count; i++)
+      if (!(t->flags[i] & MDT_DUMMY))
+      {
+        struct mdt_counts c;
+
+        memset (&c, 0, sizeof(c));
+        c.read = t->read[i];
+        c.unread = t->unread[i];
+        c.flags = t->flags[i];
+        if (t->ages)
+          c.ages = t->ages[i];
+        if (t->digest)
+          c.digest = t->digest[i];
+        record (&run, t->names + t->path[i], &c);
+      }
+  }
+  else
+  {
+    run.b = mdt_builder_new(mdt_root_name(path, name, sizeof(name)), columns());
+    if (run.b == NULL)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+    mdt_builder_sort (run.b, options.sort);
+
+    opts.lookup = &lookup;
+    opts.lookup_arg = &run;
+
+    if (mdt_walk(path, &opts, &record, &run) != 0)
+    {
+      err = errno;
+      mdt_builder_free (run.b);
+      flush (false);
+      errno = err;
+      return NULL;
+    }
+
+    if ((t = mdt_finish(run.b)) == NULL)
+      return NULL;
+  }
+
+  /* Done, unless the deadline cut anything short */
+  if (t->folders_partial == 0)
+  {
+    snprintf (id, sizeof(id), "R\t%u\t", j.roots[r].id);
+    put (id, strlen(id));
+    put_field (t->names + t->name[0]);
+    put ("\n", 1);
+  }
+
+  flush (true);
+  return t;
+}
+
+/* merge_main: print the maildirs of the part files of all shards of a
+ * run, as that run would have without --shard. */
+int merge_main (char **files, int n)
+{
+  struct mdt_tree *t;
+  bool *seen = NULL, digests = options.digest;
+  unsigned int r;
+  FILE *fp;
+  int i, ret = 1;
+
+  for (i = 0; i < n; i++)
+  {
+    if ((fp = fopen(files[i], "r")) == NULL)
+    {
+      printf ("maildirtree: %s: %s\n", files[i], strerror(errno));
+      goto out;
+    }
+
+    if (load(fp, true, i) <= 0)
+    {
+      printf ("maildirtree: %s: not a part file, or one of another run\n", files[i]);
+      fclose (fp);
+      goto out;
+    }
+    fclose (fp);
+
+    if (seen == NULL && (seen = (bool *) calloc (shard_n, sizeof(bool))) == NULL)
+    {
+      printf ("maildirtree: out of memory\n");
+      goto out;
+    }
+
+    if (seen[shard_k - 1])
+    {
+      printf ("maildirtree: %s: shard %u/%u twice\n", files[i], shard_k, shard_n);
+      goto out;
+    }
+    seen[shard_k - 1] = true;
+  }
+
+  if (n == 0 || (unsigned int) n != shard_n)
+  {
+    printf ("maildirtree: have %d of %u shards\n", n, n ? shard_n : 0);
+    goto out;
+  }
+
+  /* Digests can only come from part files that have them. */
+  if (digests && !options.digest)
+  {
+    printf ("maildirtree: the part files were made without --digest\n");
+    goto out;
+  }
+
+  /* A maildir given to the shards as different strings (Mail and
+   * ./Mail) shows up as two, each finished by none of them. */
+  for (r = 0; r < j.nroots; r++)
+  {
+    if (j.roots[r].parts != shard_n)
+    {
+      printf ("maildirtree: %s: not finished by every shard\n", j.roots[r].path);
+      goto out;
+    }
+
+    if ((t = replay(r)) == NULL)
+    {
+      printf ("maildirtree: %s: %s\n", j.roots[r].path, strerror(errno));
+      goto out;
+    }
+
+    if (digests)
+      print_digests (stdout, t);
+    else
+      report (stdout, t, j.roots[r].path, NULL);
+    mdt_free (t);
+    puts ("");
+  }
+
+  ret = 0;
+
+out:
+  free (seen);
+  return ret;
+}
+
+/* header: the first line of a journal, with the options that a resumed
+ * run must have as well for the counts to mean the same. */
+static const char * header (void)
+{
+  static char h [128];
+  int len;
+
+  len = snprintf (h, sizeof(h), JOURNAL_MAGIC "\tages=%d mbox=%d mbox-status=%d dovecot=%d digest=%d",
+                  options.ages, options.mbox, options.mbox_status, options.dovecot,
+                  options.digest);
+  if (shard_n)
+    snprintf (h + len, sizeof(h) - len, "\tshard=%u/%u", shard_k, shard_n);
+  return h;
+}
+
+/* part_header: whether 'line' starts a part file of the same run as
+ * the ones before it. The first one says which options that run had. */
+static bool part_header (const char *line, int part)
+{
+  int ages, mbox, status, dovecot, digest;
+  unsigned int k, n;
+
+  if (sscanf(line, JOURNAL_MAGIC "\tages=%d mbox=%d mbox-status=%d dovecot=%d digest=%d\tshard=%u/%u",
+             &ages, &mbox, &status, &dovecot, &digest, &k, &n) != 7 || k == 0 || k > n)
+    return false;
+
+  if (part == 0)
+  {
+    options.ages = ages;
+    options.mbox = mbox;
+    options.mbox_status = status;
+    options.dovecot = dovecot;
+    options.digest = digest;
+    shard_n = n;
+  }
+  shard_k = k;
+
+  return strcmp(line, header()) == 0;
+}
+
+/* load: read a journal, or with 'merging' the part file number 'part';
+ * returns how much of it is whole lines, or -1 if it is not a journal
+ * made with our options. */
+static off_t load (FILE *fp, bool merging, int part)
+{
+  char *line = NULL, *f[16];
+  size_t size = 0;
+  ssize_t len;
+  off_t good = 0;
+  unsigned int id, r;
+  struct mdt_counts c;
+  int n;
+
+  /* Ids are only good within one file. */
+  j.nids = 0;
+
+  while ((len = getline(&line, &size, fp)) > 0 && line[len - 1] == '\n')
+  {
+    line[len - 1] = '\0';
+
+    if (good == 0)
+    {
+      if (merging ? !part_header(line, part) : strcmp(line, header()) != 0)
+      {
+        free (line);
+        return -1;
+      }
+      good = len;
+      continue;
+    }
+
+    good += len;
+
+    if ((n = split(line, f, 16)) < 3)
+      continue;
+
+    id = (unsigned int) strtoul(f[1], NULL, 10);
+
+    if (!strcmp(f[0], "S"))
+    {
+      unsigned int *nids;
+
+      if (id >= j.nids)
+      {
+        if ((nids = (unsigned int *) realloc (j.ids, (id + 1) * sizeof(unsigned int))) == NULL)
+          break;
+        while (j.nids <= id)
+          nids[j.nids++] = MDT_NONE;
+        j.ids = nids;
+      }
+
+      unescape (f[2]);
+      j.ids[id] = find_root(f[2], true);
+      continue;
+    }
+
+    if (id >= j.nids || (r = j.ids[id]) == MDT_NONE)
+      continue;
+
+    if (!strcmp(f[0], "F") && parse_folder(f, n, &c))
+    {
+      unescape (f[2]);
+      if (find_folder(r, f[2]) == MDT_NONE)
+        add_folder (r, f[2], &c);
+    }
+    else if (!strcmp(f[0], "R"))
+    {
+      unescape (f[2]);
+
+      if (j.roots[r].last_part != part)
+      {
+        j.roots[r].parts++;
+        j.roots[r].last_part = part;
+      }
+
+      /* Only the shard that read an archive knows what it is called. */
+      if (j.roots[r].name == NULL || (!*j.roots[r].name && *f[2]))
+      {
+        free (j.roots[r].name);
+        j.roots[r].name = strdup(f[2]);
+      }
+    }
+  }
+
+  free (line);
+
+  /* None of the roots has been started on by this run yet. */
+  for (r = 0; r < j.nroots; r++)
+    j.roots[r].id = MDT_NONE;
+
+  return good;
+}
+
+/* parse_folder: the counts of an F record, split into f[0 .. n - 1]. */
+static bool parse_folder (char **f, int n, struct mdt_counts *c)
+{
+  int b, want = 6;
+
+  memset (c, 0, sizeof(*c));
+  mdt_clear_ages (&c->ages);
+
+  if (options.ages)
+    want += 2 + MDT_AGE_BUCKETS;
+  if (options.digest)
+    want++;
+  if (n != want)
+    return false;
+
+  c->flags = (unsigned char) strtoul(f[3], NULL, 10);
+  c->read = (unsigned int) strtoul(f[4], NULL, 10);
+  c->unread = (unsigned int) strtoul(f[5], NULL, 10);
+
+  if (options.ages)
+  {
+    c->ages.oldest = (time_t) strtol(f[6], NULL, 10);
+    c->ages.newest = (time_t) strtol(f[7], NULL, 10);
+    for (b = 0; b < MDT_AGE_BUCKETS; b++)
+      c->ages.bucket[b] = (unsigned int) strtoul(f[8 + b], NULL, 10);
+  }
+
+  if (options.digest &&
+      sscanf(f[n - 1], "%16llx%16llx", &c->digest.hi, &c->digest.lo) != 2)
+    return false;
+
+  return true;
+}
+
+/* find_root: the root for 'path', added if 'add' and not there yet. */
+static unsigned int find_root (const char *path, bool add)
+{
+  size_t h, mask = j.root_hash_size - 1, i;
+  struct root *nroots;
+  unsigned int *nhash, r;
+
+  if (j.root_hash_size)
+    for (h = hash_str(0, path) & mask; j.root_hash[h] != 0; h = (h + 1) & mask)
+      if (!strcmp(j.roots[j.root_hash[h] - 1].path, path))
+        return j.root_hash[h] - 1;
+
+  if (!add)
+    return MDT_NONE;
+
+  if (j.nroots == j.roots_alloc)
+  {
+    j.roots_alloc = j.roots_alloc ? j.roots_alloc * 2 : 64;
+    if ((nroots = (struct root *) realloc (j.roots, j.roots_alloc * sizeof(struct root))) == NULL)
+      return MDT_NONE;
+    j.roots = nroots;
+  }
+
+  /* Keep the hash at most half full */
+  if (2 * (j.nroots + 1) > j.root_hash_size)
+  {
+    size_t size = j.root_hash_size ? j.root_hash_size * 2 : 128;
+
+    if ((nhash = (unsigned int *) calloc (size, sizeof(unsigned int))) == NULL)
+      return MDT_NONE;
+
+    for (i = 0; i < j.nroots; i++)
+    {
+      for (h = hash_str(0, j.roots[i].path) & (size - 1); nhash[h] != 0; h = (h + 1) & (size - 1))
+        ;
+      nhash[h] = i + 1;
+    }
+
+    free (j.root_hash);
+    j.root_hash = nhash;
+    j.root_hash_size = size;
+    mask = size - 1;
+  }
+
+  r = j.nroots;
+  if ((j.roots[r].path = strdup(path)) == NULL)
+    return MDT_NONE;
+  j.roots[r].name = NULL;
+  j.roots[r].first = MDT_NONE;
+  j.roots[r].id = MDT_NONE;
+  j.roots[r].parts = 0;
+  j.roots[r].last_part = -1;
+  j.nroots++;
+
+  for (h = hash_str(0, path) & mask; j.root_hash[h] != 0; h = (h + 1) & mask)
+    ;
+  j.root_hash[h] = r + 1;
+
+  return r;
+}
+
+static unsigned int find_folder (unsigned int r, const char *name)
+{
+  size_t h, mask = j.folder_hash_size - 1;
+  const struct folder *f;
+
+  if (j.folder_hash_size == 0)
+    return MDT_NONE;
+
+  for (h = hash_str(r, name) & mask; j.folder_hash[h] != 0; h = (h + 1) & mask)
+  {
+    f = &j.folders[j.folder_hash[h] - 1];
+    if (f->root == r && !strcmp(f->name, name))
+      return j.folder_hash[h] - 1;
+  }
+
+  return MDT_NONE;
+}
+
+static unsigned int add_folder (unsigned int r, const char *name, const struct mdt_counts *c)
+{
+  size_t h, mask, i;
+  struct folder *nfolders;
+  unsigned int *nhash, n;
+
+  if (j.nfolders == j.folders_alloc)
+  {
+    j.folders_alloc = j.folders_alloc ? j.folders_alloc * 2 : 1024;
+    if ((nfolders = (struct folder *) realloc (j.folders, j.folders_alloc * sizeof(struct folder))) == NULL)
+      return MDT_NONE;
+    j.folders = nfolders;
+  }
+
+  if (2 * (j.nfolders + 1) > j.folder_hash_size)
+  {
+    size_t size = j.folder_hash_size ? j.folder_hash_size * 2 : 4096;
+
+    if ((nhash = (unsigned int *) calloc (size, sizeof(unsigned int))) == NULL)
+      return MDT_NONE;
+
+    for (i = 0; i < j.nfolders; i++)
+    {
+      for (h = hash_str(j.folders[i].root, j.folders[i].name) & (size - 1);
+           nhash[h] != 0; h = (h + 1) & (size - 1))
+        ;
+      nhash[h] = i + 1;
+    }
+
+    free (j.folder_hash);
+    j.folder_hash = nhash;
+    j.folder_hash_size = size;
+  }
+
+  n = j.nfolders;
+  if ((j.folders[n].name = strdup(name)) == NULL)
+    return MDT_NONE;
+  j.folders[n].root = r;
+  j.folders[n].c = *c;
+  j.folders[n].next = j.roots[r].first;
+  j.roots[r].first = n;
+  j.nfolders++;
+
+  mask = j.folder_hash_size - 1;
+  for (h = hash_str(r, name) & mask; j.folder_hash[h] != 0; h = (h + 1) & mask)
+    ;
+  j.folder_hash[h] = n + 1;
+
+  return n;
+}
+
+/* replay: the tree of a root the journal has all of. */
+static struct mdt_tree * replay (unsigned int r)
+{
+  struct mdt_builder *b;
+  unsigned int f;
+
+  if ((b = mdt_builder_new(j.roots[r].name, columns())) == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+  mdt_builder_sort (b, options.sort);
+
+  for (f = j.roots[r].first; f != MDT_NONE; f = j.folders[f].next)
+    mdt_insert (b, j.folders[f].name, &j.folders[f].c);
+
+  return mdt_finish (b);
+}
+
+/* columns: what the trees of the journal's folders have room for */
+static unsigned int columns (void)
+{
+  return (options.ages ? MDT_AGES : 0) | (options.digest ? MDT_DIGEST : 0);
+}
+
+/* lookup: mdt_options.lookup, the counts of a folder if journalled. */
+static bool lookup (void *arg, const char *name, struct mdt_counts *c)
+{
+  struct run *run = (struct run *) arg;
+  unsigned int f;
+
+  /* Another shard's; nothing to count */
+  if (!mine(run->path, name))
+  {
+    memset (c, 0, sizeof(*c));
+    return true;
+  }
+
+  if ((f = find_folder(run->root, name)) == MDT_NONE)
+    return false;
+
+  *c = j.folders[f].c;
+  return true;
+}
+
+/* record: mdt_walk() callback; into the tree with it, and into the
+ * journal too, unless it came from there. */
+static int record (void *arg, const char *name, const struct mdt_counts *c)
+{
+  struct run *run = (struct run *) arg;
+
+  if (!run->whole && !mine(run->path, name))
+    return 0;
+
+  if (run->b)
+    mdt_insert (run->b, name, c);
+
+  if (!(c->flags & MDT_PARTIAL) && find_folder(run->root, name) == MDT_NONE)
+    put_folder (j.roots[run->root].id, name, c);
+
+  return 0;
+}
+
+static void put_folder (unsigned int id, const char *name, const struct mdt_counts *c)
+{
+  char num [128];
+  int b, n;
+
+  snprintf (num, sizeof(num), "F\t%u\t", id);
+  put (num, strlen(num));
+  put_field (name);
+
+  n = snprintf (num, sizeof(num), "\t%u\t%u\t%u", c->flags, c->read, c->unread);
+  put (num, n);
+
+  if (options.ages)
+  {
+    n = snprintf (num, sizeof(num), "\t%ld\t%ld", (long) c->ages.oldest, (long) c->ages.newest);
+    put (num, n);
+    for (b = 0; b < MDT_AGE_BUCKETS; b++)
+    {
+      n = snprintf (num, sizeof(num), "\t%u", c->ages.bucket[b]);
+      put (num, n);
+    }
+  }
+
+  if (options.digest)
+  {
+    n = snprintf (num, sizeof(num), "\t%016llx%016llx", c->digest.hi, c->digest.lo);
+    put (num, n);
+  }
+
+  put ("\n", 1);
+  flush (false);
+}
+
+/* put_field: s, escaped so that it stays one field of one line */
+static void put_field (const char *s)
+{
+  const char *p;
+
+  for (p = s; *p; p++)
+  {
+    switch (*p)
+    {
+      case '\\': put ("\\\\", 2); break;
+      case '\t': put ("\\t", 2); break;
+      case '\n': put ("\\n", 2); break;
+      default: put (p, 1); break;
+    }
+  }
+}
+
+static void put (const char *s, size_t len)
+{
+  char *nbuf;
+  size_t want;
+
+  if (j.failed)
+    return;
+
+  if (j.len + len > j.alloc)
+  {
+    for (want = j.alloc ? j.alloc : 2 * FLUSH_SIZE; want < j.len + len; want *= 2)
+      ;
+    if ((nbuf = (char *) realloc (j.buf, want)) == NULL)
+    {
+      j.failed = true;
+      fprintf (stderr, "maildirtree: out of memory; no longer checkpointing\n");
+      return;
+    }
+    j.buf = nbuf;
+    j.alloc = want;
+  }
+
+  memcpy (j.buf + j.len, s, len);
+  j.len += len;
+}
+
+/* flush: write out the records collected so far, if it is time to or
+ * 'now' says so. Only whole lines are ever in the buffer by then. */
+static void flush (bool now)
+{
+  ssize_t w;
+  size_t done = 0;
+
+  if (j.failed || j.len == 0)
+    return;
+
+  if (!now && j.len < FLUSH_SIZE && time(NULL) - j.flushed < FLUSH_INTERVAL)
+    return;
+
+  while (done < j.len)
+  {
+    if ((w = write(j.fd, j.buf + done, j.len - done)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      j.failed = true;
+      fprintf (stderr, "maildirtree: checkpoint: %s; no longer checkpointing\n",
+               strerror(errno));
+      return;
+    }
+    done += w;
+  }
+
+  fdatasync (j.fd);
+  j.len = 0;
+  j.flushed = time(NULL);
+}
+
+/* split: line into at most max tab-separated fields; returns how many. */
+static int split (char *line, char **f, int max)
+{
+  int n = 0;
+
+  f[n++] = line;
+  while (n < max && (line = strchr(line, '\t')) != NULL)
+  {
+    *line++ = '\0';
+    f[n++] = line;
+  }
+
+  return n;
+}
+
+/* unescape: undo put_field() in place */
+static void unescape (char *s)
+{
+  char *d = s;
+
+  for (; *s; s++)
+  {
+    if (*s == '\\' && s[1])
+    {
+      s++;
+      *d++ = (*s == 't') ? '\t' : (*s == 'n') ? '\n' : *s;
+    }
+    else
+      *d++ = *s;
+  }
+
+  *d = '\0';
+}
+
+/* mine: whether folder 'name' of the maildir at 'path' is for this
+ * shard to count. Subfolders go with their top-level folder, and the
+ * hash is 32-bit FNV-1a of both, so that every host agrees on it as
+ * long as each was given 'path' the same way. */
+static bool mine (const char *path, const char *name)
+{
+  uint32_t h = 2166136261u;
+
+  if (shard_n == 0)
+    return true;
+
+  for (; *path; path++)
+    h = (h ^ (unsigned char) *path) * 16777619u;
+  h = (h ^ '/') * 16777619u;
+
+  while (*name == '.')
+    name++;
+  for (; *name && *name != '.'; name++)
+    h = (h ^ (unsigned char) *name) * 16777619u;
+
+  return h % shard_n == shard_k - 1;
+}
+
+/* FNV-1a, seeded with the root */
+static inline size_t hash_str (unsigned int seed, const char *s)
+{
+  size_t h = 2166136261u ^ seed;
+
+  while (*s)
+    h = (h ^ (unsigned char) *s++) * 16777619u;
+
+  return h;
+}
@@ -0,0 +1,720 @@
+/* daemon.c: answer count queries for a set of Maildirs over a Unix
+ * socket, from trees kept in memory. See maildirtree.c for full
+ * copyright.
+ *
+ * The protocol is line based. Every request is one line; the answer is
+ * either a single line starting with OK or ERR, or an OK line followed
+ * by data lines and a line holding a single dot (data lines starting
+ * with a dot get another one, as in SMTP).
+ *
+ *   ROOTS                  OK <n>, then "<index> <path>" per root
+ *   TOTALS [root]          OK <unread> <total> <folders with unread>
+ *   FOLDER <root> <path>   OK <unread> <total>  (path as in Foo/Bar)
+ *   UNREAD [root]          OK <n>, then "<unread> <total> <path>"
+ *   TREE [root]            OK, then the tree as maildirtree prints it
+ *   QUIT                   OK, and the connection is closed
+ *
+ * A root is given by its index or its path as on the command line, and
+ * defaults to the first.
+ *
+ * Trees are brought up to date at most every REFRESH_INTERVAL seconds,
+ * when asked about, by looking at the mtimes of their folders. With
+ * --watch, fanotify tells us about every message instead (see watch.c),
+ * which is what makes serving a whole --spool of them feasible. */
+
+#include "config.h"
+
+#include "maildirtree.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+
+/* How stale an answer may be: a root's mtimes are not looked at again
+ * for this many seconds, however many clients ask. */
+#define REFRESH_INTERVAL 1
+
+/* Longest request line we take */
+#define MAX_LINE 1024
+
+struct root
+{
+  char *path;
+  struct mdt_tree *tree;
+  time_t checked;
+  bool changed, stale;     /* by --watch: totals, or all of it, are off */
+};
+
+/* What watch events are applied to */
+struct roots
+{
+  struct root *roots;
+  int n;
+};
+
+struct client
+{
+  int fd;
+  char in [MAX_LINE];
+  size_t inlen;
+  char *out;
+  size_t outlen, outsize, outoff;
+  bool closing;
+};
+
+static int listen_on (const char *);
+static void serve (struct client *, struct root *, int);
+static void request (struct client *, struct root *, int, char *);
+static struct root * find_root (struct root *, int, const char *);
+static bool refresh (struct root *);
+static void on_event (void *, unsigned int, unsigned int, int, int);
+static void catch_up (struct watch *, struct root *, int);
+static int by_path (const void *, const void *);
+static long find_folder (const struct mdt_tree *, const char *);
+static void reply (struct client *, const char *, ...);
+static void reply_data (struct client *, const char *, size_t);
+static void on_signal (int);
+
+static volatile sig_atomic_t stop = 0;
+
+/* Set while fanotify keeps the trees current for us */
+static struct watch *watch = NULL;
+
+int daemon_main (char **paths, int npaths, const char *socket_path, bool watching)
+{
+  struct root *roots;
+  struct roots all;
+  struct client *clients = NULL;
+  struct pollfd *fds = NULL;
+  int i, n, nclients = 0, nfds, lfd, fd;
+
+  if (socket_path == NULL)
+  {
+    fprintf (stderr, "maildirtree: --daemon needs --socket\n");
+    return 1;
+  }
+
+  /* Trees are kept with their mtimes, so that refreshing is cheap. */
+  options.stamps = true;
+
+  roots = (struct root *) calloc (npaths, sizeof(struct root));
+  for (i = 0; i < npaths; i++)
+  {
+    roots[i].path = paths[i];
+    if ((roots[i].tree = mdt_scan(paths[i], &options)) == NULL)
+    {
+      printf ("maildirtree: %s: %s\n", paths[i], strerror(errno));
+      return 1;
+    }
+    roots[i].checked = time(NULL);
+  }
+
+  if (watching && (watch = watch_open()) == NULL)
+    fprintf (stderr, "maildirtree: cannot watch: %s; checking mtimes instead\n",
+             strerror(errno));
+
+  for (i = 0; watch && i < npaths; i++)
+  {
+    if (watch_add(watch, i, paths[i], roots[i].tree) != 0)
+    {
+      fprintf (stderr, "maildirtree: cannot watch %s: %s; checking mtimes instead\n",
+               paths[i], strerror(errno));
+      watch_close (watch);
+      watch = NULL;
+    }
+  }
+  all.roots = roots;
+  all.n = npaths;
+
+  if ((lfd = listen_on(socket_path)) < 0)
+  {
+    printf ("maildirtree: %s: %s\n", socket_path, strerror(errno));
+    return 1;
+  }
+
+  signal (SIGPIPE, SIG_IGN);
+  signal (SIGINT, &on_signal);
+  signal (SIGTERM, &on_signal);
+
+  while (!stop)
+  {
+    fds = (struct pollfd *) realloc (fds, (nclients + 2) * sizeof(struct pollfd));
+    fds[0].fd = lfd;
+    fds[0].events = POLLIN;
+
+    for (i = 0; i < nclients; i++)
+    {
+      fds[i + 1].fd = clients[i].fd;
+      fds[i + 1].events = (clients[i].outoff < clients[i].outlen) ? POLLOUT : POLLIN;
+    }
+
+    /* Events go last, so that clients keep their places. */
+    nfds = nclients + 1;
+    if (watch)
+    {
+      fds[nfds].fd = watch_fd(watch);
+      fds[nfds].events = POLLIN;
+      fds[nfds++].revents = 0;
+    }
+
+    if ((n = poll(fds, nfds, -1)) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    /* Before answering anyone, so that answers are current */
+    if (watch && (fds[nclients + 1].revents & POLLIN))
+    {
+      if (watch_read(watch, &on_event, &all) != 0)
+      {
+        fprintf (stderr, "maildirtree: watch: %s; checking mtimes instead\n",
+                 strerror(errno));
+        watch_close (watch);
+        watch = NULL;
+      }
+      else
+        catch_up (watch, roots, npaths);
+    }
+
+    for (i = 0; i < nclients; i++)
+    {
+      if (fds[i + 1].revents)
+        serve (&clients[i], roots, npaths);
+    }
+
+    /* Drop whoever is done, in place. */
+    for (i = n = 0; i < nclients; i++)
+    {
+      if (clients[i].fd < 0)
+      {
+        free (clients[i].out);
+        continue;
+      }
+      clients[n++] = clients[i];
+    }
+    nclients = n;
+
+    if (fds[0].revents & POLLIN)
+    {
+      while ((fd = accept(lfd, NULL, NULL)) >= 0)
+      {
+        fcntl (fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        clients = (struct client *) realloc (clients, (nclients + 1) * sizeof(struct client));
+        memset (&clients[nclients], 0, sizeof(struct client));
+        clients[nclients++].fd = fd;
+      }
+    }
+  }
+
+  for (i = 0; i < nclients; i++)
+  {
+    close (clients[i].fd);
+    free (clients[i].out);
+  }
+  for (i = 0; i < npaths; i++)
+    mdt_free (roots[i].tree);
+
+  if (watch)
+    watch_close (watch);
+
+  close (lfd);
+  unlink (socket_path);
+
+  free (clients);
+  free (fds);
+  free (roots);
+
+  return 0;
+}
+
+static int listen_on (const char *path)
+{
+  struct sockaddr_un sun;
+  struct stat st;
+  int fd;
+
+  if (strlen(path) >= sizeof(sun.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  memset (&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strcpy (sun.sun_path, path);
+
+  /* Left over from a daemon that did not get to clean up */
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink (path);
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return -1;
+
+  if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) != 0 ||
+      listen(fd, 64) != 0)
+  {
+    close (fd);
+    return -1;
+  }
+
+  fcntl (fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  return fd;
+}
+
+/* serve: do whatever a client is ready for. Sets c->fd to -1 once it
+ * is gone. */
+static void serve (struct client *c, struct root *roots, int nroots)
+{
+  ssize_t n;
+  char *nl;
+
+  if (c->outoff < c->outlen)
+  {
+    n = write (c->fd, c->out + c->outoff, c->outlen - c->outoff);
+    if (n < 0 && errno != EAGAIN && errno != EINTR)
+      goto gone;
+
+    if (n > 0 && (c->outoff += n) == c->outlen)
+    {
+      c->outoff = c->outlen = 0;
+      if (c->closing)
+        goto gone;
+    }
+
+    return;
+  }
+
+  n = read (c->fd, c->in + c->inlen, sizeof(c->in) - c->inlen);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+    goto gone;
+  if (n < 0)
+    return;
+
+  c->inlen += n;
+
+  /* Answer every complete line; clients may send several at once. */
+  while (!c->closing && (nl = memchr(c->in, '\n', c->inlen)) != NULL)
+  {
+    *nl = '\0';
+    if (nl > c->in && nl[-1] == '\r')
+      nl[-1] = '\0';
+
+    request (c, roots, nroots, c->in);
+
+    c->inlen -= nl + 1 - c->in;
+    memmove (c->in, nl + 1, c->inlen);
+  }
+
+  if (c->inlen == sizeof(c->in))
+  {
+    reply (c, "ERR line too long\n");
+    c->closing = true;
+  }
+
+  return;
+
+gone:
+  close (c->fd);
+  c->fd = -1;
+}
+
+static void request (struct client *c, struct root *roots, int nroots, char *line)
+{
+  struct root *r;
+  struct mdt_tree *t;
+  char *cmd, *arg, *rest, path [PATH_MAX];
+  long i;
+  size_t j;
+  FILE *out;
+  char *buf = NULL;
+  size_t len = 0;
+
+  cmd = line;
+  while (*cmd == ' ')
+    cmd++;
+
+  /* Split off the first argument; the rest is kept whole, as folder
+   * names may well have spaces in them. */
+  if ((arg = strchr(cmd, ' ')) != NULL)
+  {
+    *arg++ = '\0';
+    while (*arg == ' ')
+      arg++;
+    if ((rest = strchr(arg, ' ')) != NULL)
+      *rest++ = '\0';
+  }
+  else
+    rest = NULL;
+
+  if (!strcasecmp(cmd, "QUIT"))
+  {
+    reply (c, "OK bye\n");
+    c->closing = true;
+    return;
+  }
+
+  if (!strcasecmp(cmd, "ROOTS"))
+  {
+    reply (c, "OK %d\n", nroots);
+    for (i = 0; i < nroots; i++)
+      reply (c, "%ld %s\n", i, roots[i].path);
+    reply (c, ".\n");
+    return;
+  }
+
+  if (strcasecmp(cmd, "TOTALS") && strcasecmp(cmd, "FOLDER") &&
+      strcasecmp(cmd, "UNREAD") && strcasecmp(cmd, "TREE"))
+  {
+    reply (c, "ERR unknown command\n");
+    return;
+  }
+
+  if ((r = find_root(roots, nroots, arg)) == NULL)
+  {
+    reply (c, "ERR no such root\n");
+    return;
+  }
+
+  if (!refresh(r))
+  {
+    reply (c, "ERR %s\n", strerror(errno));
+    return;
+  }
+
+  t = r->tree;
+
+  if (!strcasecmp(cmd, "TOTALS"))
+    reply (c, "OK %u %u %u\n", t->total_unread, t->total_read + t->total_unread,
+           t->folders_unread);
+
+  else if (!strcasecmp(cmd, "FOLDER"))
+  {
+    if (rest == NULL || (i = find_folder(t, rest)) < 0)
+      reply (c, "ERR no such folder\n");
+    else
+      reply (c, "OK %u %u\n", t->unread[i], t->read[i] + t->unread[i]);
+  }
+
+  else if (!strcasecmp(cmd, "UNREAD"))
+  {
+    reply (c, "OK %u\n", t->folders_unread);
+    for (j = 0; j < t->count; j++)
+    {
+      if (t->unread[j] == 0)
+        continue;
+
+      folder_path (t, j, NULL, path, sizeof(path));
+      reply (c, "%u %u %s\n", t->unread[j], t->read[j] + t->unread[j], path);
+    }
+    reply (c, ".\n");
+  }
+
+  else /* TREE */
+  {
+#ifdef HAVE_OPEN_MEMSTREAM
+    out = open_memstream (&buf, &len);
+#else
+    out = tmpfile ();
+#endif
+    if (out == NULL)
+    {
+      reply (c, "ERR %s\n", strerror(errno));
+      return;
+    }
+
+    report (out, t, r->path, NULL);
+
+#ifdef HAVE_OPEN_MEMSTREAM
+    fclose (out);
+#else
+    len = ftell (out);
+    rewind (out);
+    buf = (char *) malloc (len + 1);
+    len = fread (buf, 1, len, out);
+    fclose (out);
+#endif
+
+    reply (c, "OK\n");
+    reply_data (c, buf, len);
+    reply (c, ".\n");
+
+    free (buf);
+  }
+}
+
+static struct root * find_root (struct root *roots, int nroots, const char *arg)
+{
+  char *end;
+  long i;
+
+  if (arg == NULL || *arg == '\0')
+    return &roots[0];
+
+  i = strtol (arg, &end, 10);
+  if (*end == '\0')
+    return (i >= 0 && i < nroots) ? &roots[i] : NULL;
+
+  for (i = 0; i < nroots; i++)
+    if (!strcmp(roots[i].path, arg))
+      return &roots[i];
+
+  return NULL;
+}
+
+/* refresh: make sure r's counts are no older than REFRESH_INTERVAL.
+ * Only folders whose cur/ or new/ changed are counted again. */
+static bool refresh (struct root *r)
+{
+  time_t now = time(NULL);
+
+  /* Events have kept it current. */
+  if (watch)
+    return true;
+
+  if (now - r->checked < REFRESH_INTERVAL)
+    return true;
+
+  if (mdt_refresh(&r->tree, r->path, &options) < 0)
+    return false;
+
+  r->checked = now;
+  return true;
+}
+
+/* on_event: watch_read() callback, counting a message in or out of a
+ * folder, or noting that a root needs scanning again. */
+static void on_event (void *arg, unsigned int root, unsigned int folder, int which, int delta)
+{
+  struct roots *all = (struct roots *) arg;
+  struct mdt_tree *t;
+  unsigned int *count;
+  int i;
+
+  if (root == MDT_NONE)
+  {
+    for (i = 0; i < all->n; i++)
+      all->roots[i].stale = true;
+    return;
+  }
+
+  if ((int) root >= all->n)
+    return;
+
+  /* A count alone would leave the ages and unique counts behind. */
+  t = all->roots[root].tree;
+  if (which == WATCH_ROOT || folder >= t->count || options.ages || options.unique)
+  {
+    all->roots[root].stale = true;
+    return;
+  }
+
+  count = (which == WATCH_CUR) ? &t->read[folder] : &t->unread[folder];
+  if (delta < 0 && *count == 0)
+    all->roots[root].stale = true;
+  else
+    *count += delta;
+
+  all->roots[root].changed = true;
+}
+
+/* catch_up: after a batch of events, total up the roots they changed,
+ * and scan those they could not tell about again. */
+static void catch_up (struct watch *w, struct root *roots, int nroots)
+{
+  struct mdt_tree *t;
+  int i;
+
+  for (i = 0; i < nroots; i++)
+  {
+    if (roots[i].stale)
+    {
+      if ((t = mdt_scan(roots[i].path, &options)) == NULL)
+      {
+        fprintf (stderr, "maildirtree: %s: %s\n", roots[i].path, strerror(errno));
+        continue;
+      }
+
+      mdt_free (roots[i].tree);
+      roots[i].tree = t;
+
+      /* The folders are numbered anew. */
+      watch_forget (w, i);
+      if (watch_add(w, i, roots[i].path, t) != 0)
+        fprintf (stderr, "maildirtree: cannot watch %s: %s\n", roots[i].path, strerror(errno));
+    }
+    else if (roots[i].changed)
+      mdt_update_totals (roots[i].tree);
+
+    roots[i].stale = roots[i].changed = false;
+  }
+}
+
+/* spool_maildirs: the maildirs of a spool with one directory per user,
+ * which is either a maildir or has one called Maildir. Returns them in
+ * an array of *n, or NULL with errno set. */
+char ** spool_maildirs (const char *spool, int *n)
+{
+  DIR *d;
+  struct dirent *e;
+  struct stat st;
+  char **paths = NULL, **npaths, *p;
+  size_t len, alloc = 0;
+
+  if ((d = opendir(spool)) == NULL)
+    return NULL;
+
+  *n = 0;
+  while ((e = readdir(d)) != NULL)
+  {
+    if (*e->d_name == '.')
+      continue;
+
+    len = strlen(spool) + strlen(e->d_name) + sizeof("//Maildir/cur");
+    if ((p = (char *) malloc (len)) == NULL)
+      break;
+
+    snprintf (p, len, "%s/%s/cur", spool, e->d_name);
+    if (stat(p, &st) != 0 || !S_ISDIR(st.st_mode))
+      snprintf (p, len, "%s/%s/Maildir/cur", spool, e->d_name);
+    if (stat(p, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+      free (p);
+      continue;
+    }
+    p[strlen(p) - 4] = '\0';
+
+    if ((size_t) *n == alloc)
+    {
+      alloc = alloc ? alloc * 2 : 64;
+      if ((npaths = (char **) realloc (paths, alloc * sizeof(char *))) == NULL)
+      {
+        free (p);
+        break;
+      }
+      paths = npaths;
+    }
+    paths[(*n)++] = p;
+  }
+
+  closedir (d);
+
+  if (paths == NULL)
+  {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  /* So that roots keep their numbers from one start to the next */
+  qsort (paths, *n, sizeof(char *), &by_path);
+  return paths;
+}
+
+static int by_path (const void *a, const void *b)
+{
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* find_folder: look up Foo/Bar by walking down from the root, hopping
+ * from sibling to sibling by subtree size. */
+static long find_folder (const struct mdt_tree *t, const char *path)
+{
+  size_t i = 0, j, len;
+  const char *end;
+
+  while (*path)
+  {
+    if ((end = strchr(path, '/')) == NULL)
+      end = path + strlen(path);
+    len = end - path;
+
+    for (j = i + 1; j < i + t->size[i]; j += t->size[j])
+    {
+      if (!strncmp(t->names + t->name[j], path, len) &&
+          t->names[t->name[j] + len] == '\0')
+        break;
+    }
+
+    if (j >= i + t->size[i])
+      return -1;
+
+    i = j;
+    path = *end ? end + 1 : end;
+  }
+
+  return (long) i;
+}
+
+static void reply (struct client *c, const char *fmt, ...)
+{
+  va_list ap;
+  char line [PATH_MAX + 64];
+  int n;
+
+  va_start (ap, fmt);
+  n = vsnprintf (line, sizeof(line), fmt, ap);
+  va_end (ap);
+
+  if (n < 0)
+    return;
+  if ((size_t) n >= sizeof(line))
+    n = sizeof(line) - 1;
+
+  if (c->outlen + n > c->outsize)
+  {
+    c->outsize = (c->outlen + n) * 2;
+    c->out = (char *) realloc (c->out, c->outsize);
+  }
+
+  memcpy (c->out + c->outlen, line, n);
+  c->outlen += n;
+}
+
+/* reply_data: queue the lines in buf, dot-stuffed. */
+static void reply_data (struct client *c, const char *buf, size_t len)
+{
+  const char *p = buf, *end = buf + len, *nl;
+
+  while (p < end)
+  {
+    if ((nl = memchr(p, '\n', end - p)) == NULL)
+      nl = end;
+
+    if (c->outlen + (nl - p) + 2 > c->outsize)
+    {
+      c->outsize = (c->outlen + (nl - p) + 2) * 2;
+      c->out = (char *) realloc (c->out, c->outsize);
+    }
+
+    if (*p == '.')
+      c->out[c->outlen++] = '.';
+    memcpy (c->out + c->outlen, p, nl - p);
+    c->outlen += nl - p;
+    c->out[c->outlen++] = '\n';
+
+    p = nl + 1;
+  }
+}
+
+static void on_signal (int sig)
+{
+  (void) sig;
+  stop = 1;
+}
@@ -0,0 +1,290 @@
+/* deadline.c: --deadline, scanning a Maildir for no longer than we were
+ * given. See maildirtree.c for full copyright.
+ *
+ * The library stops counting by itself once options.deadline passes,
+ * but it only looks at the clock between batches of directory entries;
+ * a directory the kernel hangs on (a dead NFS server, say) would hold
+ * the scan up for good. So the scan runs in a thread of its own that
+ * hands over each folder as soon as it is counted, and when the time is
+ * up we lay out whatever we were handed and leave the thread to it.
+ *
+ * So that the folder it hangs on, and those it never got to, are not
+ * simply missing, the thread first lists the Maildir's top level; what
+ * of that it has not handed over goes in as not counted. */
+
+#include "config.h"
+
+#include "maildirtree.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#include <pthread.h>
+
+struct job
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  char *path;
+  struct mdt_builder *b;
+
+  /* Under the lock: the walk has returned, and with what; or we gave
+   * up on it, and the thread is to clean up after itself. */
+  bool done, abandoned;
+  int r, err;
+
+  /* Also under the lock: the top level, by name, and which of it has
+   * been handed over */
+  struct entry *listed;
+  size_t nlisted;
+};
+
+struct entry
+{
+  char *name;
+  unsigned char flags;     /* MDT_MBOX for a file */
+  bool counted;
+};
+
+static void * worker (void *);
+static int collect (void *, const char *, const struct mdt_counts *);
+static struct entry * list_top (const char *, size_t *);
+static int by_name (const void *, const void *);
+static void free_job (struct job *);
+
+/* deadline_scan: mdt_scan() of 'path' that returns by 'hard' (on the
+ * CLOCK_MONOTONIC clock) come what may. If it had to give up on the
+ * scan, the root is flagged MDT_PARTIAL as well, and so is every
+ * folder at the top that was listed but not counted. */
+struct mdt_tree * deadline_scan (const char *path, const struct timespec *hard)
+{
+  struct job *j;
+  struct mdt_tree *t;
+  struct mdt_builder *b;
+  struct mdt_counts c;
+  pthread_condattr_t attr;
+  pthread_t thread;
+  char name [NAME_MAX + 1];
+  bool done;
+  int r, err;
+  size_t i;
+
+  if ((j = (struct job *) calloc (1, sizeof(struct job))) == NULL ||
+      (j->path = strdup(path)) == NULL)
+    goto nomem;
+
+  j->b = mdt_builder_new(mdt_root_name(path, name, sizeof(name)),
+                         (options.ages ? MDT_AGES : 0) |
+                         (options.audit ? MDT_AUDIT : 0) |
+                         (options.digest ? MDT_DIGEST : 0));
+  if (j->b == NULL)
+    goto nomem;
+  mdt_builder_sort (j->b, options.sort);
+
+  pthread_mutex_init (&j->lock, NULL);
+  pthread_condattr_init (&attr);
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+  pthread_cond_init (&j->cond, &attr);
+  pthread_condattr_destroy (&attr);
+
+  if ((errno = pthread_create(&thread, NULL, &worker, j)) != 0)
+  {
+    err = errno;
+    free_job (j);
+    errno = err;
+    return NULL;
+  }
+  pthread_detach (thread);
+
+  pthread_mutex_lock (&j->lock);
+  while (!j->done)
+    if (pthread_cond_timedwait(&j->cond, &j->lock, hard) == ETIMEDOUT)
+      break;
+
+  /* From here on, the builder is ours alone. */
+  done = j->done;
+  j->abandoned = !done;
+  b = j->b;
+  j->b = NULL;
+  r = j->r;
+  err = j->err;
+
+  if (!done)
+  {
+    memset (&c, 0, sizeof(c));
+    mdt_clear_ages (&c.ages);
+
+    for (i = 0; i < j->nlisted; i++)
+      if (!j->listed[i].counted)
+      {
+        c.flags = MDT_PARTIAL | j->listed[i].flags;
+        mdt_insert (b, j->listed[i].name, &c);
+      }
+  }
+  pthread_mutex_unlock (&j->lock);
+
+  if (done)
+    free_job (j);
+
+  if (r < 0)
+  {
+    mdt_builder_free (b);
+    errno = err;
+    return NULL;
+  }
+
+  if ((t = mdt_finish(b)) != NULL && !done)
+  {
+    t->flags[0] |= MDT_PARTIAL;
+    mdt_update_totals (t);
+  }
+
+  return t;
+
+nomem:
+  if (j)
+    free (j->path);
+  free (j);
+  errno = ENOMEM;
+  return NULL;
+}
+
+static void * worker (void *arg)
+{
+  struct job *j = (struct job *) arg;
+  struct entry *listed;
+  bool abandoned;
+  size_t n;
+  int r;
+
+  /* Listing the top may hang just as well; then there is nothing to
+   * show but the root. */
+  listed = list_top(j->path, &n);
+
+  pthread_mutex_lock (&j->lock);
+  j->listed = listed;
+  j->nlisted = n;
+  pthread_mutex_unlock (&j->lock);
+
+  r = mdt_walk(j->path, &options, &collect, j);
+
+  pthread_mutex_lock (&j->lock);
+  j->r = r;
+  j->err = errno;
+  j->done = true;
+  abandoned = j->abandoned;
+  pthread_cond_signal (&j->cond);
+  pthread_mutex_unlock (&j->lock);
+
+  /* Nobody is waiting for us any more. */
+  if (abandoned)
+    free_job (j);
+
+  return NULL;
+}
+
+/* collect: mdt_walk() callback, handing a folder over, unless it is too
+ * late for that. */
+static int collect (void *arg, const char *name, const struct mdt_counts *c)
+{
+  struct job *j = (struct job *) arg;
+  struct entry key, *e;
+  int r = 0;
+
+  pthread_mutex_lock (&j->lock);
+  if (j->abandoned)
+    r = ETIMEDOUT;
+  else
+  {
+    mdt_insert (j->b, name, c);
+
+    key.name = (char *) name;
+    if (*name && (e = (struct entry *) bsearch (&key, j->listed, j->nlisted,
+                                                sizeof(struct entry), &by_name)) != NULL)
+      e->counted = true;
+  }
+  pthread_mutex_unlock (&j->lock);
+
+  return r;
+}
+
+/* list_top: the entries of the Maildir at 'path' that mdt_walk() could
+ * hand over as folders, sorted by name; *n of them. These are the ones
+ * the library lists itself once past its deadline (see
+ * mdt_maybe_folder()), so both ways of running out of time show the
+ * same folders. Running out of memory leaves the list short. */
+static struct entry * list_top (const char *path, size_t *n)
+{
+  struct entry *e = NULL, *ne;
+  struct dirent *d;
+  size_t alloc = 0;
+  unsigned char flags;
+  DIR *dir;
+
+  *n = 0;
+  if ((dir = opendir(path)) == NULL)
+    return NULL;
+
+  while ((d = readdir(dir)) != NULL)
+  {
+    if (!mdt_maybe_folder(d, &options, &flags))
+      continue;
+
+    if (*n == alloc)
+    {
+      alloc = alloc ? alloc * 2 : 64;
+      if ((ne = (struct entry *) realloc (e, alloc * sizeof(struct entry))) == NULL)
+        break;
+      e = ne;
+    }
+
+    if ((e[*n].name = strdup(d->d_name)) == NULL)
+      break;
+    e[*n].flags = flags;
+    e[(*n)++].counted = false;
+  }
+  closedir (dir);
+
+  if (*n > 0)
+    qsort (e, *n, sizeof(struct entry), &by_name);
+  return e;
+}
+
+static int by_name (const void *a, const void *b)
+{
+  return strcmp(((const struct entry *) a)->name, ((const struct entry *) b)->name);
+}
+
+static void free_job (struct job *j)
+{
+  size_t i;
+
+  for (i = 0; i < j->nlisted; i++)
+    free (j->listed[i].name);
+  free (j->listed);
+
+  pthread_mutex_destroy (&j->lock);
+  pthread_cond_destroy (&j->cond);
+  if (j->b)
+    mdt_builder_free (j->b);
+  free (j->path);
+  free (j);
+}
+
+#else /* no threads */
+
+/* Without threads, all we have is the library's own deadline. */
+struct mdt_tree * deadline_scan (const char *path, const struct timespec *hard)
+{
+  (void) hard;
+  return mdt_scan (path, &options);
+}
+
+#endif
@@ -0,0 +1,238 @@
+/* digest.c: --digest, what the names of the files in each folder add up
+ * to, and --compare, which scans two copies of a maildir at once and
+ * says which of their folders differ by it. See maildirtree.c for full
+ * copyright.
+ *
+ * A replica that rsync or dsync keeps should have the same files under
+ * the same names as the original, and so the same digests (see
+ * mdt_options.digest). Comparing them costs a scan on each side and no
+ * file lists: one side can print its digests where it is, and they can
+ * be diffed against the other's. */
+
+#include "config.h"
+
+#include "maildirtree.h"
+#include "snprintf.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/* One of the two maildirs of --compare */
+struct side
+{
+  const char *path;
+  struct mdt_tree *tree;
+  int error;
+
+  unsigned int *items;     /* its folders, dummies left out, by name */
+  size_t n;
+};
+
+static void * scan_side (void *);
+static bool sort_side (struct side *);
+static int compare_names (const char *, const char *);
+static bool same (const struct mdt_tree *, size_t, const struct mdt_tree *, size_t);
+
+/* print_digests: a line for each folder of 'res' that is one: its
+ * digest in hex (zero for what has none, like an archive), read and
+ * unread messages, and its directory name (. for the root). Meant for
+ * diff(1) or comm(1). */
+void print_digests (FILE *out, const struct mdt_tree *res)
+{
+  static const struct mdt_digest none;
+  const struct mdt_digest *d;
+  const char *name;
+  size_t i;
+
+  for (i = 0; i < res->count; i++)
+  {
+    name = res->names + res->path[i];
+    if (i > 0 && *name == '\0')
+      continue;
+
+    d = res->digest ? &res->digest[i] : &none;
+    fprintf (out, "%016llx%016llx %u %u %s\n", d->hi, d->lo,
+             res->read[i], res->unread[i], (i == 0) ? "." : name);
+  }
+}
+
+/* compare_main: --compare, scanning maildirs 'a' and 'b' side by side
+ * and printing the folders whose counts or digests differ between
+ * them. Returns 0 if none do, 3 if some do, 2 if none seem to but some
+ * were not counted in full, and 1 if either could not be scanned. */
+int compare_main (const char *a, const char *b)
+{
+  struct side s [2];
+  const struct mdt_tree *ta, *tb;
+  char pa [PATH_MAX], pb [PATH_MAX];
+  unsigned int differ = 0, partial = 0, messages = 0;
+  size_t i = 0, j = 0, ia, ib;
+  int c, k;
+#ifdef HAVE_PTHREAD_H
+  pthread_t thread;
+  bool threaded;
+#endif
+
+  memset (s, 0, sizeof(s));
+  s[0].path = a;
+  s[1].path = b;
+
+  /* Both at once; they are most likely on different disks, if not
+   * different machines. */
+#ifdef HAVE_PTHREAD_H
+  threaded = pthread_create(&thread, NULL, &scan_side, &s[1]) == 0;
+  scan_side (&s[0]);
+  if (threaded)
+    pthread_join (thread, NULL);
+  else
+    scan_side (&s[1]);
+#else
+  scan_side (&s[0]);
+  scan_side (&s[1]);
+#endif
+
+  for (k = 0; k < 2; k++)
+  {
+    if (s[k].tree == NULL || !sort_side(&s[k]))
+    {
+      printf ("maildirtree: %s: %s\n", s[k].path, strerror(s[k].tree ? ENOMEM : s[k].error));
+      for (k = 0; k < 2; k++)
+      {
+        free (s[k].items);
+        if (s[k].tree)
+          mdt_free (s[k].tree);
+      }
+      return 1;
+    }
+  }
+
+  ta = s[0].tree;
+  tb = s[1].tree;
+
+  /* Both in the same order by name, so one walk along the two does */
+  while (i < s[0].n || j < s[1].n)
+  {
+    ia = (i < s[0].n) ? s[0].items[i] : 0;
+    ib = (j < s[1].n) ? s[1].items[j] : 0;
+
+    if (i == s[0].n)
+      c = 1;
+    else if (j == s[1].n)
+      c = -1;
+    else
+      c = compare_names(ta->names + ta->path[ia], tb->names + tb->path[ib]);
+
+    if (c < 0)
+    {
+      printf ("%s: only in %s\n", folder_path(ta, ia, NULL, pa, sizeof(pa)), a);
+      differ++;
+      i++;
+      continue;
+    }
+    if (c > 0)
+    {
+      printf ("%s: only in %s\n", folder_path(tb, ib, NULL, pb, sizeof(pb)), b);
+      differ++;
+      j++;
+      continue;
+    }
+
+    folder_path (ta, ia, NULL, pa, sizeof(pa));
+
+    if ((ta->flags[ia] | tb->flags[ib]) & MDT_PARTIAL)
+    {
+      printf ("%s: not counted in full\n", pa);
+      partial++;
+    }
+    else if (ta->read[ia] != tb->read[ib] || ta->unread[ia] != tb->unread[ib])
+    {
+      printf ("%s: (%u/%u) against (%u/%u)\n", pa,
+              ta->unread[ia], ta->read[ia] + ta->unread[ia],
+              tb->unread[ib], tb->read[ib] + tb->unread[ib]);
+      differ++;
+    }
+    else if (!same(ta, ia, tb, ib))
+    {
+      printf ("%s: (%u/%u) both, but not the same messages\n", pa,
+              ta->unread[ia], ta->read[ia] + ta->unread[ia]);
+      differ++;
+    }
+
+    messages += ta->read[ia] + ta->unread[ia];
+    i++;
+    j++;
+  }
+
+  if (differ > 0)
+    printf ("%u folder%s.\n", differ, (differ != 1) ? "s differ" : " differs");
+  else if (partial == 0)
+    printf ("%s and %s match: %lu folder%s, %u message%s.\n", a, b,
+            (unsigned long) s[0].n, (s[0].n != 1) ? "s" : "",
+            messages, (messages != 1) ? "s" : "");
+
+  for (k = 0; k < 2; k++)
+  {
+    free (s[k].items);
+    mdt_free (s[k].tree);
+  }
+
+  return differ ? 3 : partial ? 2 : 0;
+}
+
+static void * scan_side (void *arg)
+{
+  struct side *s = (struct side *) arg;
+
+  if ((s->tree = mdt_scan(s->path, &options)) == NULL)
+    s->error = errno;
+
+  return NULL;
+}
+
+/* sort_side: its folders, by their directory names, for walking along */
+static bool sort_side (struct side *s)
+{
+  const struct mdt_tree *t = s->tree;
+  size_t i;
+
+  if ((s->items = (unsigned int *) malloc (t->count * sizeof(unsigned int))) == NULL)
+    return false;
+
+  for (i = 0; i < t->count; i++)
+    if (i == 0 || t->names[t->path[i]] != '\0')
+      s->items[s->n++] = i;
+
+  /* The root's name is empty, so it stays first. */
+  mdt_sort_names (s->items + 1, s->n - 1, t->names, t->path);
+  return true;
+}
+
+/* compare_names: in the order of mdt_sort_names(), which is bytewise
+ * but for the dot coming before everything else */
+static int compare_names (const char *a, const char *b)
+{
+  int x, y;
+
+  for (; *a && *a == *b; a++, b++)
+    ;
+
+  x = (*a == '.') ? 1 : (*a ? (unsigned char) *a + 1 : 0);
+  y = (*b == '.') ? 1 : (*b ? (unsigned char) *b + 1 : 0);
+  return x - y;
+}
+
+/* same: whether the digests agree, where both have one */
+static bool same (const struct mdt_tree *a, size_t i, const struct mdt_tree *b, size_t j)
+{
+  if (a->digest == NULL || b->digest == NULL)
+    return true;
+
+  return a->digest[i].lo == b->digest[j].lo && a->digest[i].hi == b->digest[j].hi;
+}
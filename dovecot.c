@@ -0,0 +1,183 @@
+/* dovecot.c: folder counts from Dovecot's index files, for libmaildirtree.
+ * See maildirtree.c for full copyright.
+ * (C) 2003 by Joshua Kwan. */
+
+#include "config.h"
+
+#include "libmaildirtree.h"
+#include "snprintf.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/* The parts of dovecot.index we read (lib-index/mail-index.h). The base
+ * header is followed by extension headers, each one a struct ext_header,
+ * its name, and its data, the last two padded to 8 bytes. */
+#define INDEX_MAJOR       7
+#define COMPAT_LITTLE     0x01
+
+#define OFF_BASE_SIZE     2     /* uint16_t base_header_size */
+#define OFF_HEADER_SIZE   4     /* uint32_t header_size */
+#define OFF_COMPAT        12    /* uint8_t compat_flags */
+#define OFF_MESSAGES      32    /* uint32_t messages_count */
+#define OFF_SEEN          40    /* uint32_t seen_messages_count */
+
+#define EXT_HEADER_SIZE   16    /* hdr_size, reset_id, then four uint16_t */
+#define EXT_NAME_SIZE     14    /* uint16_t name_size */
+
+/* The "maildir" extension (lib-storage/index/maildir/maildir-storage.h)
+ * notes when cur/ and new/ were last synced, as uint32_t each. */
+#define MAILDIR_NEW_MTIME 4
+#define MAILDIR_NEW_NSECS 8
+#define MAILDIR_CUR_MTIME 16
+#define MAILDIR_CUR_NSECS 20
+#define MAILDIR_HDR_SIZE  36
+
+/* Headers are small; anything bigger is not one we know. */
+#define MAX_HEADER        (64 * 1024)
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t) 7)
+
+static const unsigned char * find_ext (const unsigned char *, size_t, size_t, const char *);
+static bool synced (const unsigned char *, size_t, size_t, const struct stat *);
+static inline uint32_t get32 (const unsigned char *);
+static inline uint16_t get16 (const unsigned char *);
+
+int mdt_dovecot_counts (const char *path, struct mdt_counts *c)
+{
+  struct stat cur, new;
+  unsigned char *hdr;
+  const unsigned char *ext;
+  size_t len = strlen(path) + 16, base, size;
+  uint32_t messages, seen;
+  const union { uint16_t u; unsigned char c; } endian = { 1 };
+  char *p;
+  ssize_t got;
+  int fd, r = -1;
+
+  if ((p = (char *) malloc (len)) == NULL)
+    return -1;
+
+  snprintf (p, len, "%s/cur", path);
+  if (stat(p, &cur) != 0)
+    goto out;
+  snprintf (p, len, "%s/new", path);
+  if (stat(p, &new) != 0)
+    goto out;
+
+  snprintf (p, len, "%s/dovecot.index", path);
+  if ((fd = open(p, O_RDONLY)) < 0)
+    goto out;
+
+  hdr = (unsigned char *) malloc (MAX_HEADER);
+  got = hdr ? read(fd, hdr, MAX_HEADER) : -1;
+  close (fd);
+
+  if (got < OFF_SEEN + 4)
+    goto out_hdr;
+
+  /* Only the version and byte order we know */
+  base = get16(hdr + OFF_BASE_SIZE);
+  size = get32(hdr + OFF_HEADER_SIZE);
+  if (hdr[0] != INDEX_MAJOR || ((hdr[OFF_COMPAT] & COMPAT_LITTLE) != 0) != (endian.c == 1) ||
+      base < OFF_SEEN + 4 || size > (size_t) got || base > size)
+    goto out_hdr;
+
+  if ((ext = find_ext(hdr, base, size, "maildir")) == NULL ||
+      !synced(ext, MAILDIR_NEW_MTIME, MAILDIR_NEW_NSECS, &new) ||
+      !synced(ext, MAILDIR_CUR_MTIME, MAILDIR_CUR_NSECS, &cur))
+    goto out_hdr;
+
+  messages = get32(hdr + OFF_MESSAGES);
+  seen = get32(hdr + OFF_SEEN);
+  if (seen > messages)
+    goto out_hdr;
+
+  memset (c, 0, sizeof(*c));
+  mdt_clear_ages (&c->ages);
+  c->read = seen;
+  c->unread = messages - seen;
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  c->stamps.cur_mtime = cur.st_mtim;
+  c->stamps.new_mtime = new.st_mtim;
+#else
+  c->stamps.cur_mtime.tv_sec = cur.st_mtime;
+  c->stamps.new_mtime.tv_sec = new.st_mtime;
+#endif
+  r = 0;
+
+out_hdr:
+  free (hdr);
+out:
+  free (p);
+  return r;
+}
+
+/* find_ext: the data of the extension header called 'name', at least
+ * MAILDIR_HDR_SIZE bytes of it, or NULL. */
+static const unsigned char * find_ext (const unsigned char *hdr, size_t off, size_t size,
+                                       const char *name)
+{
+  size_t name_len = strlen(name), hdr_size, name_size, data;
+
+  off = ALIGN8(off);
+  while (off + EXT_HEADER_SIZE <= size)
+  {
+    hdr_size = get32(hdr + off);
+    name_size = get16(hdr + off + EXT_NAME_SIZE);
+    data = ALIGN8(off + EXT_HEADER_SIZE + name_size);
+
+    if (data + hdr_size > size)
+      return NULL;
+
+    if (name_size == name_len && !memcmp(hdr + off + EXT_HEADER_SIZE, name, name_len))
+      return (hdr_size >= MAILDIR_HDR_SIZE) ? hdr + data : NULL;
+
+    off = ALIGN8(data + hdr_size);
+  }
+
+  return NULL;
+}
+
+/* synced: whether the directory is as Dovecot last saw it. Nanoseconds
+ * only count where both sides have them. */
+static bool synced (const unsigned char *ext, size_t mtime, size_t nsecs, const struct stat *st)
+{
+  if ((time_t) get32(ext + mtime) != st->st_mtime)
+    return false;
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  if (get32(ext + nsecs) != 0 && get32(ext + nsecs) != (uint32_t) st->st_mtim.tv_nsec)
+    return false;
+#else
+  (void) nsecs;
+#endif
+
+  return true;
+}
+
+/* Dovecot writes its index in host byte order, which was checked. */
+static inline uint32_t get32 (const unsigned char *p)
+{
+  uint32_t v;
+
+  memcpy (&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint16_t get16 (const unsigned char *p)
+{
+  uint16_t v;
+
+  memcpy (&v, p, sizeof(v));
+  return v;
+}
@@ -0,0 +1,903 @@
+/* history.c: --history, the counts of every run kept in a file, and
+ * --since, what they did over a span of time. See maildirtree.c for full
+ * copyright.
+ *
+ * The file is meant to take a run a minute over thousands of folders
+ * for months, so it only holds what changed. After HISTORY_MAGIC it is
+ * a sequence of records, each a varint length and then that many bytes:
+ *
+ *   'n' <root+1> <name>    a name for the next id, counting from 0: a
+ *                          maildir by its path if root+1 is 0, else a
+ *                          folder of root by its directory name (.Foo.Bar,
+ *                          empty for the maildir itself)
+ *   'r' <time> <k> <k entries>
+ *                          a run; time is seconds since the last run,
+ *                          and each entry a folder whose counts changed
+ *
+ * An entry is <gap*2+gone>, with gap the number of ids skipped since
+ * the last entry (they come in increasing order), followed unless gone
+ * by the changes of <read> and <unread>. Numbers are varints of seven
+ * bits a byte, low bits first; those that can go down (times and
+ * changes) are zigzagged first, so that small changes either way take a
+ * byte. A folder that did not change costs nothing, and a run in which
+ * nothing did is not written at all.
+ *
+ * Each run is appended by a single write() under a lock on the file, so
+ * a run that is killed leaves a short last record at worst, which the
+ * next one cuts off. Folders counted only in part, before a --deadline,
+ * are left as they were. */
+
+#include "config.h"
+
+#include "maildirtree.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#define HISTORY_MAGIC "MDTHIST1"
+#define MAGIC_LEN     8
+
+/* No record comes anywhere near this; a length past it is garbage. */
+#define MAX_RECORD    (256 * 1024 * 1024)
+
+/* A maildir (root MDT_NONE) or one of its folders, with its counts as of
+ * the last run that changed them */
+struct series
+{
+  unsigned int root;
+  char *name;
+  bool present;
+  unsigned int read, unread;
+
+  /* As of the start of the span asked about */
+  bool was_present;
+  unsigned int was_read, was_unread;
+  int wanted;              /* the folder argument it matches, plus one */
+
+  bool seen;               /* in this run */
+};
+
+
+/* One folder of a run about to be written */
+struct entry
+{
+  unsigned int id;
+  bool gone;
+  long long read, unread;
+};
+
+/* One change of a wanted folder within the span */
+struct point
+{
+  unsigned int id;
+  time_t when;
+  bool present;
+  unsigned int read, unread;
+};
+
+struct buf
+{
+  unsigned char *data;
+  size_t len, alloc;
+};
+
+static struct
+{
+  int fd;
+  bool failed;
+  struct buf out;          /* records of this run, not yet written */
+  struct buf rec;          /* the one being put together */
+
+  struct series *series;
+  size_t nseries, series_alloc;
+  unsigned int *hash;      /* by root and name; 0 free, else index + 1 */
+  size_t hash_size;
+
+  time_t last;             /* of the last run in the file */
+
+  struct entry *entries;
+  size_t nentries, entries_alloc;
+
+  /* --since: runs from 'cutoff' on are noted for the wanted folders */
+  time_t cutoff;
+  bool snapped;
+  char **wanted;
+  int nwanted;
+  struct point *points;
+  size_t npoints, points_alloc;
+} h;
+
+static off_t load (FILE *, bool);
+static bool load_name (const unsigned char *, const unsigned char *);
+static bool load_run (const unsigned char *, const unsigned char *, bool);
+static void snapshot (void);
+static unsigned int name_id (unsigned int, const char *);
+static unsigned int find (unsigned int, const char *);
+static unsigned int add (unsigned int, const char *);
+static bool add_entry (unsigned int, bool, long long, long long);
+static void print_series (unsigned int);
+static void print_growth (unsigned int);
+static int by_id (const void *, const void *);
+static int by_growth (const void *, const void *);
+static char * display (unsigned int, char *, size_t);
+static bool matches (const char *, const char *);
+static const char * when (time_t, char *, size_t);
+static void end_record (void);
+static void put (struct buf *, const void *, size_t);
+static void put_varint (struct buf *, unsigned long long);
+static inline unsigned long long zigzag (long long);
+static inline long long unzigzag (unsigned long long);
+static bool get_varint (const unsigned char **, const unsigned char *, unsigned long long *);
+static int get_varint_file (FILE *, unsigned long long *);
+static inline size_t hash_str (unsigned int, const char *);
+
+/* history_open: get ready to add this run to 'file', locking it for as
+ * long as we take. */
+int history_open (const char *file)
+{
+  struct flock lock;
+  FILE *fp;
+  off_t good;
+  int fd;
+
+  h.fd = -1;
+
+  if ((fd = open(file, O_RDWR | O_CREAT, 0644)) < 0)
+  {
+    printf ("maildirtree: %s: %s\n", file, strerror(errno));
+    return -1;
+  }
+
+  memset (&lock, 0, sizeof(lock));
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  while (fcntl(fd, F_SETLKW, &lock) != 0)
+  {
+    if (errno != EINTR)
+    {
+      printf ("maildirtree: %s: cannot lock: %s\n", file, strerror(errno));
+      close (fd);
+      return -1;
+    }
+  }
+
+  if ((fp = fdopen(dup(fd), "r")) == NULL)
+  {
+    printf ("maildirtree: %s: %s\n", file, strerror(errno));
+    close (fd);
+    return -1;
+  }
+
+  good = load (fp, false);
+  fclose (fp);
+
+  if (good < 0)
+  {
+    printf ("maildirtree: %s: not a history file, or a damaged one\n", file);
+    close (fd);
+    return -1;
+  }
+
+  if (ftruncate(fd, good) != 0 || lseek(fd, good, SEEK_SET) < 0 ||
+      (good == 0 && write(fd, HISTORY_MAGIC, MAGIC_LEN) != MAGIC_LEN))
+  {
+    printf ("maildirtree: %s: %s\n", file, strerror(errno));
+    close (fd);
+    return -1;
+  }
+
+  h.fd = fd;
+  return 0;
+}
+
+/* history_add: note the counts of the maildir scanned as 'dir' for this
+ * run, and which of its folders are gone since the last one. */
+void history_add (const char *dir, const struct mdt_tree *t)
+{
+  struct series *s;
+  unsigned int r, id;
+  size_t i;
+
+  if (h.fd < 0 || h.failed)
+    return;
+
+  if ((r = name_id(MDT_NONE, dir)) == MDT_NONE)
+    goto nomem;
+
+  /* Given twice; once is enough */
+  if (h.series[r].seen)
+    return;
+  h.series[r].seen = true;
+
+  for (i = 0; i < t->count; i++)
+  {
+    /* Dummies have nothing to keep, and the partly counted nothing true */
+    if ((i > 0 && t->names[t->path[i]] == '\0') || (t->flags[i] & MDT_PARTIAL))
+      continue;
+
+    if ((id = name_id(r, t->names + t->path[i])) == MDT_NONE)
+      goto nomem;
+
+    s = &h.series[id];
+    s->seen = true;
+
+    if (s->present && s->read == t->read[i] && s->unread == t->unread[i])
+      continue;
+
+    if (!add_entry(id, false, (long long) t->read[i] - (s->present ? s->read : 0),
+                   (long long) t->unread[i] - (s->present ? s->unread : 0)))
+      goto nomem;
+
+    s->present = true;
+    s->read = t->read[i];
+    s->unread = t->unread[i];
+  }
+
+  /* Whatever was not counted might still be there. */
+  if (t->folders_partial > 0)
+    return;
+
+  for (id = 0; id < h.nseries; id++)
+  {
+    s = &h.series[id];
+    if (s->root != r || !s->present || s->seen)
+      continue;
+
+    if (!add_entry(id, true, 0, 0))
+      goto nomem;
+    s->present = false;
+  }
+
+  return;
+
+nomem:
+  h.failed = true;
+  fprintf (stderr, "maildirtree: out of memory; this run is not kept in the history\n");
+}
+
+/* history_expect: for mdt_options.expect, how many messages folder
+ * 'name' of the maildir scanned as 'arg' had in the last run, or 0 if
+ * it is new. */
+unsigned long history_expect (void *arg, const char *name)
+{
+  unsigned int r, id;
+
+  if (h.fd < 0 || (r = find(MDT_NONE, (const char *) arg)) == MDT_NONE ||
+      (id = find(r, name)) == MDT_NONE || !h.series[id].present)
+    return 0;
+
+  return (unsigned long) h.series[id].read + h.series[id].unread;
+}
+
+/* history_close: append this run, if anything changed in it, together
+ * with the names it brought along. */
+void history_close (void)
+{
+  unsigned int next = 0;
+  size_t i, done = 0;
+  ssize_t w;
+
+  if (h.fd < 0)
+    return;
+
+  if (h.nentries > 0)
+  {
+    qsort (h.entries, h.nentries, sizeof(struct entry), &by_id);
+
+    put (&h.rec, "r", 1);
+    put_varint (&h.rec, zigzag((long long) options.now - h.last));
+    put_varint (&h.rec, h.nentries);
+
+    for (i = 0; i < h.nentries; i++)
+    {
+      put_varint (&h.rec, (unsigned long long) (h.entries[i].id - next) * 2 + h.entries[i].gone);
+      if (!h.entries[i].gone)
+      {
+        put_varint (&h.rec, zigzag(h.entries[i].read));
+        put_varint (&h.rec, zigzag(h.entries[i].unread));
+      }
+      next = h.entries[i].id + 1;
+    }
+
+    end_record ();
+  }
+
+  /* Names alone are not worth writing: the run that needs them will
+   * bring them again. */
+  if (!h.failed && h.nentries > 0)
+  {
+    while (done < h.out.len)
+    {
+      if ((w = write(h.fd, h.out.data + done, h.out.len - done)) < 0)
+      {
+        if (errno == EINTR)
+          continue;
+
+        fprintf (stderr, "maildirtree: history: %s\n", strerror(errno));
+        break;
+      }
+      done += w;
+    }
+
+    fdatasync (h.fd);
+  }
+
+  close (h.fd);
+  h.fd = -1;
+}
+
+/* history_main: --since, what the history in 'file' has to say about
+ * the last 'span' seconds: how each of 'folders' went, or if none are
+ * given, which folders grew the most (at most 'top' of them). */
+int history_main (const char *file, unsigned long span, unsigned int top,
+                  char **folders, int nfolders)
+{
+  unsigned int id;
+  FILE *fp;
+  int i;
+
+  if ((fp = fopen(file, "r")) == NULL)
+  {
+    printf ("maildirtree: %s: %s\n", file, strerror(errno));
+    return 1;
+  }
+
+  h.cutoff = time(NULL) - (time_t) span;
+  h.wanted = folders;
+  h.nwanted = nfolders;
+
+  if (load(fp, true) < 0)
+  {
+    printf ("maildirtree: %s: not a history file, or a damaged one\n", file);
+    fclose (fp);
+    return 1;
+  }
+  fclose (fp);
+
+  /* Nothing happened since; it all stands as it was */
+  if (!h.snapped)
+    snapshot ();
+
+  if (nfolders == 0)
+  {
+    print_growth (top);
+    return 0;
+  }
+
+  for (i = 0; i < nfolders; i++)
+    for (id = 0; id < h.nseries; id++)
+      if (h.series[id].wanted == i + 1)
+        print_series (id);
+
+  return 0;
+}
+
+/* load: read the history, returning where the last whole record ends
+ * (0 for an empty file), or -1 if it is no history. With 'query', the
+ * counts as of the cutoff are kept aside and changes after it noted. */
+static off_t load (FILE *fp, bool query)
+{
+  char magic [MAGIC_LEN];
+  unsigned char *rec = NULL, *nrec;
+  unsigned long long len;
+  size_t alloc = 0;
+  off_t good = MAGIC_LEN;
+  int r;
+
+  if (fread(magic, 1, MAGIC_LEN, fp) != MAGIC_LEN)
+    return ferror(fp) ? -1 : 0;
+  if (memcmp(magic, HISTORY_MAGIC, MAGIC_LEN) != 0)
+    return -1;
+
+  while ((r = get_varint_file(fp, &len)) > 0)
+  {
+    if (len == 0 || len > MAX_RECORD)
+      break;
+
+    if (len > alloc)
+    {
+      if ((nrec = (unsigned char *) realloc (rec, len)) == NULL)
+      {
+        free (rec);
+        return -1;
+      }
+      rec = nrec;
+      alloc = len;
+    }
+
+    /* Short: the run writing it was killed. */
+    if (fread(rec, 1, len, fp) != len)
+      break;
+
+    if (!(rec[0] == 'n' ? load_name(rec + 1, rec + len) :
+          rec[0] == 'r' ? load_run(rec + 1, rec + len, query) : false))
+    {
+      free (rec);
+      return -1;
+    }
+
+    good += r + len;
+  }
+
+  free (rec);
+  return good;
+}
+
+static bool load_name (const unsigned char *p, const unsigned char *end)
+{
+  unsigned long long root;
+  unsigned int r, id;
+  char *name;
+
+  if (!get_varint(&p, end, &root) || root > h.nseries)
+    return false;
+
+  r = root > 0 ? (unsigned int) root - 1 : MDT_NONE;
+  if (r != MDT_NONE && h.series[r].root != MDT_NONE)
+    return false;
+
+  if ((name = (char *) malloc (end - p + 1)) == NULL)
+    return false;
+  memcpy (name, p, end - p);
+  name[end - p] = '\0';
+
+  /* Every name is handed out once only. */
+  id = (find(r, name) == MDT_NONE) ? add(r, name) : MDT_NONE;
+  free (name);
+
+  return id != MDT_NONE;
+}
+
+static bool load_run (const unsigned char *p, const unsigned char *end, bool query)
+{
+  unsigned long long delta, k, gap, read, unread, i, next = 0;
+  struct series *s;
+  struct point *npoints;
+  time_t t;
+
+  if (!get_varint(&p, end, &delta) || !get_varint(&p, end, &k))
+    return false;
+  t = h.last + (time_t) unzigzag(delta);
+
+  if (query && !h.snapped && t >= h.cutoff)
+    snapshot ();
+
+  for (i = 0; i < k; i++)
+  {
+    if (!get_varint(&p, end, &gap))
+      return false;
+
+    next += gap >> 1;
+    if (next >= h.nseries || h.series[next].root == MDT_NONE)
+      return false;
+    s = &h.series[next];
+
+    if (gap & 1)
+      s->present = false;
+    else
+    {
+      if (!get_varint(&p, end, &read) || !get_varint(&p, end, &unread))
+        return false;
+
+      if (!s->present)
+        s->read = s->unread = 0;
+      s->read += (unsigned int) unzigzag(read);
+      s->unread += (unsigned int) unzigzag(unread);
+      s->present = true;
+    }
+
+    if (h.snapped && s->wanted)
+    {
+      if (h.npoints == h.points_alloc)
+      {
+        h.points_alloc = h.points_alloc ? h.points_alloc * 2 : 256;
+        npoints = (struct point *) realloc (h.points, h.points_alloc * sizeof(struct point));
+        if (npoints == NULL)
+          return false;
+        h.points = npoints;
+      }
+
+      h.points[h.npoints].id = next;
+      h.points[h.npoints].when = t;
+      h.points[h.npoints].present = s->present;
+      h.points[h.npoints].read = s->read;
+      h.points[h.npoints].unread = s->unread;
+      h.npoints++;
+    }
+
+    next++;
+  }
+
+  h.last = t;
+  return p == end;
+}
+
+/* snapshot: the counts as they stand become those at the cutoff. */
+static void snapshot (void)
+{
+  struct series *s;
+  size_t id;
+
+  for (id = 0; id < h.nseries; id++)
+  {
+    s = &h.series[id];
+    s->was_present = s->present;
+    s->was_read = s->present ? s->read : 0;
+    s->was_unread = s->present ? s->unread : 0;
+  }
+
+  h.snapped = true;
+}
+
+/* name_id: the id of 'name' (see find()), handed out now and its name
+ * record put in if it has none yet. */
+static unsigned int name_id (unsigned int root, const char *name)
+{
+  unsigned int id;
+
+  if ((id = find(root, name)) != MDT_NONE)
+    return id;
+  if ((id = add(root, name)) == MDT_NONE)
+    return MDT_NONE;
+
+  put (&h.rec, "n", 1);
+  put_varint (&h.rec, root == MDT_NONE ? 0 : (unsigned long long) root + 1);
+  put (&h.rec, name, strlen(name));
+  end_record ();
+
+  return h.failed ? MDT_NONE : id;
+}
+
+/* find: the series of folder 'name' of maildir 'root', or of the
+ * maildir at path 'name' if root is MDT_NONE. */
+static unsigned int find (unsigned int root, const char *name)
+{
+  size_t hh, mask = h.hash_size - 1;
+  const struct series *s;
+
+  if (h.hash_size == 0)
+    return MDT_NONE;
+
+  for (hh = hash_str(root, name) & mask; h.hash[hh] != 0; hh = (hh + 1) & mask)
+  {
+    s = &h.series[h.hash[hh] - 1];
+    if (s->root == root && !strcmp(s->name, name))
+      return h.hash[hh] - 1;
+  }
+
+  return MDT_NONE;
+}
+
+static unsigned int add (unsigned int root, const char *name)
+{
+  size_t hh, mask, i, size;
+  struct series *nseries, *s;
+  unsigned int *nhash, id;
+  char path [PATH_MAX];
+  int w;
+
+  if (h.nseries == h.series_alloc)
+  {
+    h.series_alloc = h.series_alloc ? h.series_alloc * 2 : 1024;
+    if ((nseries = (struct series *) realloc (h.series, h.series_alloc * sizeof(struct series))) == NULL)
+      return MDT_NONE;
+    h.series = nseries;
+  }
+
+  /* Keep the hash at most half full */
+  if (2 * (h.nseries + 1) > h.hash_size)
+  {
+    size = h.hash_size ? h.hash_size * 2 : 4096;
+
+    if ((nhash = (unsigned int *) calloc (size, sizeof(unsigned int))) == NULL)
+      return MDT_NONE;
+
+    for (i = 0; i < h.nseries; i++)
+    {
+      for (hh = hash_str(h.series[i].root, h.series[i].name) & (size - 1);
+           nhash[hh] != 0; hh = (hh + 1) & (size - 1))
+        ;
+      nhash[hh] = i + 1;
+    }
+
+    free (h.hash);
+    h.hash = nhash;
+    h.hash_size = size;
+  }
+
+  id = h.nseries;
+  s = &h.series[id];
+  memset (s, 0, sizeof(*s));
+  if ((s->name = strdup(name)) == NULL)
+    return MDT_NONE;
+  s->root = root;
+  h.nseries++;
+
+  mask = h.hash_size - 1;
+  for (hh = hash_str(root, name) & mask; h.hash[hh] != 0; hh = (hh + 1) & mask)
+    ;
+  h.hash[hh] = id + 1;
+
+  if (root != MDT_NONE)
+    for (w = 0; w < h.nwanted && !s->wanted; w++)
+      if (matches(display(id, path, sizeof(path)), h.wanted[w]))
+        s->wanted = w + 1;
+
+  return id;
+}
+
+static bool add_entry (unsigned int id, bool gone, long long read, long long unread)
+{
+  struct entry *nentries;
+
+  if (h.nentries == h.entries_alloc)
+  {
+    h.entries_alloc = h.entries_alloc ? h.entries_alloc * 2 : 1024;
+    if ((nentries = (struct entry *) realloc (h.entries, h.entries_alloc * sizeof(struct entry))) == NULL)
+      return false;
+    h.entries = nentries;
+  }
+
+  h.entries[h.nentries].id = id;
+  h.entries[h.nentries].gone = gone;
+  h.entries[h.nentries].read = read;
+  h.entries[h.nentries].unread = unread;
+  h.nentries++;
+
+  return true;
+}
+
+/* print_series: how folder id went since the cutoff, one line for how
+ * it stood then and one for every change after. */
+static void print_series (unsigned int id)
+{
+  const struct series *s = &h.series[id];
+  char path [PATH_MAX], stamp [32];
+  size_t i;
+
+  printf ("%s\n", display(id, path, sizeof(path)));
+
+  if (s->was_present)
+    printf ("  %s  (%u/%u)\n", when(h.cutoff, stamp, sizeof(stamp)),
+            s->was_unread, s->was_read + s->was_unread);
+  else
+    printf ("  %s  not there\n", when(h.cutoff, stamp, sizeof(stamp)));
+
+  for (i = 0; i < h.npoints; i++)
+  {
+    if (h.points[i].id != id)
+      continue;
+
+    if (h.points[i].present)
+      printf ("  %s  (%u/%u)\n", when(h.points[i].when, stamp, sizeof(stamp)),
+              h.points[i].unread, h.points[i].read + h.points[i].unread);
+    else
+      printf ("  %s  gone\n", when(h.points[i].when, stamp, sizeof(stamp)));
+  }
+}
+
+/* print_growth: the folders that gained the most messages since the
+ * cutoff, with their counts now. */
+static void print_growth (unsigned int top)
+{
+  unsigned int *ids, n = 0, i;
+  const struct series *s;
+  char path [PATH_MAX], stamp [32];
+  long long total;
+
+  if ((ids = (unsigned int *) malloc ((h.nseries + 1) * sizeof(unsigned int))) == NULL)
+  {
+    printf ("maildirtree: out of memory\n");
+    return;
+  }
+
+  for (i = 0; i < h.nseries; i++)
+  {
+    s = &h.series[i];
+    if (s->root != MDT_NONE && s->present &&
+        (long long) s->read + s->unread > (long long) s->was_read + s->was_unread)
+      ids[n++] = i;
+  }
+
+  qsort (ids, n, sizeof(unsigned int), &by_growth);
+
+  printf ("Fastest-growing folders since %s:\n", when(h.cutoff, stamp, sizeof(stamp)));
+  if (n == 0)
+    printf ("  none\n");
+
+  for (i = 0; i < n && i < top; i++)
+  {
+    s = &h.series[ids[i]];
+    total = (long long) s->read + s->unread - s->was_read - s->was_unread;
+    printf ("  %+7lld %+6lld unread  %s (%u/%u)\n", total,
+            (long long) s->unread - s->was_unread, display(ids[i], path, sizeof(path)),
+            s->unread, s->read + s->unread);
+  }
+
+  free (ids);
+}
+
+static int by_id (const void *a, const void *b)
+{
+  unsigned int x = ((const struct entry *) a)->id, y = ((const struct entry *) b)->id;
+
+  return (x > y) - (x < y);
+}
+
+/* by_growth: most messages gained first, then most unread gained */
+static int by_growth (const void *a, const void *b)
+{
+  const struct series *x = &h.series[*(const unsigned int *) a];
+  const struct series *y = &h.series[*(const unsigned int *) b];
+  long long gx = (long long) x->read + x->unread - x->was_read - x->was_unread;
+  long long gy = (long long) y->read + y->unread - y->was_read - y->was_unread;
+
+  if (gx != gy)
+    return gx < gy ? 1 : -1;
+
+  gx = (long long) x->unread - x->was_unread;
+  gy = (long long) y->unread - y->was_unread;
+  return (gx < gy) - (gx > gy);
+}
+
+/* display: folder id as queries name it, the maildir's path and then
+ * Foo/Bar for .Foo.Bar */
+static char * display (unsigned int id, char *buf, size_t size)
+{
+  const struct series *s = &h.series[id];
+  const char *name = s->name;
+  size_t len;
+
+  len = snprintf (buf, size, "%s", h.series[s->root].name);
+  if (*name == '\0' || len + 1 >= size)
+    return buf;
+
+  buf[len++] = '/';
+  while (*name == '.')
+    name++;
+  for (; *name && len + 1 < size; name++)
+    buf[len++] = (*name == '.') ? '/' : *name;
+  buf[len] = '\0';
+
+  return buf;
+}
+
+/* matches: whether 'want' names the folder called 'path', in full or by
+ * its last components */
+static bool matches (const char *path, const char *want)
+{
+  size_t plen = strlen(path), wlen = strlen(want);
+
+  if (wlen > plen)
+    return false;
+
+  return !strcmp(path + plen - wlen, want) &&
+         (wlen == plen || path[plen - wlen - 1] == '/');
+}
+
+static const char * when (time_t t, char *buf, size_t size)
+{
+  struct tm *tm = localtime(&t);
+
+  if (tm == NULL || strftime(buf, size, "%Y-%m-%d %H:%M", tm) == 0)
+    snprintf (buf, size, "%ld", (long) t);
+
+  return buf;
+}
+
+/* end_record: move the record put together into the output, after its
+ * length */
+static void end_record (void)
+{
+  put_varint (&h.out, h.rec.len);
+  put (&h.out, h.rec.data, h.rec.len);
+  h.rec.len = 0;
+}
+
+static void put (struct buf *b, const void *s, size_t len)
+{
+  unsigned char *ndata;
+  size_t want;
+
+  if (h.failed)
+    return;
+
+  if (b->len + len > b->alloc)
+  {
+    for (want = b->alloc ? b->alloc : 4096; want < b->len + len; want *= 2)
+      ;
+    if ((ndata = (unsigned char *) realloc (b->data, want)) == NULL)
+    {
+      h.failed = true;
+      fprintf (stderr, "maildirtree: out of memory; this run is not kept in the history\n");
+      return;
+    }
+    b->data = ndata;
+    b->alloc = want;
+  }
+
+  memcpy (b->data + b->len, s, len);
+  b->len += len;
+}
+
+static void put_varint (struct buf *b, unsigned long long v)
+{
+  unsigned char out [10];
+  size_t n = 0;
+
+  while (v >= 0x80)
+  {
+    out[n++] = (unsigned char) (v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (unsigned char) v;
+
+  put (b, out, n);
+}
+
+static inline unsigned long long zigzag (long long v)
+{
+  return ((unsigned long long) v << 1) ^ (unsigned long long) (v >> 63);
+}
+
+static inline long long unzigzag (unsigned long long v)
+{
+  return (long long) (v >> 1) ^ -(long long) (v & 1);
+}
+
+static bool get_varint (const unsigned char **p, const unsigned char *end,
+                        unsigned long long *v)
+{
+  unsigned int shift = 0;
+
+  *v = 0;
+  while (*p < end && shift < 64)
+  {
+    *v |= (unsigned long long) (**p & 0x7f) << shift;
+    if ((*(*p)++ & 0x80) == 0)
+      return true;
+    shift += 7;
+  }
+
+  return false;
+}
+
+/* get_varint_file: likewise from 'fp'; returns the bytes it took, or 0
+ * at the end of the file or in the middle of a number. */
+static int get_varint_file (FILE *fp, unsigned long long *v)
+{
+  unsigned int shift = 0;
+  int c, n = 0;
+
+  *v = 0;
+  while (shift < 64 && (c = getc(fp)) != EOF)
+  {
+    n++;
+    *v |= (unsigned long long) (c & 0x7f) << shift;
+    if ((c & 0x80) == 0)
+      return n;
+    shift += 7;
+  }
+
+  return 0;
+}
+
+/* FNV-1a, seeded with the root */
+static inline size_t hash_str (unsigned int seed, const char *s)
+{
+  size_t v = 2166136261u ^ seed;
+
+  while (*s)
+    v = (v ^ (unsigned char) *s++) * 16777619u;
+
+  return v;
+}
@@ -0,0 +1,315 @@
+/* libmaildirtree.h: the Maildir scanner behind maildirtree, for programs
+ * that want folder counts without running it and parsing its output.
+ * See maildirtree.c for full copyright.
+ * (C) 2003 by Joshua Kwan. */
+
+#ifndef INCLUDED_libmaildirtree_h
+#define INCLUDED_libmaildirtree_h
+
+#include <stddef.h>
+#include <time.h>
+
+#if !defined(__cplusplus) && __STDC_VERSION__ < 199901L
+typedef enum { false = 0, true } bool;
+#elif !defined(__cplusplus)
+#include <stdbool.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Buckets of the age histogram: delivered less than a day, a week,
+ * 30 days ago, older than that, and files whose names carry no
+ * delivery timestamp at all. */
+enum { MDT_AGE_DAY, MDT_AGE_WEEK, MDT_AGE_MONTH, MDT_AGE_OLDER,
+       MDT_AGE_UNDATED, MDT_AGE_BUCKETS };
+
+struct mdt_ages
+{
+  time_t oldest, newest;   /* newest is 0 if nothing was dated */
+  unsigned int bucket[MDT_AGE_BUCKETS];
+};
+
+/* Modification times of a folder's cur/ and new/, and with opts->audit
+ * of its tmp/, as of its last count. */
+struct mdt_stamps
+{
+  struct timespec cur_mtime, new_mtime, tmp_mtime;
+};
+
+/* What is wrong with a Maildir folder, as opts->audit finds it */
+struct mdt_audit
+{
+  unsigned int duplicates;   /* in new as well as in cur */
+  unsigned int stale;        /* in tmp since MDT_STALE seconds ago */
+  time_t stale_at;           /* when the next one will be, 0 if never */
+};
+
+/* The names of the files of a Maildir folder, summed up for
+ * opts->digest: the low and high halves of a 128-bit number */
+struct mdt_digest
+{
+  unsigned long long lo, hi;
+};
+
+/* A delivery takes seconds; one left in tmp this long was abandoned. */
+#define MDT_STALE (36 * 60 * 60)
+
+/* Everything that is known about one folder. */
+struct mdt_counts
+{
+  unsigned int read, unread;
+  struct mdt_ages ages;
+  struct mdt_stamps stamps;  /* of an mbox, its mtime is in cur_mtime */
+  struct mdt_audit audit;
+  struct mdt_digest digest;
+  unsigned char flags;       /* MDT_MBOX, MDT_PARTIAL */
+};
+
+struct mdt_options
+{
+  /* Fill in mdt_tree.ages, measured against 'now' (0 means the time
+   * the scan or mdt_refresh() started). */
+  bool ages;
+  time_t now;
+
+  /* Fill in mdt_tree.stamps, which mdt_refresh() needs. */
+  bool stamps;
+
+  /* Order of the subfolders of each folder, an MDT_SORT_* */
+  int sort;
+
+  /* Count mbox files (those starting with "From ") as folders too. All
+   * their messages are read, unless mbox_status says to go by the
+   * Status: header, where an R means read. */
+  bool mbox, mbox_status;
+
+  /* Take counts from Dovecot's index where it is up to date, see
+   * mdt_dovecot_counts(). Not done when asked for ages or unique. */
+  bool dovecot;
+
+  /* Fill in mdt_tree.unique, telling the messages of a Maildir apart by
+   * their inodes (as read from the directory, without a stat() each),
+   * so that one hard-linked into several folders counts once. Only
+   * mdt_scan() and mdt_refresh() of a directory do this. */
+  bool unique;
+
+  /* Fill in mdt_tree.audit: the messages of a folder in both new and
+   * cur (by their unique names, before any :2, info), found while
+   * counting them, and the files in tmp older than MDT_STALE seconds by
+   * the time at the start of their names, which costs a listing of tmp
+   * but no stat() of anything in it. Not for archives or mboxes. */
+  bool audit;
+
+  /* Fill in mdt_tree.digest: for each folder, the sum of a 128-bit hash
+   * of the name of every file in cur and in new (told apart), taken
+   * while counting them. Two copies of a folder have the same digest
+   * exactly when they have the same files under the same names, short
+   * of a collision, whatever order they are listed in. Not for
+   * archives or mboxes, whose digests are zero. */
+  bool digest;
+
+  /* Count the folders of mdt_scan() on this many threads (0 or 1 means
+   * just the caller's), taking them in the order of how long they are
+   * expected to take, longest first. 'expect' says how many messages a
+   * folder had the last time, by the name it would be handed to an
+   * mdt_walk() callback with, or 0 if it does not know; then the size
+   * of its cur and new directories has to do. May be NULL. Not done
+   * with unique, nor where there are no threads. */
+  unsigned int threads;
+  unsigned long (*expect) (void *arg, const char *name);
+  void *expect_arg;
+
+  /* Stop counting once the CLOCK_MONOTONIC time passes this; zero means
+   * never. The folder being counted then keeps what it had, and those
+   * left in the listing of the root get no counts at all; both are
+   * flagged MDT_PARTIAL. The clock is only looked at between batches
+   * of directory entries, so a directory that hangs in the kernel
+   * still holds the scan up. Archives are read to the end regardless. */
+  struct timespec deadline;
+
+  /* Asked before each folder is counted, by the name it would be handed
+   * to an mdt_walk() callback with; if it returns true, the folder has
+   * the counts it filled in and is not looked at at all. May be NULL.
+   * Archives are always read in full. */
+  bool (*lookup) (void *arg, const char *name, struct mdt_counts *counts);
+  void *lookup_arg;
+
+  /* Called with a one-line message for every folder that had to be
+   * skipped. May be NULL to ignore them. */
+  void (*warn) (void *arg, const char *msg);
+  void *warn_arg;
+};
+
+/* Folder flags */
+#define MDT_DUMMY 0x01      /* only implied, as .Foo is by .Foo.Bar */
+#define MDT_MBOX  0x02      /* an mbox file, not a Maildir */
+#define MDT_PARTIAL 0x04    /* not counted in full before the deadline */
+
+/* Optional columns of a tree */
+#define MDT_AGES   0x01
+#define MDT_STAMPS 0x02
+#define MDT_AUDIT  0x04
+#define MDT_DIGEST 0x08
+
+/* Orders of subfolders. By count means the most messages first, and
+ * then by name. */
+enum { MDT_SORT_NAME, MDT_SORT_UNREAD, MDT_SORT_TOTAL, MDT_SORT_NONE };
+
+#define MDT_NONE ((unsigned int) -1)
+
+/* A folder hierarchy, as parallel arrays with one entry per folder.
+ *
+ * Folders are laid out in preorder: folder 0 is the root, and the
+ * subtree of folder i is i .. i + size[i] - 1. So i + size[i] is the
+ * next sibling of i, if that has the same parent, and walking the
+ * hierarchy top-down is a straight run through memory. */
+struct mdt_tree
+{
+  size_t count;
+
+  unsigned int *parent;    /* index of the parent, MDT_NONE for the root */
+  unsigned int *size;      /* folders in the subtree, this one included */
+  unsigned int *depth;     /* 0 for the root */
+  unsigned int *name;      /* offset of the name in 'names' */
+  unsigned int *path;      /* offset of the directory name (.Foo.Bar) in
+                            * 'names', empty for the root and dummies */
+  unsigned int *read, *unread;
+  unsigned char *flags;
+  struct mdt_ages *ages;   /* NULL unless asked for */
+  struct mdt_stamps *stamps; /* likewise */
+  struct mdt_audit *audit;   /* likewise */
+  struct mdt_digest *digest; /* likewise */
+
+  char *names;             /* NUL-terminated names, back to back */
+  size_t names_len;        /* bytes in 'names' */
+
+  unsigned int total_read, total_unread, folders_unread;
+  unsigned int folders_partial;  /* flagged MDT_PARTIAL */
+  unsigned int unique;     /* distinct messages if opts->unique, else 0 */
+  struct mdt_ages total_ages;
+  struct mdt_audit total_audit;
+  unsigned int folders_audit;    /* with anything in their mdt_audit */
+
+  struct timespec mtime;   /* of the root directory, if stamps */
+};
+
+/* Scan the Maildir at 'path' and all of its Courier-style subfolders.
+ * Returns NULL with errno set if 'path' cannot be read. opts may be NULL.
+ * Everything is allocated together and released by mdt_free().
+ *
+ * If 'path' is a file, it is taken for a tar archive of a Maildir and
+ * handed to mdt_scan_archive(). */
+struct mdt_tree * mdt_scan (const char *path, const struct mdt_options *opts);
+
+/* What mdt_scan() names the root of a tree from 'path': its last
+ * component, in 'buf' of 'size' bytes, which is returned. */
+const char * mdt_root_name (const char *path, char *buf, size_t size);
+
+/* Scan a Maildir inside a tar archive, plain or compressed with gzip or
+ * zstd (if built with zlib or libzstd), without extracting it. The
+ * Maildir is the shallowest directory with a cur/ or new/ in it, and the
+ * result is what mdt_scan() of it extracted would give. Fails with
+ * EINVAL if 'path' is no tar archive, ENOTSUP for compression we were
+ * built without. */
+struct mdt_tree * mdt_scan_archive (const char *path, const struct mdt_options *opts);
+void mdt_free (struct mdt_tree *tree);
+
+/* Bring a tree from mdt_scan() with stamps up to date, recounting only
+ * the folders whose cur/ or new/ changed since (or with opts->audit, the
+ * stale files of those whose tmp/ did, or where one has since gone
+ * stale). If folders were added
+ * or removed, *tree is replaced by a fresh scan; otherwise folders stay
+ * in the order they were, even when sorted by count. Returns the number of
+ * folders recounted, or -1 with errno set (*tree is then left alone). */
+long mdt_refresh (struct mdt_tree **tree, const char *path,
+                  const struct mdt_options *opts);
+
+/* Recompute the totals of a tree whose counts were changed in place. */
+void mdt_update_totals (struct mdt_tree *tree);
+
+/* Sum up the counts of every folder and all of its subfolders into
+ * 'read' and 'unread', which have room for tree->count each. */
+void mdt_rollup (const struct mdt_tree *tree, unsigned int *read, unsigned int *unread);
+
+/* Building a tree by hand, for folders that come from somewhere other
+ * than mdt_scan(). 'columns' says which of the optional arrays the tree
+ * gets (MDT_AGES, MDT_STAMPS, MDT_AUDIT,
+ * MDT_DIGEST), and mdt_builder_sort() how subfolders
+ * are ordered (by name unless told otherwise). mdt_insert() takes a
+ * folder name as found in a Maildir (.Foo.Bar), creating dummies for
+ * any parents not seen yet; the empty name is the root. It returns the folder's index in the
+ * builder, or MDT_NONE if memory ran out. Fields of 'counts' without a
+ * column are ignored.
+ *
+ * mdt_finish() consumes the builder and lays the tree out, or returns
+ * NULL with errno set. */
+struct mdt_builder;
+
+struct mdt_builder * mdt_builder_new (const char *root, unsigned int columns);
+void mdt_builder_sort (struct mdt_builder *b, int sort);
+unsigned int mdt_insert (struct mdt_builder *b, const char *name,
+                         const struct mdt_counts *counts);
+struct mdt_tree * mdt_finish (struct mdt_builder *b);
+void mdt_builder_free (struct mdt_builder *b);
+
+/* Sort 'n' items by their names, NUL-terminated strings in 'names' at
+ * offset[item] (or at item itself if offset is NULL), bytewise except
+ * that the dot goes before every other character. Folder names sorted
+ * this way always have their subfolders right after them: Foo, Foo.Bar,
+ * Foo-Baz rather than Foo, Foo-Baz, Foo.Bar. */
+void mdt_sort_names (unsigned int *items, size_t n, const char *names,
+                     const unsigned int *offset);
+
+/* Walk the Maildir at 'path' like mdt_scan(), but instead of building a
+ * tree, call 'fn' with each folder as soon as it is counted: first the
+ * root as "", then the subfolders by directory name (.Foo.Bar) in
+ * readdir() order. Returns 0, -1 with errno set if 'path' cannot be
+ * read, or whatever nonzero value 'fn' returned to stop the walk. */
+int mdt_walk (const char *path, const struct mdt_options *opts,
+              int (*fn) (void *arg, const char *name,
+                         const struct mdt_counts *counts),
+              void *arg);
+
+/* Whether the entry 'e' of a Maildir's top level could be a folder that
+ * mdt_walk() hands over, going only by what readdir() said of it:
+ * anything that may be a directory, and with opts->mbox a regular file,
+ * for which *flags gets MDT_MBOX (otherwise 0). A walk past its
+ * deadline hands these over as MDT_PARTIAL without a stat(). */
+struct dirent;
+bool mdt_maybe_folder (const struct dirent *e, const struct mdt_options *opts,
+                       unsigned char *flags);
+
+/* Count a single folder at 'path', leaving its subfolders alone: a
+ * Maildir, or with opts->mbox an mbox file. Returns -1 if it is neither
+ * (or a Maildir missing cur/ or new/), with whatever was found in
+ * 'counts' all the same. */
+int mdt_count_folder (const char *path, const struct mdt_options *opts,
+                      struct mdt_counts *counts);
+
+/* mdt_walk() of a tar archive, see mdt_scan_archive(). */
+int mdt_walk_archive (const char *path, const struct mdt_options *opts,
+                      int (*fn) (void *arg, const char *name,
+                                 const struct mdt_counts *counts),
+                      void *arg);
+
+/* Read the counts of the Maildir folder at 'path' from the header of its
+ * dovecot.index, without listing cur/ or new/: all messages are read
+ * but the unseen ones. Only trusted if the modification times of cur/
+ * and new/ that Dovecot noted when it last synced are still what they
+ * are; returns -1 otherwise, or if there is no usable index. */
+int mdt_dovecot_counts (const char *path, struct mdt_counts *counts);
+
+/* Helpers for mdt_ages */
+void mdt_clear_ages (struct mdt_ages *a);
+void mdt_add_ages (struct mdt_ages *to, const struct mdt_ages *from);
+
+/* File a message into 'a' by the delivery time its name starts with. */
+void mdt_age_message (struct mdt_ages *a, const char *name, time_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !INCLUDED_libmaildirtree_h */
@@ -23,12 +23,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
-#include <sys/stat.h>
 #include <limits.h>
-#include <dirent.h>
 #include <unistd.h>
-#include <fcntl.h>
 #include <errno.h>
+#include <time.h>
 
 /* Special headers that aren't always available. */
 
@@ -40,46 +38,151 @@
 #include <libgen.h>
 #endif
 
-static void insert_tree (struct Directory *, char*, unsigned int, unsigned int);
 static void process (char*, char*);
-static struct Directory * read_this_dir (DIR*, char*, int*, int*, int*);
-static void print_tree (struct Directory *, int);
-static unsigned int count_messages (DIR *);
-static void clean (struct Directory * root);
-static inline void restore_stderr(void);
-static void push_back (char*** array, size_t *curlen, char* string);
+static struct mdt_tree * scan (const char *);
+static void set_deadline (unsigned long);
+static bool parse_span (const char *, unsigned long *);
+
+static void warn (void *, const char *);
 
 static char usage [] =
 "Maildirtree " PACKAGE_VERSION " by Joshua Kwan <joshk@triplehelix.org>\n\
 Syntax: maildirtree [opts] maildir [maildir...] \n\
+  (a maildir may be an IMAP account, imap://[user[:password]@]host[:port])\n\
 Options:\n"
 #ifdef HAVE_GETOPT_LONG
 "  -h, --help\tDisplay this help message.\n\
   -s, --summary\tOnly print total counts of read and unread messages\n\
+  -a, --ages\tShow delivery dates and an age histogram for each folder\n\
   -n, --nocolor\tDo not highlight folders that contain unread messages in white\n\
-  -q, --quiet\tDo not print warning messages at all. (Same as 2>/dev/null)";
+  -q, --quiet\tDo not print warning messages at all. (Same as 2>/dev/null)\n\
+  -d, --daemon\tKeep the maildirs in memory and answer queries on a socket\n\
+  -S, --socket PATH\tUnix socket the daemon listens on\n\
+  -P, --publish FILE\tKeep the counts of one maildir current in FILE\n\
+  -i, --interval SECS\tHow often --publish looks for changes (default 1)\n\
+  -R, --read-shm FILE\tPrint the counts published in FILE\n\
+  -t, --stream\tPrint huge maildirs in little memory, folders sorted by name\n\
+  -o, --sort KEY\tOrder folders by name (default), unread or total\n\
+  -m, --mbox\tCount mbox files as folders too\n\
+  -M, --mbox-status\tLikewise, with unread messages by their Status: header\n\
+  -D, --dovecot\tTake counts from up-to-date Dovecot indexes (unread = unseen)\n\
+  -T, --deadline MS\tPrint what was counted after MS milliseconds, at most\n\
+  -I, --interactive\tBrowse the tree, counting only the folders shown\n\
+  -c, --checkpoint FILE\tJournal what has been counted in FILE\n\
+  -r, --resume\tCarry on from the --checkpoint journal, skipping what it has\n\
+  -k, --shard K/N\tCount only shard K of N, into the --checkpoint file\n\
+  -g, --merge\tPrint what the part files given instead of maildirs add up to\n\
+  -u, --rollup\tShow what each folder holds with its subfolders as well\n\
+  -H, --history FILE\tKeep the counts of every run in FILE\n\
+  -w, --since SPAN\tShow from the --history how folders went over SPAN (24h, 7d)\n\
+  -l, --top N\tWith --since and no folders given, show the N that grew most\n\
+  -U, --unique\tAlso count messages hard-linked into several folders once\n\
+  -L, --spool DIR\tWith --daemon, serve every user's maildir under DIR\n\
+  -W, --watch\tWith --daemon, follow changes with fanotify (needs root)\n\
+  -x, --tunnel CMD\tTalk IMAP to CMD instead of connecting to imap:// hosts\n\
+  -j, --jobs N\tCount folders on N threads, the biggest first\n\
+  -A, --audit\tAlso find messages in both new and cur, and stale files in tmp\n\
+  -z, --digest\tPrint a digest of the names in each folder instead of the tree\n\
+  -C, --compare\tShow where the two maildirs given differ by counts or digests";
 #else
 "  -h\tDisplay this help message.\n\
   -s\tOnly print total counts of read and unread messages\n\
+  -a\tShow delivery dates and an age histogram for each folder\n\
   -n\tDo not highlight folders that contain unread messages in white\n\
-  -q\tDo not print warning messages at all. (Same as 2>/dev/null)";
+  -q\tDo not print warning messages at all. (Same as 2>/dev/null)\n\
+  -d\tKeep the maildirs in memory and answer queries on a socket\n\
+  -S PATH\tUnix socket the daemon listens on\n\
+  -P FILE\tKeep the counts of one maildir current in FILE\n\
+  -i SECS\tHow often -P looks for changes (default 1)\n\
+  -R FILE\tPrint the counts published in FILE\n\
+  -t\tPrint huge maildirs in little memory, folders sorted by name\n\
+  -o KEY\tOrder folders by name (default), unread or total\n\
+  -m\tCount mbox files as folders too\n\
+  -M\tLikewise, with unread messages by their Status: header\n\
+  -D\tTake counts from up-to-date Dovecot indexes (unread = unseen)\n\
+  -T MS\tPrint what was counted after MS milliseconds, at most\n\
+  -I\tBrowse the tree, counting only the folders shown\n\
+  -c FILE\tJournal what has been counted in FILE\n\
+  -r\tCarry on from the -c journal, skipping what it has\n\
+  -k K/N\tCount only shard K of N, into the -c file\n\
+  -g\tPrint what the part files given instead of maildirs add up to\n\
+  -u\tShow what each folder holds with its subfolders as well\n\
+  -H FILE\tKeep the counts of every run in FILE\n\
+  -w SPAN\tShow from the -H file how folders went over SPAN (24h, 7d)\n\
+  -l N\tWith -w and no folders given, show the N that grew most\n\
+  -U\tAlso count messages hard-linked into several folders once\n\
+  -L DIR\tWith -d, serve every user's maildir under DIR\n\
+  -W\tWith -d, follow changes with fanotify (needs root)\n\
+  -x CMD\tTalk IMAP to CMD instead of connecting to imap:// hosts\n\
+  -j N\tCount folders on N threads, the biggest first\n\
+  -A\tAlso find messages in both new and cur, and stale files in tmp\n\
+  -z\tPrint a digest of the names in each folder instead of the tree\n\
+  -C\tShow where the two maildirs given differ by counts or digests";
 #endif
 
-int stderrfd;
-bool summary = false, nocolor = false;
-char** unread_dirs = NULL;
-size_t urd_len = 0;
+bool summary = false, nocolor = false, quiet = false, daemonize = false;
+bool rollup = false;
+bool stream = false, interactive = false, resume = false;
+char *socket_path = NULL, *publish_file = NULL, *read_file = NULL;
+char *checkpoint_file = NULL, *history_file = NULL, *spool = NULL;
+bool watching = false;
+char *tunnel = NULL;
+bool merge = false, compare = false;
+unsigned int shard_k = 0, shard_n = 0;
+unsigned int interval = 1;
+
+/* --since: a --history query over the last 'since_secs' */
+bool since = false;
+unsigned long since_secs;
+unsigned int top = 10;
+struct mdt_options options;
+
+/* --deadline: when we have to be done, and whether anything was left
+ * uncounted because of it */
+bool deadline = false, partial = false;
+unsigned long deadline_ms;
+struct timespec hard_deadline;
 
 int main (int argc, char* argv[])
 {
   int opt;
   char cd [PATH_MAX];
+  const char *mode;
 #ifdef HAVE_GETOPT_LONG
   struct option longopts [] = {
           { "help"   , 0, 0, 'h' },
           { "summary", 0, 0, 's' },
+          { "ages"   , 0, 0, 'a' },
           { "nocolor", 0, 0, 'n' },
           { "quiet"  , 0, 0, 'q' },
+          { "daemon" , 0, 0, 'd' },
+          { "socket" , 1, 0, 'S' },
+          { "publish", 1, 0, 'P' },
+          { "interval", 1, 0, 'i' },
+          { "read-shm", 1, 0, 'R' },
+          { "stream" , 0, 0, 't' },
+          { "sort"   , 1, 0, 'o' },
+          { "mbox"   , 0, 0, 'm' },
+          { "mbox-status", 0, 0, 'M' },
+          { "dovecot", 0, 0, 'D' },
+          { "deadline", 1, 0, 'T' },
+          { "interactive", 0, 0, 'I' },
+          { "checkpoint", 1, 0, 'c' },
+          { "resume" , 0, 0, 'r' },
+          { "shard"  , 1, 0, 'k' },
+          { "merge"  , 0, 0, 'g' },
+          { "rollup" , 0, 0, 'u' },
+          { "history", 1, 0, 'H' },
+          { "since"  , 1, 0, 'w' },
+          { "top"    , 1, 0, 'l' },
+          { "unique" , 0, 0, 'U' },
+          { "spool"  , 1, 0, 'L' },
+          { "watch"  , 0, 0, 'W' },
+          { "tunnel" , 1, 0, 'x' },
+          { "jobs"   , 1, 0, 'j' },
+          { "audit"  , 0, 0, 'A' },
+          { "digest" , 0, 0, 'z' },
+          { "compare", 0, 0, 'C' },
           { 0, 0, 0, 0 },
   };
 #endif
@@ -88,15 +191,10 @@ int main (int argc, char* argv[])
   if (!isatty(1))
     nocolor = true;
 
-  /* Save stderr unconditionally */
-  stderrfd = dup(2);
-
-  atexit (&restore_stderr);
-
 #ifdef HAVE_GETOPT_LONG
-  while ((opt = getopt_long (argc, argv, "hsnq", longopts, NULL)) != -1)
+  while ((opt = getopt_long (argc, argv, "hsanqdS:P:i:R:to:mMDT:Ic:rk:guH:w:l:UL:Wx:j:AzC", longopts, NULL)) != -1)
 #else
-  while ((opt = getopt (argc, argv, "hsnq")) != -1)
+  while ((opt = getopt (argc, argv, "hsanqdS:P:i:R:to:mMDT:Ic:rk:guH:w:l:UL:Wx:j:AzC")) != -1)
 #endif
   {
     switch (opt)
@@ -109,12 +207,157 @@ int main (int argc, char* argv[])
         summary = true;
         break;
 
+      case 'a':
+        options.ages = true;
+        break;
+
       case 'n':
         nocolor = true;
         break;
 
       case 'q':
-        dup2(open("/dev/null", O_WRONLY), 2);
+        quiet = true;
+        break;
+
+      case 'd':
+        daemonize = true;
+        break;
+
+      case 'S':
+        socket_path = optarg;
+        break;
+
+      case 'P':
+        publish_file = optarg;
+        break;
+
+      case 'i':
+        interval = (unsigned int) atoi(optarg);
+        if (interval == 0)
+          interval = 1;
+        break;
+
+      case 'R':
+        read_file = optarg;
+        break;
+
+      case 't':
+        stream = true;
+        break;
+
+      case 'o':
+        if (!strcmp(optarg, "name"))
+          options.sort = MDT_SORT_NAME;
+        else if (!strcmp(optarg, "unread"))
+          options.sort = MDT_SORT_UNREAD;
+        else if (!strcmp(optarg, "total"))
+          options.sort = MDT_SORT_TOTAL;
+        else
+        {
+          printf ("maildirtree: unknown sort order '%s'\n", optarg);
+          return 1;
+        }
+        break;
+
+      case 'M':
+        options.mbox_status = true;
+        /* fall through */
+
+      case 'm':
+        options.mbox = true;
+        break;
+
+      case 'D':
+        options.dovecot = true;
+        break;
+
+      case 'T':
+        deadline = true;
+        deadline_ms = strtoul(optarg, NULL, 10);
+        break;
+
+      case 'I':
+        interactive = true;
+        break;
+
+      case 'c':
+        checkpoint_file = optarg;
+        break;
+
+      case 'r':
+        resume = true;
+        break;
+
+      case 'k':
+        if (sscanf(optarg, "%u/%u", &shard_k, &shard_n) != 2 ||
+            shard_k == 0 || shard_k > shard_n)
+        {
+          printf ("maildirtree: --shard takes K/N, with K from 1 to N\n");
+          return 1;
+        }
+        break;
+
+      case 'g':
+        merge = true;
+        break;
+
+      case 'u':
+        rollup = true;
+        break;
+
+      case 'H':
+        history_file = optarg;
+        break;
+
+      case 'w':
+        since = true;
+        if (!parse_span(optarg, &since_secs))
+        {
+          printf ("maildirtree: --since takes a span such as 90m, 24h or 7d\n");
+          return 1;
+        }
+        break;
+
+      case 'l':
+        top = (unsigned int) atoi(optarg);
+        break;
+
+      case 'U':
+        options.unique = true;
+        break;
+
+      case 'L':
+        spool = optarg;
+        break;
+
+      case 'W':
+        watching = true;
+        break;
+
+      case 'x':
+        tunnel = optarg;
+        break;
+
+      case 'j':
+        if (atoi(optarg) < 1)
+        {
+          printf ("maildirtree: --jobs takes a number from 1 up\n");
+          return 1;
+        }
+        options.threads = (unsigned int) atoi(optarg);
+        break;
+
+      case 'A':
+        options.audit = true;
+        break;
+
+      case 'z':
+        options.digest = true;
+        break;
+
+      case 'C':
+        compare = true;
+        options.digest = true;
         break;
 
       case '?':
@@ -123,435 +366,340 @@ int main (int argc, char* argv[])
     }
   }
 
-  if (optind >= argc)
+  if (!quiet)
+    options.warn = &warn;
+
+  /* Digests are printed instead of the tree, and so of its summary. */
+  if (options.digest && summary)
   {
-    /* Make sure we get no false positive */
-    errno = 0;
-    
-    getcwd (cd, PATH_MAX);
-    
-    if (errno != 0)
-    {
-      printf("maildirtree: can't get working directory: %s", strerror(errno));
-      return 1;
-    }
-    
-    process(".", basename(cd));
-    
-    return 0;
+    printf ("maildirtree: --digest cannot be used with --summary\n");
+    return 1;
   }
 
-  while (optind < argc) 
+  /* Only a scan of its own sees all of a maildir's inodes. */
+  if (options.unique && (stream || deadline || checkpoint_file))
   {
-    process(argv[optind++], 0);
-    puts("");
+    printf ("maildirtree: --unique cannot be used with --%s\n",
+            stream ? "stream" : deadline ? "deadline" : "checkpoint");
+    return 1;
   }
-    
-  return 0;
-}
 
-static void process (char* dir, char* fake)
-{
-  DIR * maildir;
-  struct Directory * root = NULL;
-  int p, folders_unread = 0, total_read = 0, total_unread = 0;
-  
-  if ((maildir = opendir(dir)) != NULL)
+  /* These hand each folder on as it is counted, one after the other. */
+  if (options.threads > 1 && (deadline || stream || checkpoint_file))
   {
-    root = read_this_dir(maildir, dir, &folders_unread, &total_read, &total_unread);
-    closedir(maildir);
-            
-    if (!summary)
-    {
-      /* First we print the root entry manually... */
-	    
-      /* indentation of the unread message count, and printf basically returns
-       * strlen(fake) + 1 (or strlen(root->name) if that's the case) */
-      p = COUNT_START - printf("%s ", fake ? fake : root->name);
-      while (p > 0) { putchar(' '); p--; }
-    
-      /* Unread message count */
-      printf ("%s(%u/%u)%s\n",
-         (root->unread > 0 && !nocolor) ? "\033[1m" : "",
-         root->unread, root->read + root->unread,
-         (!nocolor) ? "\033[0m" : "");
-      
-      /* Print the rest of the children */
-      print_tree (root, -1);
-     
-      if (total_unread > 0)
-      {
-	
-        printf ("\n%d message%c unread in %d folder%c, %d messages total.\n",
-             total_unread, 
-             (total_unread > 1) ? 's' : 0,
-             folders_unread,
-             (folders_unread > 1) ? 's' : 0,
-             total_read + total_unread);
-      }
-      else
-      {
-        printf ("\n%d messages unread, %d messages total.\n",
-             total_unread, total_read + total_unread);
-      }
-    }
-                
-    else
-    {
-      if (total_unread > 0)
-      {
-	unsigned int i = 0, printed;
-	printf("%s: %d message%c unread in %d folder%c, %d messages total.\n",
-	    dir, total_unread,
-	    (total_unread > 1) ? 's' : 0,
-	    folders_unread,
-	    (folders_unread > 1) ? 's' : 0,
-	    total_read + total_unread);
-	assert (unread_dirs != NULL);
-	printed = printf ("Unread messages in: ");
-	for (i = 0; i < urd_len; i++)
-	{
-	  if (printed + strlen(unread_dirs[i]) + 2 >= 80)
-	  {
-	    printf("\n");
-	    printed = 0;
-	  }
-	  printed += printf("%s%s", unread_dirs[i],
-	      i == urd_len - 1 ? "" : ", ");
-	}
-      }
-      else
-        printf ("%s: %d messages unread, %d messages total.\n",
-             dir, total_unread, total_read + total_unread);
-    }
-      
-    clean(root);
-    root = NULL;
-    folders_unread = total_read = total_unread = 0;
+    printf ("maildirtree: --jobs cannot be used with --%s\n",
+            deadline ? "deadline" : stream ? "stream" : "checkpoint");
+    return 1;
   }
-  else
+
+  /* A stream comes out by name, and each folder is gone once printed. */
+  if (stream && (options.sort != MDT_SORT_NAME || rollup))
   {
-    printf ("maildirtree: %s: %s\n", dir, strerror(errno));
-    exit (1);
+    printf ("maildirtree: --%s cannot be used with --stream\n",
+            rollup ? "rollup" : "sort");
+    return 1;
   }
-}
-
-/* read_this_dir: reads a directory, and recurses into all folders below
- * 'd'.
- *
- * FIXME: Should be called many times. Many many times. Increase this
- * recursion and make it real clean.
- */
-
-static struct Directory * read_this_dir (DIR* d, char* rootpath, int* fu, int* tr, int* tu)
-{
-  DIR *curdir, *newdir;
-  struct dirent *entries;
-  struct Directory *root = (struct Directory *)malloc(sizeof(struct Directory));
-  struct stat isdir;
-  char *cur_path, *new_path, *stattmp;
-  int count = 0, len;
-  size_t rlen;
-  unsigned int r, u;
-
-  root->name = strdup(basename(rootpath));
-  
-  /* Used later, save a call to strlen */
-  rlen = strlen(rootpath);
-
-  cur_path = (char *)malloc(rlen + 5);
-  new_path = (char *)malloc(rlen + 5);
-  
-  snprintf (cur_path, rlen + 5, "%s/cur", rootpath);
-  snprintf (new_path, rlen + 5, "%s/new", rootpath);
-
-  curdir = opendir(cur_path);
-  newdir = opendir(new_path);
-
-  root->read   = (curdir != NULL) ? count_messages(curdir) : 0;
-  root->unread = (newdir != NULL) ? count_messages(newdir) : 0;
 
-  *tr += root->read;
-  *tu += root->unread;
-  
-  if (root->unread > 0)
+  /* Neither a stream nor a journal has anywhere to put them. */
+  if (options.audit && (stream || checkpoint_file))
   {
-    (*fu)++;
-    push_back (&unread_dirs, &urd_len, root->name);
+    printf ("maildirtree: --audit cannot be used with --%s\n",
+            stream ? "stream" : "checkpoint");
+    return 1;
   }
 
-  if (!curdir || !newdir) /* Are we SURE this is a Maildir? */
-    fprintf(stderr, "WARNING: %s does not look like a complete Maildir\n", rootpath);
+  /* A stream has nowhere to put them either. */
+  if (options.digest && stream)
+  {
+    printf ("maildirtree: --digest cannot be used with --stream\n");
+    return 1;
+  }
 
-  root->count   = 0;
-  root->subdirs = NULL;
-  root->last    = true;
-  root->parent  = NULL;
- 
-  closedir (curdir);
-  closedir (newdir);
+  /* The modes other than printing what maildirs hold do not scan the
+   * way process() does. Of them the daemon, --publish and --compare
+   * scan with the options, and only the daemon has anywhere to put
+   * unique counts or audits. */
+  mode = daemonize ? "daemon" : publish_file ? "publish" : read_file ? "read-shm" :
+         interactive ? "interactive" : since ? "since" : merge ? "merge" :
+         compare ? "compare" : NULL;
 
-  free (cur_path);
-  free (new_path);
+  if (mode && (stream || deadline || checkpoint_file || resume || shard_n ||
+               (history_file && !since)))
+  {
+    printf ("maildirtree: --%s cannot be used with --%s\n", mode,
+            stream ? "stream" : deadline ? "deadline" :
+            checkpoint_file ? "checkpoint" : resume ? "resume" :
+            shard_n ? "shard" : "history");
+    return 1;
+  }
 
-  count = 0;
-  
-  while ((entries = readdir(d)) != NULL)
+  if (mode && !daemonize && (options.unique || options.audit ||
+      (options.threads > 1 && !publish_file && !compare)))
   {
-    len = rlen + strlen(entries->d_name) + 6;
+    printf ("maildirtree: --%s cannot be used with --%s\n", mode,
+            options.unique ? "unique" : options.audit ? "audit" : "jobs");
+    return 1;
+  }
 
-    stattmp = (char*) malloc(len - 4);
-    snprintf (stattmp, len - 4, "%s/%s", rootpath, entries->d_name);
-    stat (stattmp, &isdir);
-    free (stattmp);
-    
-    if (S_ISDIR(isdir.st_mode) &&
-        strcmp(entries->d_name, ".") &&
-        strcmp(entries->d_name, "..") &&
-	strcmp(entries->d_name, "cur") &&
-	strcmp(entries->d_name, "new") &&
-	strcmp(entries->d_name, "tmp"))
-    {
-      cur_path = (char*)malloc(len);
-      new_path = (char*)malloc(len);
-      
-      snprintf (cur_path, len, "%s/%s/cur", rootpath, entries->d_name);
-      snprintf (new_path, len, "%s/%s/new", rootpath, entries->d_name);
+  /* Every age is measured against the same instant, except where
+   * counting goes on for days: there each count has its own (0). */
+  if (!daemonize && !publish_file)
+    options.now = time(NULL);
 
-      curdir = opendir(cur_path);
-      newdir = opendir(new_path);
+  if (daemonize)
+  {
+    static char *here[] = { "." };
 
-      if (!curdir || !newdir)
-      {
-        fprintf(stderr, "WARNING: %s is missing cur or new; ignoring!\n", entries->d_name);
-        if (curdir) closedir(curdir);
-        if (newdir) closedir(newdir);
+    char **paths;
+    int n;
 
-        free(cur_path);
-        free(new_path);
+    /* Colors make no sense down a socket. */
+    nocolor = true;
 
-        continue;
-      }
-     
-      /* Assign to r and u the unread message counts for *THIS* folder, 
-       * add it to the totals. */
-      *tr += (r = (curdir != NULL) ? count_messages(curdir) : 0);
-      *tu += (u = (newdir != NULL) ? count_messages(newdir) : 0);
-      
-      if (u > 0)
+    if (spool)
+    {
+      if ((paths = spool_maildirs(spool, &n)) == NULL)
       {
-	(*fu)++;
-	push_back(&unread_dirs, &urd_len, entries->d_name);
+        printf ("maildirtree: %s: no maildirs: %s\n", spool, strerror(errno));
+        return 1;
       }
-      
-      insert_tree(root, entries->d_name, r, u);
-
-      if (curdir) closedir(curdir);
-      if (newdir) closedir(newdir);
-      
-      free(cur_path);
-      free(new_path);
+
+      return daemon_main (paths, n, socket_path, watching);
     }
-  }
 
-  return root;
-}
+    if (optind >= argc)
+      return daemon_main (here, 1, socket_path, watching);
 
-/* insert_tree()
- * 
- * precondition: dirs points to a listing of directories in a Maildir
- * as created by read_this_dir, and root is allocated already
- *
- * FIXME: detection for .Foo.Bar where .Foo does not exist; set a flag
- * to not print message count which is 0/0
- */
-static void insert_tree (struct Directory * root, char* dirName, unsigned int read, unsigned int unread)
-{
-  bool found;
-  struct Directory *i = root;
-  char *test;        
+    return daemon_main (argv + optind, argc - optind, socket_path, watching);
+  }
 
-  /* Ignore the first null token of dirName if it's leading by a dot. */
-  if (*dirName == '.')
-    dirName++;
-  
-  /* Loop on strtok until it is NULL. */
-  test = strtok (dirName, ".");
+  if (read_file)
+    return read_shm_main (read_file);
 
-  do
+  if (interactive)
   {
-    found = false;
+    if (argc - optind > 1)
+    {
+      printf ("maildirtree: --interactive takes one maildir\n");
+      return 1;
+    }
 
-    /* Find it in the 'current' list, unless there are no subdirs */
-    if (i->subdirs)
+    /* Warnings would only mess up the screen. */
+    options.warn = NULL;
+    return browse_main (optind < argc ? argv[optind] : ".");
+  }
+
+  if (publish_file)
+  {
+    if (argc - optind > 1)
     {
-      int x;
-      for (x = 0; x < i->count; x++)
-      {
-        if (!strcmp(test, i->subdirs[x]->name)) /* FOUND IT */
-        {
-          i = i->subdirs[x];
-          found = true;
-          break;
-        }
-      }
-      if (!found) /* Additional recursion impossible, must create */
-        goto create;
+      printf ("maildirtree: --publish takes one maildir\n");
+      return 1;
     }
-    else /* This is our first */
+
+    return publish_main (optind < argc ? argv[optind] : ".", publish_file, interval);
+  }
+
+  if (since)
+  {
+    if (!history_file)
     {
-create:
-      i->count++;
-      i->subdirs = (struct Directory **) realloc (i->subdirs, sizeof(struct Directory*) * i->count);
-      i->subdirs[i->count - 1] = (struct Directory *)malloc (sizeof(struct Directory));
-      i->subdirs[i->count - 1]->parent = i;
-      
-      /* There was a 'last' one before this */
-      if (i->count > 1)
-        i->subdirs[i->count - 2]->last = false;
-
-      i = i->subdirs[i->count - 1];
-      i->name = strdup(test);
-      i->count = 0;
-      
-      /* This will be set for real later if this actually exists,
-       * but prevents junk if this is not the case (i.e. .Foo.Bar where
-       * .Foo is non-existent. */
-      
-      i->read = 0;
-      i->unread = 0;
-      i->dummy = true;
-      
-      i->subdirs = NULL;
-      i->last = true;
+      printf ("maildirtree: --since needs --history\n");
+      return 1;
     }
+
+    return history_main (history_file, since_secs, top, argv + optind, argc - optind);
   }
-  while ((test = strtok (NULL, ".")) != NULL);
 
-  /* This is only valid on the innermost node */
-  i->read = read;
-  i->unread = unread;
-  i->dummy = false;
-}
+  /* Only for printing; the clock starts now. */
+  if (deadline)
+    set_deadline (deadline_ms);
 
-static void print_tree (struct Directory * start, int level)
-{
-  int j, k, l;
-  struct Directory *it = start;
-  
-  /* This is a little messy but works. Basically we need to look from the
-   * root down to see whether we should print additional pipes for those
-   * levels, not from the bottom up as our data structure mandates. 
-   *
-   * EXPECT KID TO GET CLOBBERED! DO NOT RELY ON IT FOR MULTIPLE
-   * CALLS OF THIS FUNCTION! CAVEAT EMPTOR! ACHTUNG! ATTENTION!
-   */
-  
-  for (l = level; l > 0; l--)
+  if (merge)
+    return merge_main (argv + optind, argc - optind);
+
+  if (compare)
   {
-    it->parent->kid = it;
-    it = it->parent;
+    if (argc - optind != 2)
+    {
+      printf ("maildirtree: --compare takes two maildirs\n");
+      return 1;
+    }
+
+    return compare_main (argv[optind], argv[optind + 1]);
   }
-  
-  for (l = level; l > 0; l--)
+
+  if ((resume || shard_n) && !checkpoint_file)
   {
-    assert (it != NULL);
-    putchar ( !it->last ? '|' : ' ' );
+    printf ("maildirtree: --%s needs --checkpoint\n", resume ? "resume" : "shard");
+    return 1;
+  }
 
-    /* Move down into our temporary top-down hierarchy */
-    it = it->kid;
-    
-    for (j = 0; j < INDENT_LEN; j++)
-      putchar(' ');
+  if (checkpoint_file && checkpoint_open(checkpoint_file, resume) != 0)
+    return 1;
+
+  if (history_file)
+  {
+    if (stream || shard_n)
+    {
+      printf ("maildirtree: --history cannot be kept with --%s\n", stream ? "stream" : "shard");
+      return 1;
+    }
+
+    if (history_open(history_file) != 0)
+      return 1;
+
+    /* The last run says best which folders will take longest. */
+    options.expect = &history_expect;
   }
-  
-  if (start->parent != NULL) /* Not the start entry */
+
+  if (optind >= argc)
   {
-    /* We've already printed INDENT_LEN + 1 number of spaces,
-     * the tree 'graphic' + the name; offset the COUNT_START by this
-     * to align correctly. */
-	  
-    k = COUNT_START - (level * (INDENT_LEN + 1)) -
-            printf("%c-- %s ", start->last ? '`' : '|', start->name);
+    /* Make sure we get no false positive */
+    errno = 0;
     
-    /* Actually print the spaces. */
-    if (!start->dummy)
-    {
-      while (k > 0)
-      {
-        putchar(' ');
-        k--;
-      }
+    getcwd (cd, PATH_MAX);
     
-    /* Unread/total message count */
-      printf ("%s(%u/%u)%s\n", 
-          (start->unread > 0 && !nocolor) ? "\033[1m" : "",
-          start->unread, start->read + start->unread,
-          (!nocolor) ? "\033[0m" : "");
+    if (errno != 0)
+    {
+      printf("maildirtree: can't get working directory: %s", strerror(errno));
+      return 1;
     }
-    else
+    
+    process(".", basename(cd));
+    checkpoint_close ();
+    history_close ();
+    
+    return partial ? 2 : 0;
+  }
+
+  while (optind < argc) 
+  {
+    process(argv[optind++], 0);
+    if (!shard_n)
       puts("");
   }
-  
-  for (j = 0; j < start->count; j++)
-    print_tree (start->subdirs[j], level + 1);
+
+  checkpoint_close ();
+  history_close ();
+    
+  return partial ? 2 : 0;
 }
 
-/* precondition: dir must have been opendir'd */
-static unsigned int count_messages (DIR *dir)
+/* set_deadline: give ourselves 'ms' milliseconds from now. The scan is
+ * told to stop an eighth of that earlier, so that it normally winds
+ * down by itself and there is time left for printing. */
+static void set_deadline (unsigned long ms)
 {
-  unsigned int r = 0;
-  struct dirent * tmp;
+  struct timespec now;
 
-  while ((tmp = readdir(dir)) != NULL)
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  hard_deadline.tv_sec = now.tv_sec + ms / 1000;
+  hard_deadline.tv_nsec = now.tv_nsec + (ms % 1000) * 1000000;
+  if (hard_deadline.tv_nsec >= 1000000000)
+  {
+    hard_deadline.tv_sec++;
+    hard_deadline.tv_nsec -= 1000000000;
+  }
+
+  ms -= ms / 8;
+  options.deadline.tv_sec = now.tv_sec + ms / 1000;
+  options.deadline.tv_nsec = now.tv_nsec + (ms % 1000) * 1000000;
+  if (options.deadline.tv_nsec >= 1000000000)
   {
-    if (*tmp->d_name != '.') /* assuming that dotfiles != messages */
-      r++;
+    options.deadline.tv_sec++;
+    options.deadline.tv_nsec -= 1000000000;
   }
 
-  return r;
+  /* Zero would mean no deadline at all. */
+  if (options.deadline.tv_sec == 0 && options.deadline.tv_nsec == 0)
+    options.deadline.tv_nsec = 1;
 }
 
-static void clean (struct Directory * root)
+/* parse_span: seconds, or minutes, hours, days or weeks going by the
+ * suffix */
+static bool parse_span (const char *arg, unsigned long *secs)
 {
-  root->count--;
+  char *end;
+  unsigned long n = strtoul(arg, &end, 10);
 
-  while (root->count >= 0)
+  if (end == arg)
+    return false;
+
+  switch (*end)
   {
-    clean(root->subdirs[root->count]);
-    root->count--;
+    case '\0': case 's': break;
+    case 'm': n *= 60; break;
+    case 'h': n *= 3600; break;
+    case 'd': n *= 86400; break;
+    case 'w': n *= 7 * 86400; break;
+    default: return false;
   }
 
-  assert (root->count == -1);
-  
-  free(root->subdirs);
-  free(root->name);
-  free(root);
-}
+  if (*end && end[1])
+    return false;
 
-static inline void restore_stderr(void)
-{
-  dup2(stderrfd, 2);
+  *secs = n;
+  return true;
 }
 
-static void push_back (char*** array, size_t *curlen, char* string)
+static void process (char* dir, char* fake)
 {
-  char* ptr = NULL;
-  
-  if (array == NULL)
-    (*array) = malloc(sizeof(char*));
+  struct mdt_tree * res;
+  const char *name = dir;
+  char shown [PATH_MAX];
+  int r;
+
+  /* An IMAP account's password is no part of its name. */
+  if (is_imap(dir))
+    name = imap_name (dir, shown, sizeof(shown));
+
+  /* For --history to say what to expect of its folders */
+  options.expect_arg = (void *) name;
+
+  if (stream && !is_imap(dir))
+  {
+    if ((r = stream_report(stdout, dir, fake)) >= 0)
+    {
+      partial |= r > 0;
+      return;
+    }
+  }
+  else if ((res = scan(dir)) != NULL)
+  {
+    /* A shard's counts are only for merging. */
+    if (!shard_n && options.digest)
+      print_digests (stdout, res);
+    else if (!shard_n)
+      report (stdout, res, name, fake);
+    if (history_file)
+      history_add (name, res);
+    partial |= res->folders_partial > 0;
+    mdt_free(res);
+  }
   else
-    (*array) = realloc(*array, sizeof(char*) * (*curlen + 1));
+  {
+    printf ("maildirtree: %s: %s\n", name, strerror(errno));
+    exit (1);
+  }
+}
 
-  /* Kill the annoying leading . */
-  if (*string == '.')
-    string++;
-  
-  (*array)[*curlen] = strdup(string);
-  
-  /* change into a more legible format */
-  while ((ptr = strchr((*array)[*curlen], '.')) != NULL)
-    *ptr = '/';
+/* scan: mdt_scan(), or whichever of it the options ask for */
+static struct mdt_tree * scan (const char *dir)
+{
+  if (is_imap(dir))
+    return imap_scan (dir, tunnel);
+  if (checkpoint_file)
+    return checkpoint_scan (dir);
+  if (deadline)
+    return deadline_scan (dir, &hard_deadline);
+
+  return mdt_scan (dir, &options);
+}
 
-  (*curlen)++;
+static void warn (void *arg, const char *msg)
+{
+  (void) arg;
+  fprintf(stderr, "WARNING: %s\n", msg);
 }
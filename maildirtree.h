@@ -4,20 +4,78 @@
 #ifndef INCLUDED_maildirtree_h
 #define INCLUDED_maildirtree_h
 
-#if !defined(__cplusplus) && __STDC_VERSION__ < 199901L
-typedef enum { false = 0, true } bool;
-#endif
-
-struct Directory
-{
-  char * name;
-  struct Directory ** subdirs;
-  int count;
-  unsigned int unread;
-  unsigned int read;
-  struct Directory * parent;
-  struct Directory * kid;
-  bool last, dummy;
-};
+#include <stdio.h>
+
+/* All the scanning is done by the library. */
+#include "libmaildirtree.h"
+
+/* maildirtree.c */
+extern bool summary, nocolor, rollup;
+extern struct mdt_options options;
+extern unsigned int shard_k, shard_n;
+
+/* print.c */
+void report (FILE *, const struct mdt_tree *, const char *, const char *);
+void print_tree (FILE *, const struct mdt_tree *);
+char * folder_path (const struct mdt_tree *, size_t, const char *, char *, size_t);
+void print_root (FILE *, const char *, const struct mdt_counts *, bool);
+void print_line (FILE *, const bool *, unsigned int, bool, const char *,
+                 const struct mdt_counts *, const struct mdt_counts *, bool);
+void print_totals (FILE *, const char *, unsigned int, unsigned int, unsigned int);
+void print_unread (FILE *, const char *, unsigned int *, bool);
+void print_unique (FILE *, const struct mdt_tree *);
+void print_partial (FILE *, unsigned int);
+void print_audit (FILE *, const struct mdt_tree *, const char *);
+void print_ages (FILE *, const struct mdt_ages *);
+
+/* daemon.c */
+int daemon_main (char **, int, const char *, bool);
+char ** spool_maildirs (const char *, int *);
+
+/* watch.c */
+enum { WATCH_NONE, WATCH_ROOT, WATCH_FOLDER, WATCH_CUR, WATCH_NEW };
+
+struct watch;
+struct watch * watch_open (void);
+int watch_fd (const struct watch *);
+int watch_add (struct watch *, unsigned int, const char *, const struct mdt_tree *);
+void watch_forget (struct watch *, unsigned int);
+int watch_read (struct watch *, void (*) (void *, unsigned int, unsigned int, int, int), void *);
+void watch_close (struct watch *);
+
+/* stream.c */
+int stream_report (FILE *, const char *, const char *);
+
+/* browse.c */
+int browse_main (const char *);
+
+/* checkpoint.c */
+int checkpoint_open (const char *, bool);
+void checkpoint_close (void);
+struct mdt_tree * checkpoint_scan (const char *);
+int merge_main (char **, int);
+
+/* history.c */
+int history_open (const char *);
+void history_add (const char *, const struct mdt_tree *);
+unsigned long history_expect (void *, const char *);
+void history_close (void);
+int history_main (const char *, unsigned long, unsigned int, char **, int);
+
+/* imap.c */
+bool is_imap (const char *);
+const char * imap_name (const char *, char *, size_t);
+struct mdt_tree * imap_scan (const char *, const char *);
+
+/* digest.c */
+void print_digests (FILE *, const struct mdt_tree *);
+int compare_main (const char *, const char *);
+
+/* deadline.c */
+struct mdt_tree * deadline_scan (const char *, const struct timespec *);
+
+/* shm.c */
+int publish_main (const char *, const char *, unsigned int);
+int read_shm_main (const char *);
 
 #endif /* !INCLUDED_maildirtree_h */
@@ -0,0 +1,487 @@
+/* microbench.c: timing the kernels of maildirtree one at a time, for
+ * "make microbench". See maildirtree.c for full copyright.
+ *
+ * Every benchmark builds its fixture once, then runs its kernel over
+ * it again and again for at least MIN_TIME seconds. What it reports per
+ * operation (one name, one message, one folder) is the best time of any
+ * run and, where perf_event_open() lets us, cycles, instructions and
+ * cache misses over all runs together.
+ *
+ *   mdtbench [name]    runs the benchmarks whose names contain 'name' */
+
+#include "config.h"
+
+#include "maildirtree.h"
+#include "snprintf.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/* How long each benchmark runs for, at least, and how often */
+#define MIN_TIME 0.25
+#define MIN_RUNS 3
+#define MAX_RUNS 10000
+
+/* What print.c wants from maildirtree.c */
+bool summary = false, nocolor = true, rollup = false;
+struct mdt_options options;
+
+struct fixture;
+
+struct bench
+{
+  const char *name;
+  size_t n;                          /* size of the fixture */
+  int (*setup) (struct fixture *);
+  size_t (*run) (struct fixture *);  /* returns the operations done */
+  void (*teardown) (struct fixture *);
+};
+
+/* What a benchmark runs over, made by its setup() */
+struct fixture
+{
+  const struct bench *bench;
+  size_t n;
+  struct mdt_options opts;
+  char *names;                       /* fixture names, back to back */
+  unsigned int *offsets, *items;
+  struct mdt_tree *tree;
+  char dir [PATH_MAX];
+  FILE *out;
+};
+
+enum { CYCLES, INSTRUCTIONS, CACHE_MISSES, COUNTERS };
+
+static int counter [COUNTERS] = { -1, -1, -1 };
+
+static void counters_open (void);
+static void counters_start (void);
+static void counters_stop (unsigned long long *);
+static double now (void);
+static void measure (struct fixture *);
+
+static int make_names (struct fixture *, int);
+static int make_flat (struct fixture *);
+static int make_deep (struct fixture *);
+static int make_stamps (struct fixture *);
+static int make_random (struct fixture *);
+static int make_maildir (struct fixture *);
+static int make_ages_maildir (struct fixture *);
+static int make_tree (struct fixture *);
+static int make_summary (struct fixture *);
+static void free_fixture (struct fixture *);
+static void remove_maildir (struct fixture *);
+
+static size_t run_age_message (struct fixture *);
+static size_t run_count_folder (struct fixture *);
+static size_t run_insert (struct fixture *);
+static size_t run_sort_names (struct fixture *);
+static size_t run_report (struct fixture *);
+
+static const struct bench benches [] = {
+  { "age_message",         100000, &make_stamps,       &run_age_message,  &free_fixture },
+  { "count_folder",          1000, &make_maildir,      &run_count_folder, &remove_maildir },
+  { "count_folder",         10000, &make_maildir,      &run_count_folder, &remove_maildir },
+  { "count_folder",        100000, &make_maildir,      &run_count_folder, &remove_maildir },
+  { "count_folder/ages",    10000, &make_ages_maildir, &run_count_folder, &remove_maildir },
+  { "insert/flat",          40000, &make_flat,         &run_insert,       &free_fixture },
+  { "insert/deep",          40000, &make_deep,         &run_insert,       &free_fixture },
+  { "sort_names",           40000, &make_random,       &run_sort_names,   &free_fixture },
+  { "print_tree",           40000, &make_tree,         &run_report,       &free_fixture },
+  { "summary",              40000, &make_summary,      &run_report,       &free_fixture },
+};
+
+int main (int argc, char *argv[])
+{
+  size_t i;
+
+  counters_open ();
+
+  printf ("%-20s %7s %10s %10s %10s %10s\n", "benchmark", "n",
+          "ns/op", "cycles/op", "instr/op", "misses/op");
+
+  for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+  {
+    const struct bench *b = &benches[i];
+    struct fixture f;
+
+    if (argc > 1 && strstr(b->name, argv[1]) == NULL)
+      continue;
+
+    memset (&f, 0, sizeof(f));
+    f.bench = b;
+    f.n = b->n;
+
+    if (b->setup(&f) != 0)
+    {
+      printf ("%-20s %7lu   setup failed: %s\n", b->name, (unsigned long) b->n,
+              strerror(errno));
+      continue;
+    }
+
+    measure (&f);
+    b->teardown (&f);
+  }
+
+  return 0;
+}
+
+/* measure: run f's benchmark until it has had enough, and print what it cost. */
+static void measure (struct fixture *f)
+{
+  unsigned long long sum [COUNTERS] = { 0, 0, 0 }, got [COUNTERS];
+  double start, t, best = 0, total = 0;
+  size_t ops = 0, done;
+  unsigned int runs, c;
+
+  for (runs = 0; runs < MAX_RUNS && (runs < MIN_RUNS || total < MIN_TIME); runs++)
+  {
+    counters_start ();
+    start = now();
+    done = f->bench->run(f);
+    t = now() - start;
+    counters_stop (got);
+
+    for (c = 0; c < COUNTERS; c++)
+      sum[c] += got[c];
+
+    if (runs == 0 || t / done < best)
+      best = t / done;
+    total += t;
+    ops += done;
+  }
+
+  printf ("%-20s %7lu %10.1f", f->bench->name, (unsigned long) f->n, best * 1e9);
+  for (c = 0; c < COUNTERS; c++)
+  {
+    if (counter[c] >= 0)
+      printf (" %10.1f", (double) sum[c] / ops);
+    else
+      printf (" %10s", "-");
+  }
+  putchar ('\n');
+}
+
+/* Kernels */
+
+static size_t run_age_message (struct fixture *f)
+{
+  struct mdt_ages a;
+  size_t i;
+
+  mdt_clear_ages (&a);
+  for (i = 0; i < f->n; i++)
+    mdt_age_message (&a, f->names + f->offsets[i], options.now);
+
+  return f->n;
+}
+
+static size_t run_count_folder (struct fixture *f)
+{
+  struct mdt_counts c;
+
+  mdt_count_folder (f->dir, &f->opts, &c);
+  return c.read + c.unread;
+}
+
+static size_t run_insert (struct fixture *f)
+{
+  struct mdt_builder *builder;
+  struct mdt_counts c;
+  size_t i;
+
+  memset (&c, 0, sizeof(c));
+  builder = mdt_builder_new("bench", 0);
+  for (i = 0; i < f->n; i++)
+    mdt_insert (builder, f->names + f->offsets[i], &c);
+  mdt_free (mdt_finish(builder));
+
+  return f->n;
+}
+
+static size_t run_sort_names (struct fixture *f)
+{
+  memcpy (f->items, f->offsets, f->n * sizeof(unsigned int));
+  mdt_sort_names (f->items, f->n, f->names, NULL);
+
+  return f->n;
+}
+
+/* report() of a ready tree to /dev/null, the tree or the summary */
+static size_t run_report (struct fixture *f)
+{
+  summary = f->bench->setup == &make_summary;
+  report (f->out, f->tree, "bench", NULL);
+  fflush (f->out);
+
+  return f->tree->count;
+}
+
+/* Fixtures */
+
+/* make_names: f->n names in one buffer, of the given kind */
+enum { FLAT, DEEP, STAMPS, RANDOM };
+
+static int make_names (struct fixture *f, int kind)
+{
+  char name [NAME_MAX + 1];
+  size_t i, len, at = 0, alloc = f->n * 64;
+  unsigned int r = 12345;
+  int d, depth;
+
+  f->names = (char *) malloc (alloc);
+  f->offsets = (unsigned int *) malloc (f->n * sizeof(unsigned int));
+  f->items = (unsigned int *) malloc (f->n * sizeof(unsigned int));
+  if (!f->names || !f->offsets || !f->items)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  for (i = 0; i < f->n; i++)
+  {
+    r = r * 1103515245 + 12345;
+
+    switch (kind)
+    {
+      case FLAT:
+        /* Tens of thousands of siblings */
+        len = snprintf (name, sizeof(name), ".Sibling%06lu", (unsigned long) i);
+        break;
+
+      case DEEP:
+        /* Four to eight levels, sharing prefixes, with dummies */
+        depth = 4 + (r >> 16) % 5;
+        for (len = 0, d = 0; d < depth; d++)
+          len += snprintf (name + len, sizeof(name) - len, ".%c%lu", 'a' + d,
+                           (unsigned long) (i >> (3 * (depth - d - 1))) % 8);
+        break;
+
+      case STAMPS:
+        /* Maildir message names, a few of them undated */
+        len = snprintf (name, sizeof(name), "%s%lu.M%luP%u.bench:2,S",
+                        (r >> 8) % 50 ? "" : "x", 1600000000UL + (r >> 4) % 50000000,
+                        (unsigned long) i, r % 65536);
+        break;
+
+      default:
+        len = snprintf (name, sizeof(name), "Folder.%u.%x", (r >> 20) % 100, r);
+        break;
+    }
+
+    f->offsets[i] = at;
+    memcpy (f->names + at, name, len + 1);
+    at += len + 1;
+  }
+
+  return 0;
+}
+
+static int make_flat (struct fixture *f) { return make_names (f, FLAT); }
+static int make_deep (struct fixture *f) { return make_names (f, DEEP); }
+static int make_stamps (struct fixture *f) { return make_names (f, STAMPS); }
+static int make_random (struct fixture *f) { return make_names (f, RANDOM); }
+
+/* make_maildir: a folder of f->n messages, three quarters of them read,
+ * in tmpfs if there is one so that the disk stays out of it */
+static int make_maildir (struct fixture *f)
+{
+  char path [PATH_MAX + NAME_MAX + 8];
+  const char *tmp = getenv("TMPDIR");
+  struct stat st;
+  size_t i;
+  int fd;
+
+  if (tmp == NULL)
+    tmp = (stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode)) ? "/dev/shm" : "/tmp";
+
+  snprintf (f->dir, sizeof(f->dir), "%s/mdtbench.XXXXXX", tmp);
+  if (mkdtemp(f->dir) == NULL || make_stamps(f) != 0)
+    return -1;
+
+  snprintf (path, sizeof(path), "%s/cur", f->dir);
+  mkdir (path, 0700);
+  snprintf (path, sizeof(path), "%s/new", f->dir);
+  mkdir (path, 0700);
+
+  for (i = 0; i < f->n; i++)
+  {
+    snprintf (path, sizeof(path), "%s/%s/%s", f->dir, i % 4 ? "cur" : "new",
+              f->names + f->offsets[i]);
+    if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) < 0)
+    {
+      remove_maildir (f);
+      return -1;
+    }
+    close (fd);
+  }
+
+  return 0;
+}
+
+static int make_ages_maildir (struct fixture *f)
+{
+  f->opts.ages = true;
+  return make_maildir (f);
+}
+
+/* make_tree: a deep tree of f->n folders, with something in every one */
+static int make_tree (struct fixture *f)
+{
+  struct mdt_builder *builder;
+  struct mdt_counts c;
+  size_t i;
+
+  if (make_deep(f) != 0 || (f->out = fopen("/dev/null", "w")) == NULL)
+    return -1;
+
+  memset (&c, 0, sizeof(c));
+  builder = mdt_builder_new("bench", 0);
+  for (i = 0; i < f->n; i++)
+  {
+    c.read = i % 100;
+    c.unread = i % 7 == 0;
+    mdt_insert (builder, f->names + f->offsets[i], &c);
+  }
+
+  return (f->tree = mdt_finish(builder)) ? 0 : -1;
+}
+
+static int make_summary (struct fixture *f)
+{
+  return make_tree (f);
+}
+
+static void free_fixture (struct fixture *f)
+{
+  free (f->names);
+  free (f->offsets);
+  free (f->items);
+  if (f->tree)
+    mdt_free (f->tree);
+  if (f->out)
+    fclose (f->out);
+}
+
+static void remove_maildir (struct fixture *f)
+{
+  char path [PATH_MAX + NAME_MAX + 8];
+  const char *sub[] = { "cur", "new" };
+  struct dirent *e;
+  DIR *d;
+  int i;
+
+  for (i = 0; i < 2; i++)
+  {
+    snprintf (path, sizeof(path), "%s/%s", f->dir, sub[i]);
+    if ((d = opendir(path)) == NULL)
+      continue;
+
+    while ((e = readdir(d)) != NULL)
+    {
+      if (*e->d_name == '.')
+        continue;
+      snprintf (path, sizeof(path), "%s/%s/%s", f->dir, sub[i], e->d_name);
+      unlink (path);
+    }
+    closedir (d);
+
+    snprintf (path, sizeof(path), "%s/%s", f->dir, sub[i]);
+    rmdir (path);
+  }
+
+  rmdir (f->dir);
+  free_fixture (f);
+}
+
+/* Counters */
+
+/* counters_open: cycles, instructions and cache misses of this process,
+ * kernel included if we may (listing directories is mostly kernel). */
+static void counters_open (void)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  static const unsigned long long config [COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+  };
+  struct perf_event_attr attr;
+  int c, user_only;
+
+  for (user_only = 0; user_only <= 1 && counter[0] < 0; user_only++)
+  {
+    for (c = 0; c < COUNTERS; c++)
+    {
+      memset (&attr, 0, sizeof(attr));
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = config[c];
+      attr.disabled = 1;
+      attr.exclude_kernel = user_only;
+      attr.exclude_hv = 1;
+
+      counter[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    if (counter[0] >= 0 && user_only)
+      printf ("(counting user space only)\n");
+  }
+
+  if (counter[0] < 0)
+    printf ("(no hardware counters: %s)\n", strerror(errno));
+#endif
+}
+
+static void counters_start (void)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  int c;
+
+  for (c = 0; c < COUNTERS; c++)
+    if (counter[c] >= 0)
+    {
+      ioctl (counter[c], PERF_EVENT_IOC_RESET, 0);
+      ioctl (counter[c], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+static void counters_stop (unsigned long long *got)
+{
+  int c;
+
+  for (c = 0; c < COUNTERS; c++)
+  {
+    got[c] = 0;
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    if (counter[c] >= 0)
+    {
+      ioctl (counter[c], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(counter[c], &got[c], sizeof(got[c])) != sizeof(got[c]))
+        got[c] = 0;
+    }
+#endif
+  }
+}
+
+static double now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
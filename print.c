@@ -0,0 +1,371 @@
+/* print.c: printing scanned Maildirs as maildirtree does. See
+ * maildirtree.c for full copyright.
+ * (C) 2003 by Joshua Kwan. */
+
+#include "config.h"
+
+#include "maildirtree.h"
+#include "snprintf.h"
+#include "probes.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+/* Where --rollup goes, counting from the start of the counts */
+#define ROLLUP_START 16
+
+/* report: print the tree, or just the summary, of a scanned Maildir.
+ * 'dir' is what the user called it, 'fake' what to call the root. */
+void report (FILE *out, const struct mdt_tree *res, const char *dir, const char *fake)
+{
+  struct mdt_counts c;
+
+  if (!summary)
+  {
+    /* First we print the root entry manually... */
+    c.read = res->read[0];
+    c.unread = res->unread[0];
+    c.flags = res->flags[0];
+    if (res->ages)
+      c.ages = res->ages[0];
+    print_root (out, fake ? fake : res->names + res->name[0], &c, res->ages != NULL);
+    
+    /* Print the rest of the children */
+    print_tree (out, res);
+   
+    print_totals (out, NULL, res->total_read, res->total_unread, res->folders_unread);
+    print_unique (out, res);
+    print_partial (out, res->folders_partial);
+    print_audit (out, res, fake);
+
+    if (res->ages)
+    {
+      fprintf (out, "Ages:");
+      print_ages (out, &res->total_ages);
+      putc('\n', out);
+    }
+  }
+              
+  else
+  {
+    print_totals (out, dir, res->total_read, res->total_unread, res->folders_unread);
+    print_unique (out, res);
+    print_partial (out, res->folders_partial);
+    print_audit (out, res, fake);
+
+    if (res->total_unread > 0)
+    {
+      size_t i;
+      unsigned int printed, n = 0;
+      char path [PATH_MAX];
+
+      printed = fprintf (out, "Unread messages in: ");
+      for (i = 0; i < res->count; i++)
+      {
+        if (res->unread[i] == 0)
+          continue;
+
+        folder_path (res, i, fake, path, sizeof(path));
+        print_unread (out, path, &printed, ++n == res->folders_unread);
+      }
+    }
+
+    if (res->ages)
+    {
+      fprintf (out, "%sAges:", res->total_unread > 0 ? "\n" : "");
+      print_ages (out, &res->total_ages);
+      putc('\n', out);
+    }
+  }
+
+  PROBE2 (report__done, dir, res->count);
+}
+
+/* print_root: the first line of the tree. */
+void print_root (FILE *out, const char *name, const struct mdt_counts *c, bool ages)
+{
+  int p;
+
+  /* indentation of the unread message count, and printf basically returns
+   * strlen(fake) + 1 (or strlen(root->name) if that's the case) */
+  p = COUNT_START - fprintf(out, "%s ", name);
+  while (p > 0) { putc(' ', out); p--; }
+
+  /* Unread message count */
+  fprintf (out, "%s(%u/%u%s)%s",
+     (c->unread > 0 && !nocolor) ? "\033[1m" : "",
+     c->unread, c->read + c->unread,
+     (c->flags & MDT_PARTIAL) ? "+" : "",
+     (!nocolor) ? "\033[0m" : "");
+  if (ages)
+    print_ages (out, &c->ages);
+  putc('\n', out);
+}
+
+/* print_totals: the line with the totals, which closes the tree or, given
+ * the 'dir' to name, opens the summary. */
+void print_totals (FILE *out, const char *dir, unsigned int read,
+                   unsigned int unread, unsigned int folders)
+{
+  if (dir)
+    fprintf (out, "%s: ", dir);
+  else
+    putc('\n', out);
+
+  if (unread > 0)
+  {
+    fprintf (out, "%u message%c unread in %u folder%c, %u messages total.\n",
+         unread,
+         (unread > 1) ? 's' : 0,
+         folders,
+         (folders > 1) ? 's' : 0,
+         read + unread);
+  }
+  else
+  {
+    fprintf (out, "%u messages unread, %u messages total.\n",
+         unread, read + unread);
+  }
+}
+
+/* print_unique: after the totals, how many of the messages are distinct
+ * if we were asked to tell, and how many more are only hard links. */
+void print_unique (FILE *out, const struct mdt_tree *res)
+{
+  unsigned int total = res->total_read + res->total_unread;
+
+  if (!options.unique || res->unique == 0)
+    return;
+
+  fprintf (out, "%u distinct message%s", res->unique, (res->unique != 1) ? "s" : "");
+  if (total > res->unique)
+    fprintf (out, ", and %u more hard link%s to them", total - res->unique,
+             (total - res->unique > 1) ? "s" : "");
+  fprintf (out, ".\n");
+}
+
+/* print_partial: after the totals, say that the deadline left some
+ * folders uncounted, if it did. Those are marked with a + after their
+ * counts, which are as far as counting got. */
+void print_partial (FILE *out, unsigned int folders)
+{
+  if (folders == 0)
+    return;
+
+  fprintf (out, "Out of time: %u folder%s not counted in full.\n",
+       folders, (folders > 1) ? "s" : "");
+}
+
+/* print_audit: after the totals, what --audit found, and a line for
+ * each folder it found it in. */
+void print_audit (FILE *out, const struct mdt_tree *res, const char *fake)
+{
+  const struct mdt_audit *a = &res->total_audit;
+  char path [PATH_MAX];
+  size_t i;
+
+  if (res->audit == NULL)
+    return;
+
+  if (res->folders_audit == 0)
+  {
+    fprintf (out, "Audit: nothing in both new and cur, nothing stale in tmp.\n");
+    return;
+  }
+
+  fprintf (out, "Audit: %u message%s in both new and cur, %u file%s in tmp for over %u hours:\n",
+           a->duplicates, (a->duplicates != 1) ? "s" : "",
+           a->stale, (a->stale != 1) ? "s" : "", MDT_STALE / 3600);
+
+  for (i = 0; i < res->count; i++)
+  {
+    if (res->audit[i].duplicates == 0 && res->audit[i].stale == 0)
+      continue;
+
+    fprintf (out, "  %s: %u in both, %u stale\n", folder_path(res, i, fake, path, sizeof(path)),
+             res->audit[i].duplicates, res->audit[i].stale);
+  }
+}
+
+/* print_unread: one folder of the summary's list, wrapped at 80 columns.
+ * 'printed' is how far along the current line we are. */
+void print_unread (FILE *out, const char *path, unsigned int *printed, bool last)
+{
+  if (*printed + strlen(path) + 2 >= 80)
+  {
+    fprintf(out, "\n");
+    *printed = 0;
+  }
+  *printed += fprintf(out, "%s%s", path, last ? "" : ", ");
+}
+
+/* print_tree: print every folder below the root, one per line.
+ *
+ * The folders come in preorder, so all we need to remember while going
+ * down is, for each level above the current one, whether there is
+ * another folder still to come there (and so a pipe to draw). */
+void print_tree (FILE *out, const struct mdt_tree * res)
+{
+  bool *more, last;
+  size_t i, next;
+  struct mdt_counts c, sub;
+  unsigned int *sub_read = NULL, *sub_unread = NULL;
+
+  more = (bool *) malloc (res->count * sizeof(bool));
+  assert (more != NULL);
+
+  if (rollup)
+  {
+    sub_read = (unsigned int *) malloc (res->count * sizeof(unsigned int));
+    sub_unread = (unsigned int *) malloc (res->count * sizeof(unsigned int));
+    assert (sub_read != NULL && sub_unread != NULL);
+    mdt_rollup (res, sub_read, sub_unread);
+  }
+
+  for (i = 1; i < res->count; i++)
+  {
+    /* Whatever follows our subtree is either our next sibling or
+     * belongs further up. */
+    next = i + res->size[i];
+    last = next >= res->count || res->parent[next] != res->parent[i];
+    more[res->depth[i]] = !last;
+
+    c.read = res->read[i];
+    c.unread = res->unread[i];
+    c.flags = res->flags[i];
+    if (res->ages)
+      c.ages = res->ages[i];
+
+    /* Only worth saying for folders with subfolders */
+    if (rollup && res->size[i] > 1)
+    {
+      sub.read = sub_read[i];
+      sub.unread = sub_unread[i];
+    }
+
+    print_line (out, more, res->depth[i], last, res->names + res->name[i],
+                (res->flags[i] & MDT_DUMMY) ? NULL : &c,
+                (rollup && res->size[i] > 1) ? &sub : NULL, res->ages != NULL);
+  }
+
+  free (more);
+  free (sub_read);
+  free (sub_unread);
+}
+
+/* print_line: one line of the tree, for a folder 'depth' levels below
+ * the root. more[1 .. depth - 1] say which levels above still have
+ * folders to come; 'c' is NULL for a dummy. 'sub', if not NULL, is what
+ * the folder holds with its subfolders, for --rollup. */
+void print_line (FILE *out, const bool *more, unsigned int depth, bool last,
+                 const char *name, const struct mdt_counts *c,
+                 const struct mdt_counts *sub, bool ages)
+{
+  unsigned int l;
+  int j, k, n = 0;
+
+  for (l = 1; l < depth; l++)
+  {
+    putc(more[l] ? '|' : ' ', out);
+
+    for (j = 0; j < INDENT_LEN; j++)
+      putc(' ', out);
+  }
+
+  /* We've already printed INDENT_LEN + 1 number of spaces,
+   * the tree 'graphic' + the name; offset the COUNT_START by this
+   * to align correctly. */
+  k = COUNT_START - ((depth - 1) * (INDENT_LEN + 1)) -
+          fprintf(out, "%c-- %s ", last ? '`' : '|', name);
+
+  /* Actually print the spaces. */
+  if (c != NULL || sub != NULL)
+  {
+    while (k > 0)
+    {
+      putc(' ', out);
+      k--;
+    }
+
+  /* Unread/total message count */
+    if (c != NULL)
+    {
+      fprintf (out, "%s", (c->unread > 0 && !nocolor) ? "\033[1m" : "");
+      n = fprintf (out, "(%u/%u%s)", c->unread, c->read + c->unread,
+          (c->flags & MDT_PARTIAL) ? "+" : "");
+      fprintf (out, "%s", (!nocolor) ? "\033[0m" : "");
+    }
+
+    /* The rollup in a column of its own */
+    if (sub != NULL)
+      fprintf (out, "%*s[%u/%u]", ROLLUP_START - n, "",
+          sub->unread, sub->read + sub->unread);
+
+    if (c != NULL && ages)
+      print_ages (out, &c->ages);
+    putc('\n', out);
+  }
+  else
+    putc('\n', out);
+}
+
+void print_ages (FILE *out, const struct mdt_ages *a)
+{
+  char oldest[16], newest[16];
+
+  fprintf (out, "  <1d:%u <7d:%u <30d:%u older:%u",
+       a->bucket[MDT_AGE_DAY], a->bucket[MDT_AGE_WEEK],
+       a->bucket[MDT_AGE_MONTH], a->bucket[MDT_AGE_OLDER]);
+  
+  if (a->bucket[MDT_AGE_UNDATED] > 0)
+    fprintf (out, " undated:%u", a->bucket[MDT_AGE_UNDATED]);
+
+  /* Nothing was dated, so there is no range to show. */
+  if (a->newest == 0)
+    return;
+
+  strftime (oldest, sizeof(oldest), "%Y-%m-%d", localtime(&a->oldest));
+  strftime (newest, sizeof(newest), "%Y-%m-%d", localtime(&a->newest));
+  fprintf (out, " [%s..%s]", oldest, newest);
+}
+
+/* folder_path: write the name of folder i as it reads in summary mode,
+ * Foo/Bar for .Foo.Bar, into buf. The root is called 'fake' if given. */
+char * folder_path (const struct mdt_tree *res, size_t i, const char *fake,
+                    char *buf, size_t size)
+{
+  size_t len = 0, n;
+  unsigned int j;
+
+  if (i == 0)
+  {
+    snprintf (buf, size, "%s", fake ? fake : res->names + res->name[0]);
+    return buf;
+  }
+
+  /* Measure first, then fill in from the right going up the parents. */
+  for (j = i; j > 0; j = res->parent[j])
+    len += strlen(res->names + res->name[j]) + 1;
+
+  if (len == 0 || len > size)
+  {
+    snprintf (buf, size, "%s", res->names + res->name[i]);
+    return buf;
+  }
+
+  buf[--len] = '\0';
+  for (j = i; j > 0; j = res->parent[j])
+  {
+    n = strlen(res->names + res->name[j]);
+    len -= n;
+    memcpy (buf + len, res->names + res->name[j], n);
+    if (len > 0)
+      buf[--len] = '/';
+  }
+
+  return buf;
+}
@@ -0,0 +1,43 @@
+/* probes.h: USDT probes for bpftrace and friends, where <sys/sdt.h> is
+ * around; otherwise nothing at all. See maildirtree.c for full
+ * copyright.
+ *
+ * Each is a nop in the code and a note in the binary until something
+ * attaches to it, as in
+ *
+ *   bpftrace -e 'usdt:./maildirtree:folder__start { @t[tid] = nsecs; }
+ *     usdt:./maildirtree:folder__done /@t[tid]/ {
+ *       @us = hist((nsecs - @t[tid]) / 1000); delete(@t[tid]); }'
+ *
+ * The probes, all of provider maildirtree:
+ *
+ *   folder__start (path)                      counting a Maildir folder
+ *                                             begins
+ *   folder__done  (path, read, unread, r)     and ends; r is -1 if it
+ *                                             lacked cur or new
+ *   dir__batch    (messages)                  a batch of a cur or new
+ *                                             directory was counted: one
+ *                                             getdents() batch with
+ *                                             --deadline, otherwise 512
+ *                                             entries (or what was left)
+ *   tree__insert  (name, index)               a folder went into a tree
+ *   report__done  (dir, folders)              a tree was printed */
+
+#ifndef INCLUDED_probes_h
+#define INCLUDED_probes_h
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)           DTRACE_PROBE1 (maildirtree, name, a)
+#define PROBE2(name, a, b)        DTRACE_PROBE2 (maildirtree, name, a, b)
+#define PROBE4(name, a, b, c, d)  DTRACE_PROBE4 (maildirtree, name, a, b, c, d)
+#else
+/* Their arguments are not evaluated, only kept from looking unused. */
+#define PROBE1(name, a)           do { (void) sizeof (a); } while (0)
+#define PROBE2(name, a, b)        do { (void) sizeof (a); (void) sizeof (b); } while (0)
+#define PROBE4(name, a, b, c, d)  do { (void) sizeof (a); (void) sizeof (b); \
+                                       (void) sizeof (c); (void) sizeof (d); } while (0)
+#endif
+
+#endif /* !INCLUDED_probes_h */
@@ -0,0 +1,1609 @@
+/* scan.c: the Maildir scanner of libmaildirtree. See maildirtree.c for
+ * full copyright.
+ * (C) 2003 by Joshua Kwan. */
+
+#include "config.h"
+
+#include "libmaildirtree.h"
+#include "snprintf.h"
+#include "probes.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#ifdef SYS_getdents64
+#define HAVE_GETDENTS64
+#endif
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/* Everything one mdt_scan() call needs; there is no global state. */
+struct scan
+{
+  const struct mdt_options *opts;
+  time_t now;
+  time_t started;    /* by the clock, unlike 'now' */
+
+  /* Where the folders go; for mdt_scan(), into a builder. */
+  int (*fn) (void *, const char *, const struct mdt_counts *);
+  void *arg;
+  int stopped;
+
+  bool expired;      /* opts->deadline has passed */
+
+  /* opts->unique: the inodes seen, and the device of the directory
+   * being counted as an index into them */
+  struct inodes *inodes;
+  unsigned int dev;
+  unsigned int mbox_messages;  /* which have no inodes of their own */
+
+  /* opts->audit: what to do with the names counted (AUDIT_CUR or
+   * AUDIT_NEW, or 0 for nothing), the unique names of cur, and how
+   * many of new were among them */
+  int audit;
+  struct names *names;
+  unsigned int duplicates;
+
+  /* opts->digest: where the names counted are summed up, and the seed
+   * of their hashes, which differs between cur and new */
+  struct mdt_digest *digest;
+  uint64_t seed;
+};
+
+enum { AUDIT_CUR = 1, AUDIT_NEW };
+
+/* The unique names in cur of the folder being counted, for opts->audit,
+ * as 64-bit FNV-1a hashes in an open-addressed set with linear probing,
+ * at most half full. 0 is a free slot, so a hash of 0 is taken for 1.
+ * Telling two names apart only by hash takes a match of all 64 bits to
+ * go wrong, which would take billions of messages to come about. */
+struct names
+{
+  uint64_t *slots;
+  size_t size, used;       /* size is a power of two */
+};
+
+/* A set of message inodes for opts->unique, open-addressed with linear
+ * probing. Slots are 32 bits wide for as long as every inode number
+ * fits and all are on the first device, so that a Maildir on one
+ * filesystem takes some 4 to 11 bytes a message; after that they are
+ * 64 bits, with the device's index in the top byte. 0 is a free slot,
+ * as no file has inode 0. */
+#define MAX_DEVS 255
+
+struct inodes
+{
+  void *slots;
+  size_t size, used;       /* size is a power of two */
+  unsigned int bits;       /* log2(size) */
+  bool wide, failed;
+  dev_t devs [MAX_DEVS];
+  unsigned int ndevs;
+};
+
+#ifdef HAVE_GETDENTS64
+/* What getdents64() returns, one after the other */
+struct linux_dirent64
+{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name [];
+};
+#endif
+
+/* Without getdents64(), how many readdir() entries make a batch */
+#define BATCH 512
+
+#ifdef HAVE_PTHREAD_H
+/* One folder for the threads of read_in_parallel() to count */
+struct job
+{
+  char *name;              /* as handed to s->fn; empty for the root */
+  char *path;
+  bool mbox;
+  bool counted;            /* already, by opts->lookup or the deadline */
+  unsigned long cost;      /* in messages, more or less */
+  int r;
+  struct mdt_counts c;
+};
+
+struct jobs
+{
+  const struct scan *s;
+  struct job *job;         /* in the order of the listing */
+  struct job **order;      /* those to count, the costliest first */
+  size_t n, alloc, norder, next;
+  pthread_mutex_t lock;
+};
+
+/* For guessing how many messages a folder holds without a history: the
+ * bytes of a directory per entry, and of an mbox per message (which
+ * costs less to count than an entry, as it is only scanned through) */
+#define DIRENT_BYTES 64
+#define MBOX_BYTES   4096
+#endif
+
+static void setup (struct scan *, const struct mdt_options *);
+static int add_folder (void *, const char *, const struct mdt_counts *);
+static void read_this_dir (struct scan *, DIR*, const char*);
+#ifdef HAVE_PTHREAD_H
+static void read_in_parallel (struct scan *, DIR *, const char *);
+static struct job * add_job (struct jobs *, const char *, const char *);
+static void drop_job (struct jobs *);
+static unsigned long expect (struct scan *, const char *, const char *);
+static void * count_jobs (void *);
+static int by_cost (const void *, const void *);
+static void free_jobs (struct jobs *);
+#endif
+static int count_folder (struct scan *, const char *, struct mdt_counts *);
+static int count_dirs (struct scan *, const char *, struct mdt_counts *);
+static bool count_messages (struct scan *, DIR *, struct mdt_ages *, unsigned int *);
+static bool count_batches (struct scan *, DIR *, struct mdt_ages *, unsigned int *);
+static bool expired (struct scan *);
+static inline bool known (struct scan *, const char *, struct mdt_counts *);
+static int count_mbox (struct scan *, const char *, struct mdt_counts *);
+static const char * next_from (const char *, const char *);
+static bool mbox_read (const char *, const char *);
+static inline void age_message (struct mdt_ages *, const char *, time_t);
+static unsigned int inode_dev (struct inodes *, dev_t);
+static void inode_add (struct inodes *, unsigned int, uint64_t);
+static bool inode_grow (struct inodes *, bool);
+static inline size_t inode_slot (const struct inodes *, uint64_t);
+static inline void audit_name (struct scan *, const char *);
+static inline void digest_name (struct scan *, const char *);
+static inline uint64_t mix (uint64_t);
+static bool names_add (struct names *, uint64_t);
+static bool names_has (const struct names *, uint64_t);
+static void count_stale (struct scan *, const char *, struct mdt_audit *, struct timespec *);
+static void stamp (struct scan *, const struct stat *, struct timespec *);
+static inline void settle (struct scan *, struct timespec *);
+static int dir_stamp (struct scan *, char *, size_t, const char *, struct timespec *);
+static inline bool same_time (const struct timespec *, const struct timespec *);
+static void warn (struct scan *, const char *, const char *);
+
+static struct mdt_options default_options;
+
+struct mdt_tree * mdt_scan (const char *path, const struct mdt_options *opts)
+{
+  struct scan s;
+  struct inodes inodes;
+  struct mdt_builder *b;
+  struct mdt_tree *t;
+  struct stat st;
+  bool have_st = false;
+  DIR *maildir;
+  char name [NAME_MAX + 1];
+
+  setup (&s, opts);
+
+  if ((maildir = opendir(path)) == NULL)
+  {
+    /* A file; perhaps a tarball of a Maildir */
+    if (errno != ENOTDIR)
+      return NULL;
+
+    if (s.opts->stamps)
+      have_st = stat(path, &st) == 0;
+
+    if ((t = mdt_scan_archive(path, s.opts)) != NULL && have_st)
+      stamp (&s, &st, &t->mtime);
+
+    return t;
+  }
+
+  b = mdt_builder_new(mdt_root_name(path, name, sizeof(name)),
+                      (s.opts->ages ? MDT_AGES : 0) |
+                      (s.opts->stamps ? MDT_STAMPS : 0) |
+                      (s.opts->audit ? MDT_AUDIT : 0) |
+                      (s.opts->digest ? MDT_DIGEST : 0));
+  if (b == NULL)
+  {
+    closedir (maildir);
+    errno = ENOMEM;
+    return NULL;
+  }
+  mdt_builder_sort (b, s.opts->sort);
+
+  /* Before reading it, so that nothing slips in between. */
+  if (s.opts->stamps)
+    have_st = fstat(dirfd(maildir), &st) == 0;
+
+  if (s.opts->unique)
+  {
+    memset (&inodes, 0, sizeof(inodes));
+    s.inodes = &inodes;
+  }
+
+  s.fn = &add_folder;
+  s.arg = b;
+#ifdef HAVE_PTHREAD_H
+  if (s.opts->threads > 1 && !s.inodes)
+    read_in_parallel (&s, maildir, path);
+  else
+#endif
+    read_this_dir (&s, maildir, path);
+  closedir (maildir);
+
+  if ((t = mdt_finish (b)) != NULL && have_st)
+    stamp (&s, &st, &t->mtime);
+
+  if (s.inodes)
+  {
+    /* Out of memory leaves it unknown rather than wrong. */
+    if (t != NULL && !inodes.failed)
+      t->unique = inodes.used + s.mbox_messages;
+    free (inodes.slots);
+  }
+
+  return t;
+}
+
+int mdt_walk (const char *path, const struct mdt_options *opts,
+              int (*fn) (void *arg, const char *name,
+                         const struct mdt_counts *counts),
+              void *arg)
+{
+  struct scan s;
+  DIR *maildir;
+
+  setup (&s, opts);
+
+  if ((maildir = opendir(path)) == NULL)
+    return (errno == ENOTDIR) ? mdt_walk_archive(path, s.opts, fn, arg) : -1;
+
+  s.fn = fn;
+  s.arg = arg;
+  read_this_dir (&s, maildir, path);
+  closedir (maildir);
+
+  return s.stopped;
+}
+
+int mdt_count_folder (const char *path, const struct mdt_options *opts,
+                      struct mdt_counts *counts)
+{
+  struct scan s;
+  struct stat st;
+
+  setup (&s, opts);
+
+  if (s.opts->mbox && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+    return count_mbox (&s, path, counts);
+
+  return count_folder (&s, path, counts);
+}
+
+long mdt_refresh (struct mdt_tree **tree, const char *path,
+                  const struct mdt_options *opts)
+{
+  struct mdt_tree *t = *tree, *fresh;
+  struct scan s;
+  struct stat st;
+  struct mdt_counts c;
+  struct timespec cur, new, tmp;
+  char *fpath;
+  size_t i, rlen = strlen(path), len;
+  long changed = 0;
+
+  setup (&s, opts);
+
+  if (t->stamps == NULL)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (stat(path, &st) != 0)
+    return -1;
+  stamp (&s, &st, &cur);
+
+  /* An archive changes all at once or not at all. */
+  if (S_ISREG(st.st_mode) && same_time(&cur, &t->mtime))
+    return 0;
+
+  /* Folders came or went; nothing for it but to start over. */
+  if (!same_time(&cur, &t->mtime) || S_ISREG(st.st_mode))
+  {
+    if ((fresh = mdt_scan(path, s.opts)) == NULL)
+      return -1;
+
+    mdt_free (t);
+    *tree = fresh;
+    return (long) fresh->count;
+  }
+
+  if ((fpath = (char *) malloc(rlen + NAME_MAX + 6)) == NULL)
+    return -1;
+
+  for (i = 0; i < t->count; i++)
+  {
+    if (t->flags[i] & MDT_DUMMY)
+      continue;
+
+    len = snprintf (fpath, rlen + NAME_MAX + 6, "%s/%s", path, t->names + t->path[i]);
+
+    if (t->flags[i] & MDT_MBOX)
+    {
+      /* An mbox changes with its mtime; the stamp is kept in cur_mtime. */
+      if (stat(fpath, &st) != 0)
+        goto rescan;
+      stamp (&s, &st, &cur);
+      if (same_time(&cur, &t->stamps[i].cur_mtime))
+        continue;
+
+      if (count_mbox(&s, fpath, &c) != 0)
+        goto rescan;
+    }
+    else
+    {
+      /* The root's "" leaves a trailing slash; harmless. The root also
+       * gets to lack cur/ or new/, which then stay stamped zero. */
+      if (dir_stamp(&s, fpath, len, "/cur", &cur) != 0 && i > 0)
+        goto rescan;
+      if (dir_stamp(&s, fpath, len, "/new", &new) != 0 && i > 0)
+        goto rescan;
+
+      if (same_time(&cur, &t->stamps[i].cur_mtime) && same_time(&new, &t->stamps[i].new_mtime))
+      {
+        /* An audit looks at tmp/ as well, though of what it found
+         * only the stale files can have changed: by coming or going,
+         * or by a file there getting old enough. */
+        if (t->audit == NULL)
+          continue;
+        dir_stamp (&s, fpath, len, "/tmp", &tmp);
+        if (same_time(&tmp, &t->stamps[i].tmp_mtime) &&
+            (t->audit[i].stale_at == 0 || s.now < t->audit[i].stale_at))
+          continue;
+
+        count_stale (&s, fpath, &t->audit[i], &t->stamps[i].tmp_mtime);
+        changed++;
+        continue;
+      }
+
+      fpath[len] = '\0';
+      if (count_folder(&s, fpath, &c) != 0 && i > 0)
+        goto rescan;
+    }
+
+    t->read[i] = c.read;
+    t->unread[i] = c.unread;
+    t->stamps[i] = c.stamps;
+    if (t->ages)
+      t->ages[i] = c.ages;
+    if (t->audit)
+      t->audit[i] = c.audit;
+    if (t->digest)
+      t->digest[i] = c.digest;
+
+    changed++;
+  }
+
+  free (fpath);
+
+  /* Which messages are the same can only be told all over again. */
+  if (changed && s.opts->unique)
+  {
+    if ((fresh = mdt_scan(path, s.opts)) == NULL)
+      return -1;
+
+    mdt_free (t);
+    *tree = fresh;
+    return (long) fresh->count;
+  }
+
+  if (changed)
+    mdt_update_totals (t);
+
+  return changed;
+
+rescan:
+  /* A folder went away under us without the root noticing. */
+  free (fpath);
+
+  if ((fresh = mdt_scan(path, s.opts)) == NULL)
+    return -1;
+
+  mdt_free (t);
+  *tree = fresh;
+  return (long) fresh->count;
+}
+
+static void setup (struct scan *s, const struct mdt_options *opts)
+{
+  memset (s, 0, sizeof(*s));
+  s->opts = opts ? opts : &default_options;
+  s->started = time(NULL);
+  s->now = s->opts->now ? s->opts->now : s->started;
+}
+
+static int add_folder (void *arg, const char *name, const struct mdt_counts *c)
+{
+  mdt_insert ((struct mdt_builder *) arg, name, c);
+
+  /* Running out of memory sticks to the builder; mdt_finish() says so. */
+  return 0;
+}
+
+/* read_this_dir: reads a directory, and recurses into all folders below
+ * 'd'.
+ *
+ * FIXME: Should be called many times. Many many times. Increase this
+ * recursion and make it real clean.
+ */
+
+static void read_this_dir (struct scan *s, DIR* d, const char* rootpath)
+{
+  struct dirent *entries;
+  struct stat isdir;
+  struct mdt_counts c;
+  char *path;
+  int len;
+  size_t rlen;
+
+  /* Used later, save a call to strlen */
+  rlen = strlen(rootpath);
+
+  if (!known(s, "", &c) && count_folder(s, rootpath, &c) != 0) /* Are we SURE this is a Maildir? */
+    warn(s, "%s does not look like a complete Maildir", rootpath);
+  if ((s->stopped = s->fn(s->arg, "", &c)) != 0)
+    return;
+
+  while ((entries = readdir(d)) != NULL)
+  {
+    if (!strcmp(entries->d_name, ".") ||
+        !strcmp(entries->d_name, "..") ||
+	!strcmp(entries->d_name, "cur") ||
+	!strcmp(entries->d_name, "new") ||
+	!strcmp(entries->d_name, "tmp"))
+      continue;
+
+    /* Counted before; not even a stat() for it */
+    if (known(s, entries->d_name, &c))
+    {
+      if ((s->stopped = s->fn(s->arg, entries->d_name, &c)) != 0)
+        break;
+      continue;
+    }
+
+    /* Out of time: the rest is only listed, not even stat()ed, since
+     * that could hang just the same. */
+    if (expired(s))
+    {
+      memset (&c, 0, sizeof(c));
+      mdt_clear_ages (&c.ages);
+      if (!mdt_maybe_folder(entries, s->opts, &c.flags))
+        continue;
+      c.flags |= MDT_PARTIAL;
+
+      if ((s->stopped = s->fn(s->arg, entries->d_name, &c)) != 0)
+        break;
+      continue;
+    }
+
+    len = rlen + strlen(entries->d_name) + 2;
+
+    path = (char*) malloc(len);
+    snprintf (path, len, "%s/%s", rootpath, entries->d_name);
+
+    /* Gone since readdir(), or unreadable */
+    if (stat (path, &isdir) != 0)
+    {
+      free (path);
+      continue;
+    }
+
+    if (!S_ISDIR(isdir.st_mode))
+    {
+      if (s->opts->mbox && S_ISREG(isdir.st_mode) && count_mbox(s, path, &c) == 0)
+      {
+        s->mbox_messages += c.read + c.unread;
+        s->stopped = s->fn(s->arg, entries->d_name, &c);
+      }
+
+      free (path);
+      if (s->stopped)
+        break;
+      continue;
+    }
+
+    /* Assign to c the message counts for *THIS* folder. */
+    if (count_folder(s, path, &c) != 0)
+      warn(s, "%s is missing cur or new; ignoring!", entries->d_name);
+    else
+      s->stopped = s->fn(s->arg, entries->d_name, &c);
+
+    free (path);
+
+    if (s->stopped)
+      break;
+  }
+}
+
+#ifdef HAVE_PTHREAD_H
+/* read_in_parallel: read_this_dir() with the folders counted on
+ * opts->threads threads, this one included. The directory is listed
+ * first, and then the threads take the folders expected to take
+ * longest first: that way, a huge one is started at once rather than
+ * whenever the listing gets to it, and the scan takes about as long as
+ * it does, or as all of them split evenly, whichever is more. The
+ * folders go to s->fn in the order of the listing, as they would have. */
+static void read_in_parallel (struct scan *s, DIR *d, const char *rootpath)
+{
+  struct jobs j;
+  struct job *job;
+  struct dirent *e;
+  struct stat st;
+  pthread_t *threads;
+  unsigned int t, nthreads;
+  size_t i;
+
+  memset (&j, 0, sizeof(j));
+  j.s = s;
+
+  if ((job = add_job(&j, "", rootpath)) == NULL)
+    goto serial;
+  job->counted = known(s, "", &job->c);
+  if (!job->counted)
+    job->cost = expect(s, "", rootpath);
+
+  while ((e = readdir(d)) != NULL)
+  {
+    if (!strcmp(e->d_name, ".") ||
+        !strcmp(e->d_name, "..") ||
+        !strcmp(e->d_name, "cur") ||
+        !strcmp(e->d_name, "new") ||
+        !strcmp(e->d_name, "tmp"))
+      continue;
+
+    if ((job = add_job(&j, e->d_name, rootpath)) == NULL)
+      goto serial;
+
+    if (known(s, e->d_name, &job->c))
+    {
+      job->counted = true;
+      continue;
+    }
+
+    /* As read_this_dir() would, it is only listed now. */
+    if (expired(s))
+    {
+      memset (&job->c, 0, sizeof(job->c));
+      mdt_clear_ages (&job->c.ages);
+      if (!mdt_maybe_folder(e, s->opts, &job->c.flags))
+      {
+        drop_job (&j);
+        continue;
+      }
+
+      job->c.flags |= MDT_PARTIAL;
+      job->counted = true;
+      continue;
+    }
+
+    if (stat(job->path, &st) != 0)
+      drop_job (&j);
+    else if (S_ISDIR(st.st_mode))
+      job->cost = expect(s, e->d_name, job->path);
+    else if (s->opts->mbox && S_ISREG(st.st_mode))
+    {
+      job->mbox = true;
+      job->cost = st.st_size / MBOX_BYTES;
+    }
+    else
+      drop_job (&j);
+  }
+
+  if ((j.order = (struct job **) malloc ((j.n + 1) * sizeof(struct job *))) == NULL)
+    goto serial;
+
+  for (i = 0; i < j.n; i++)
+    if (!j.job[i].counted)
+      j.order[j.norder++] = &j.job[i];
+  qsort (j.order, j.norder, sizeof(struct job *), &by_cost);
+
+  /* No more threads than there are folders; if some cannot be started,
+   * those that were do their share. */
+  nthreads = s->opts->threads;
+  if (nthreads > j.norder)
+    nthreads = j.norder;
+
+  pthread_mutex_init (&j.lock, NULL);
+  threads = nthreads > 1 ? (pthread_t *) malloc ((nthreads - 1) * sizeof(pthread_t)) : NULL;
+  for (t = 0; threads != NULL && t < nthreads - 1; t++)
+    if (pthread_create(&threads[t], NULL, &count_jobs, &j) != 0)
+      break;
+
+  count_jobs (&j);
+
+  while (t-- > 0)
+    pthread_join (threads[t], NULL);
+  free (threads);
+  pthread_mutex_destroy (&j.lock);
+
+  for (i = 0; i < j.n && !s->stopped; i++)
+  {
+    job = &j.job[i];
+
+    if (i == 0 && !job->counted && job->r != 0)
+      warn(s, "%s does not look like a complete Maildir", rootpath);
+    else if (!job->counted && job->r != 0)
+    {
+      if (!job->mbox)
+        warn(s, "%s is missing cur or new; ignoring!", job->name);
+      continue;
+    }
+
+    if (job->mbox)
+      s->mbox_messages += job->c.read + job->c.unread;
+    s->stopped = s->fn(s->arg, job->name, &job->c);
+  }
+
+  free_jobs (&j);
+  return;
+
+serial:
+  /* Out of memory: the plain way still works. */
+  free_jobs (&j);
+  rewinddir (d);
+  read_this_dir (s, d, rootpath);
+}
+
+/* add_job: a job for folder 'name' of the maildir at 'rootpath' */
+static struct job * add_job (struct jobs *j, const char *name, const char *rootpath)
+{
+  struct job *njob, *job;
+  size_t len = strlen(rootpath) + strlen(name) + 2;
+
+  if (j->n == j->alloc)
+  {
+    j->alloc = j->alloc ? j->alloc * 2 : 64;
+    if ((njob = (struct job *) realloc (j->job, j->alloc * sizeof(struct job))) == NULL)
+      return NULL;
+    j->job = njob;
+  }
+
+  job = &j->job[j->n];
+  memset (job, 0, sizeof(*job));
+
+  job->name = strdup(name);
+  job->path = (char *) malloc (len);
+  if (job->name == NULL || job->path == NULL)
+  {
+    free (job->name);
+    free (job->path);
+    return NULL;
+  }
+
+  if (*name)
+    snprintf (job->path, len, "%s/%s", rootpath, name);
+  else
+    strcpy (job->path, rootpath);
+
+  j->n++;
+  return job;
+}
+
+/* drop_job: forget the last job added after all */
+static void drop_job (struct jobs *j)
+{
+  j->n--;
+  free (j->job[j->n].name);
+  free (j->job[j->n].path);
+}
+
+/* expect: about how many messages the folder 'name' at 'path' holds; as
+ * opts->expect remembers, or else going by the size of its cur and new
+ * directories, which grow with the entries in them. */
+static unsigned long expect (struct scan *s, const char *name, const char *path)
+{
+  struct stat st;
+  unsigned long n = 0;
+  size_t len = strlen(path) + 5;
+  char *sub;
+
+  if (s->opts->expect && (n = s->opts->expect(s->opts->expect_arg, name)) > 0)
+    return n;
+
+  if ((sub = (char *) malloc (len)) == NULL)
+    return 0;
+
+  snprintf (sub, len, "%s/cur", path);
+  if (stat(sub, &st) == 0)
+    n += st.st_size / DIRENT_BYTES;
+  snprintf (sub, len, "%s/new", path);
+  if (stat(sub, &st) == 0)
+    n += st.st_size / DIRENT_BYTES;
+
+  free (sub);
+  return n;
+}
+
+/* count_jobs: one thread of read_in_parallel(), counting the costliest
+ * folder left until there are none. */
+static void * count_jobs (void *arg)
+{
+  struct jobs *j = (struct jobs *) arg;
+  struct job *job;
+  struct scan w;
+
+  /* Of its own, as expired() writes to it */
+  w = *j->s;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&j->lock);
+    job = (j->next < j->norder) ? j->order[j->next++] : NULL;
+    pthread_mutex_unlock (&j->lock);
+
+    if (job == NULL)
+      return NULL;
+
+    if (job->mbox)
+      job->r = count_mbox(&w, job->path, &job->c);
+    else
+      job->r = count_folder(&w, job->path, &job->c);
+  }
+}
+
+static int by_cost (const void *a, const void *b)
+{
+  const struct job *x = *(const struct job * const *) a;
+  const struct job *y = *(const struct job * const *) b;
+
+  if (x->cost != y->cost)
+    return (x->cost < y->cost) ? 1 : -1;
+
+  /* Otherwise as listed */
+  return (x < y) ? -1 : (x > y);
+}
+
+static void free_jobs (struct jobs *j)
+{
+  size_t i;
+
+  for (i = 0; i < j->n; i++)
+  {
+    free (j->job[i].name);
+    free (j->job[i].path);
+  }
+
+  free (j->job);
+  free (j->order);
+}
+#endif
+
+/* count_folder: count_dirs(), between its two probes */
+static int count_folder (struct scan *s, const char *path, struct mdt_counts *c)
+{
+  int r;
+
+  PROBE1 (folder__start, path);
+  r = count_dirs(s, path, c);
+  PROBE4 (folder__done, path, c->read, c->unread, r);
+
+  return r;
+}
+
+/* count_dirs: count the messages in path/cur and path/new into c.
+ * Returns -1 if either is missing, with whatever the other held. If the
+ * deadline passes first, c holds what was counted by then and is
+ * flagged MDT_PARTIAL. */
+static int count_dirs (struct scan *s, const char *path, struct mdt_counts *c)
+{
+  DIR *dir;
+  struct stat st;
+  struct names names;
+  struct mdt_ages *ap = s->opts->ages ? &c->ages : NULL;
+  char *sub;
+  size_t len = strlen(path) + 5;
+  int r = 0;
+
+  memset (c, 0, sizeof(*c));
+  mdt_clear_ages (&c->ages);
+
+  if (expired(s))
+  {
+    c->flags = MDT_PARTIAL;
+    return 0;
+  }
+
+  /* Dovecot may already know, but cannot tell ages, inodes or names. */
+  if (s->opts->dovecot && !s->opts->ages && !s->inodes && !s->opts->audit &&
+      !s->opts->digest && mdt_dovecot_counts(path, c) == 0)
+  {
+    settle (s, &c->stamps.cur_mtime);
+    settle (s, &c->stamps.new_mtime);
+    return 0;
+  }
+
+  sub = (char *)malloc(len);
+
+  /* The names of cur are kept, and those of new looked up in them. */
+  if (s->opts->audit)
+  {
+    memset (&names, 0, sizeof(names));
+    s->names = &names;
+    s->duplicates = 0;
+    s->audit = AUDIT_CUR;
+  }
+  if (s->opts->digest)
+  {
+    s->digest = &c->digest;
+    s->seed = 0x6375720aULL;      /* "cur\n" */
+  }
+
+  snprintf (sub, len, "%s/cur", path);
+  if ((dir = opendir(sub)) != NULL)
+  {
+    if ((s->opts->stamps || s->inodes) && fstat(dirfd(dir), &st) == 0)
+    {
+      if (s->opts->stamps)
+        stamp (s, &st, &c->stamps.cur_mtime);
+      if (s->inodes)
+        s->dev = inode_dev(s->inodes, st.st_dev);
+    }
+
+    if (!count_messages(s, dir, ap, &c->read))
+      c->flags = MDT_PARTIAL;
+    closedir (dir);
+  }
+  else
+    r = -1;
+
+  snprintf (sub, len, "%s/new", path);
+  if (s->audit)
+    s->audit = AUDIT_NEW;
+  if (s->digest)
+    s->seed = 0x6e65770aULL;      /* "new\n" */
+  if (!(c->flags & MDT_PARTIAL))
+  {
+    if ((dir = opendir(sub)) != NULL)
+    {
+      if ((s->opts->stamps || s->inodes) && fstat(dirfd(dir), &st) == 0)
+      {
+        if (s->opts->stamps)
+          stamp (s, &st, &c->stamps.new_mtime);
+        if (s->inodes)
+          s->dev = inode_dev(s->inodes, st.st_dev);
+      }
+
+      if (!count_messages(s, dir, ap, &c->unread))
+        c->flags = MDT_PARTIAL;
+      closedir (dir);
+    }
+    else
+      r = -1;
+  }
+
+  if (s->audit)
+  {
+    c->audit.duplicates = s->duplicates;
+    snprintf (sub, len, "%s/tmp", path);
+    if (!(c->flags & MDT_PARTIAL))
+      count_stale (s, sub, &c->audit, &c->stamps.tmp_mtime);
+
+    free (names.slots);
+    s->names = NULL;
+    s->audit = 0;
+  }
+  s->digest = NULL;
+
+  free (sub);
+
+  /* So that mdt_refresh() counts it again */
+  if (c->flags & MDT_PARTIAL)
+  {
+    memset (&c->stamps, 0, sizeof(c->stamps));
+    return 0;
+  }
+
+  return r;
+}
+
+/* precondition: dir must have been opendir'd. The messages in it go in
+ * *count; if a is not NULL, the delivery time of every one of them is
+ * added to it as well. Returns false if the deadline cut it short.
+ *
+ * readdir() hides the kernel's batches, so dir__batch fires every BATCH
+ * entries here, and once more for the rest. */
+static bool count_messages (struct scan *s, DIR *dir, struct mdt_ages *a,
+                            unsigned int *count)
+{
+  unsigned int r = 0, n = 0, before = 0;
+  struct dirent * tmp;
+
+  if (s->opts->deadline.tv_sec || s->opts->deadline.tv_nsec)
+    return count_batches (s, dir, a, count);
+
+  if (!a && !s->inodes && !s->audit && !s->digest)
+  {
+    while ((tmp = readdir(dir)) != NULL)
+    {
+      if (*tmp->d_name != '.') /* assuming that dotfiles != messages */
+        r++;
+
+      if (++n % BATCH == 0)
+      {
+        PROBE1 (dir__batch, r - before);
+        before = r;
+      }
+    }
+
+    if (n % BATCH != 0)
+      PROBE1 (dir__batch, r - before);
+
+    *count = r;
+    return true;
+  }
+
+  while ((tmp = readdir(dir)) != NULL)
+  {
+    if (*tmp->d_name != '.')
+    {
+      r++;
+      if (a)
+        age_message (a, tmp->d_name, s->now);
+      if (s->inodes)
+        inode_add (s->inodes, s->dev, tmp->d_ino);
+      if (s->audit)
+        audit_name (s, tmp->d_name);
+      if (s->digest)
+        digest_name (s, tmp->d_name);
+    }
+
+    if (++n % BATCH == 0)
+    {
+      PROBE1 (dir__batch, r - before);
+      before = r;
+    }
+  }
+
+  if (n % BATCH != 0)
+    PROBE1 (dir__batch, r - before);
+
+  *count = r;
+  return true;
+}
+
+/* count_batches: count_messages() with an eye on the clock, which is
+ * looked at after every batch of entries the kernel hands over. With
+ * getdents64() those are its batches; otherwise readdir() hides them,
+ * so every BATCH entries will do. */
+static bool count_batches (struct scan *s, DIR *dir, struct mdt_ages *a,
+                           unsigned int *count)
+{
+#ifdef HAVE_GETDENTS64
+  uint64_t buf [4096];
+  const struct linux_dirent64 *e;
+  long got, off;
+  unsigned int before;
+  int fd = dirfd(dir);
+
+  *count = 0;
+
+  for (;;)
+  {
+    if ((got = syscall(SYS_getdents64, fd, buf, sizeof(buf))) <= 0)
+      return true;
+
+    before = *count;
+    for (off = 0; off < got; off += e->d_reclen)
+    {
+      e = (const struct linux_dirent64 *) ((const char *) buf + off);
+      if (*e->d_name == '.')
+        continue;
+
+      (*count)++;
+      if (a)
+        age_message (a, e->d_name, s->now);
+      if (s->inodes)
+        inode_add (s->inodes, s->dev, e->d_ino);
+      if (s->audit)
+        audit_name (s, e->d_name);
+      if (s->digest)
+        digest_name (s, e->d_name);
+    }
+
+    PROBE1 (dir__batch, *count - before);
+    if (expired(s))
+      return false;
+  }
+#else
+  struct dirent *tmp;
+  unsigned int n = 0, before = 0;
+
+  *count = 0;
+
+  while ((tmp = readdir(dir)) != NULL)
+  {
+    if (*tmp->d_name != '.')
+    {
+      (*count)++;
+      if (a)
+        age_message (a, tmp->d_name, s->now);
+      if (s->inodes)
+        inode_add (s->inodes, s->dev, tmp->d_ino);
+      if (s->audit)
+        audit_name (s, tmp->d_name);
+      if (s->digest)
+        digest_name (s, tmp->d_name);
+    }
+
+    if (++n % BATCH == 0)
+    {
+      PROBE1 (dir__batch, *count - before);
+      before = *count;
+      if (expired(s))
+        return false;
+    }
+  }
+
+  if (n % BATCH != 0)
+    PROBE1 (dir__batch, *count - before);
+  return true;
+#endif
+}
+
+/* inode_dev: the index of device 'dev' among those seen. Past MAX_DEVS
+ * of them, the last one has to do for the rest. */
+static unsigned int inode_dev (struct inodes *in, dev_t dev)
+{
+  unsigned int i;
+
+  for (i = 0; i < in->ndevs; i++)
+    if (in->devs[i] == dev)
+      return i;
+
+  if (in->ndevs == MAX_DEVS)
+    return MAX_DEVS - 1;
+
+  in->devs[in->ndevs] = dev;
+  return in->ndevs++;
+}
+
+/* inode_add: note the message with inode 'ino' on device index 'dev',
+ * unless it has been seen before. */
+static void inode_add (struct inodes *in, unsigned int dev, uint64_t ino)
+{
+  uint64_t key = ino ^ ((uint64_t) dev << 56);
+  size_t i, mask;
+
+  if (in->failed || key == 0)
+    return;
+
+  if ((!in->wide && key > UINT32_MAX && !inode_grow(in, true)) ||
+      (4 * (in->used + 1) > 3 * in->size && !inode_grow(in, in->wide)))
+    return;
+
+  mask = in->size - 1;
+  if (in->wide)
+  {
+    uint64_t *slot = (uint64_t *) in->slots;
+
+    for (i = inode_slot(in, key); slot[i] != 0; i = (i + 1) & mask)
+      if (slot[i] == key)
+        return;
+    slot[i] = key;
+  }
+  else
+  {
+    uint32_t *slot = (uint32_t *) in->slots;
+
+    for (i = inode_slot(in, key); slot[i] != 0; i = (i + 1) & mask)
+      if (slot[i] == key)
+        return;
+    slot[i] = (uint32_t) key;
+  }
+
+  in->used++;
+}
+
+/* inode_grow: rehash into twice the slots (or as many if just going
+ * 'wide'), leaving the set failed if there is no memory for it. */
+static bool inode_grow (struct inodes *in, bool wide)
+{
+  struct inodes old = *in;
+  size_t i, j, width = wide ? sizeof(uint64_t) : sizeof(uint32_t);
+  uint64_t key;
+
+  in->bits = (old.size == 0) ? 12 : (wide && !old.wide) ? old.bits : old.bits + 1;
+  in->size = (size_t) 1 << in->bits;
+  in->wide = wide;
+
+  if ((in->slots = calloc (in->size, width)) == NULL)
+  {
+    free (old.slots);
+    in->failed = true;
+    return false;
+  }
+
+  for (i = 0; i < old.size; i++)
+  {
+    key = old.wide ? ((uint64_t *) old.slots)[i] : ((uint32_t *) old.slots)[i];
+    if (key == 0)
+      continue;
+
+    for (j = inode_slot(in, key); wide ? ((uint64_t *) in->slots)[j] != 0
+                                       : ((uint32_t *) in->slots)[j] != 0;
+         j = (j + 1) & (in->size - 1))
+      ;
+
+    if (wide)
+      ((uint64_t *) in->slots)[j] = key;
+    else
+      ((uint32_t *) in->slots)[j] = (uint32_t) key;
+  }
+
+  free (old.slots);
+  return true;
+}
+
+/* Fibonacci hashing: the top bits of the key times 2^64 / phi */
+static inline size_t inode_slot (const struct inodes *in, uint64_t key)
+{
+  return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> (64 - in->bits));
+}
+
+/* audit_name: keep the unique name of a message in cur, or look that
+ * of one in new up among them. The unique name is all of it up to the
+ * info after a colon, which moving it to cur adds or changes. */
+static inline void audit_name (struct scan *s, const char *name)
+{
+  uint64_t h = 14695981039346656037ULL;
+
+  for (; *name && *name != ':'; name++)
+  {
+    h ^= (unsigned char) *name;
+    h *= 1099511628211ULL;
+  }
+  if (h == 0)
+    h = 1;
+
+  /* Out of memory, some go unnoticed; none are made up. */
+  if (s->audit == AUDIT_CUR)
+    names_add (s->names, h);
+  else if (names_has(s->names, h))
+    s->duplicates++;
+}
+
+/* digest_name: add a 128-bit hash of a file's name to the digest of
+ * its folder. It is two 64-bit hashes of the name, each run through
+ * mix() so that every bit of the name reaches every bit of the result,
+ * and the halves are added with a carry between them. A sum, unlike an
+ * exclusive or, does not lose a name that turns up twice. */
+static inline void digest_name (struct scan *s, const char *name)
+{
+  uint64_t a = 14695981039346656037ULL ^ s->seed, b = s->seed;
+  struct mdt_digest *d = s->digest;
+  const unsigned char *p;
+
+  for (p = (const unsigned char *) name; *p; p++)
+  {
+    a = (a ^ *p) * 1099511628211ULL;
+    b = (b + *p) * 0x9e3779b97f4a7c15ULL;
+    b ^= b >> 29;
+  }
+
+  a = mix(a ^ (uint64_t) (p - (const unsigned char *) name));
+  b = mix(b + a);
+
+  d->lo += a;
+  d->hi += b + (d->lo < a);
+}
+
+/* mix: the finalizer of MurmurHash3, spreading every bit over all 64 */
+static inline uint64_t mix (uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static bool names_add (struct names *n, uint64_t h)
+{
+  uint64_t *old = n->slots;
+  size_t i, j, oldsize = n->size;
+
+  if (2 * (n->used + 1) > n->size)
+  {
+    n->size = oldsize ? oldsize * 2 : 1024;
+    if ((n->slots = (uint64_t *) calloc (n->size, sizeof(uint64_t))) == NULL)
+    {
+      n->slots = old;
+      n->size = oldsize;
+      return false;
+    }
+
+    for (i = 0; i < oldsize; i++)
+    {
+      if (old[i] == 0)
+        continue;
+      for (j = old[i] & (n->size - 1); n->slots[j] != 0; j = (j + 1) & (n->size - 1))
+        ;
+      n->slots[j] = old[i];
+    }
+    free (old);
+  }
+
+  for (i = h & (n->size - 1); n->slots[i] != 0; i = (i + 1) & (n->size - 1))
+    if (n->slots[i] == h)
+      return true;
+
+  n->slots[i] = h;
+  n->used++;
+  return true;
+}
+
+static bool names_has (const struct names *n, uint64_t h)
+{
+  size_t i;
+
+  if (n->size == 0)
+    return false;
+
+  for (i = h & (n->size - 1); n->slots[i] != 0; i = (i + 1) & (n->size - 1))
+    if (n->slots[i] == h)
+      return true;
+
+  return false;
+}
+
+/* count_stale: into a->stale, the files in the tmp directory at 'path'
+ * whose names start with a time more than MDT_STALE seconds before
+ * s->now, as those of a delivery in progress do; into a->stale_at, when
+ * the first of the others will be. With opts->stamps, the directory's
+ * mtime goes in *ts. */
+static void count_stale (struct scan *s, const char *path, struct mdt_audit *a,
+                         struct timespec *ts)
+{
+  DIR *dir;
+  struct dirent *e;
+  struct stat st;
+  unsigned long t;
+  char *end;
+
+  a->stale = 0;
+  a->stale_at = 0;
+
+  if ((dir = opendir(path)) == NULL)
+    return;
+
+  if (s->opts->stamps && fstat(dirfd(dir), &st) == 0)
+    stamp (s, &st, ts);
+
+  while ((e = readdir(dir)) != NULL)
+  {
+    if (*e->d_name == '.')
+      continue;
+
+    t = strtoul(e->d_name, &end, 10);
+    if (end == e->d_name || *end != '.')
+      continue;
+
+    if ((time_t) t < s->now - MDT_STALE)
+      a->stale++;
+    else if (a->stale_at == 0 || (time_t) t + MDT_STALE + 1 < a->stale_at)
+      a->stale_at = (time_t) t + MDT_STALE + 1;
+  }
+
+  closedir (dir);
+}
+
+/* mdt_maybe_folder: what read_this_dir() would stat() and count,
+ * less what it would find to be neither a folder nor an mbox. */
+bool mdt_maybe_folder (const struct dirent *e, const struct mdt_options *opts,
+                       unsigned char *flags)
+{
+  *flags = 0;
+
+  if (!strcmp(e->d_name, ".") ||
+      !strcmp(e->d_name, "..") ||
+      !strcmp(e->d_name, "cur") ||
+      !strcmp(e->d_name, "new") ||
+      !strcmp(e->d_name, "tmp"))
+    return false;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+  if (e->d_type == DT_REG)
+  {
+    *flags = MDT_MBOX;
+    return opts != NULL && opts->mbox;
+  }
+
+  return e->d_type == DT_DIR || e->d_type == DT_LNK || e->d_type == DT_UNKNOWN;
+#else
+  (void) opts;
+  return true;
+#endif
+}
+
+/* known: whether opts->lookup has the counts of a folder already. */
+static inline bool known (struct scan *s, const char *name, struct mdt_counts *c)
+{
+  return s->opts->lookup != NULL && s->opts->lookup(s->opts->lookup_arg, name, c);
+}
+
+/* expired: whether opts->deadline has passed. Once it has, it stays so,
+ * and the clock is not asked again. */
+static bool expired (struct scan *s)
+{
+  const struct timespec *d = &s->opts->deadline;
+  struct timespec now;
+
+  if (s->expired)
+    return true;
+  if (d->tv_sec == 0 && d->tv_nsec == 0)
+    return false;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  s->expired = now.tv_sec > d->tv_sec ||
+               (now.tv_sec == d->tv_sec && now.tv_nsec >= d->tv_nsec);
+  return s->expired;
+}
+
+/* count_mbox: count the messages in the mbox file at path into c, each
+ * starting with a "From " line. Returns -1 if it is no mbox. */
+static int count_mbox (struct scan *s, const char *path, struct mdt_counts *c)
+{
+  struct stat st;
+  const char *map, *end, *p;
+  int fd;
+
+  memset (c, 0, sizeof(*c));
+  mdt_clear_ages (&c->ages);
+  c->flags = MDT_MBOX;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+
+  if (fstat(fd, &st) != 0 || st.st_size < 5 ||
+      (map = (const char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+  {
+    close (fd);
+    return -1;
+  }
+  close (fd);
+
+  if (memcmp(map, "From ", 5) != 0)
+  {
+    munmap ((void *) map, st.st_size);
+    return -1;
+  }
+
+  if (s->opts->stamps)
+    stamp (s, &st, &c->stamps.cur_mtime);
+
+#ifdef MADV_SEQUENTIAL
+  madvise ((void *) map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+  end = map + st.st_size;
+
+  for (p = map; p != NULL; p = next_from(p + 5, end))
+  {
+    if (s->opts->mbox_status && !mbox_read(p, end))
+      c->unread++;
+    else
+      c->read++;
+
+    /* There is no delivery time to go by in the file name. */
+    if (s->opts->ages)
+      c->ages.bucket[MDT_AGE_UNDATED]++;
+  }
+
+  munmap ((void *) map, st.st_size);
+  return 0;
+}
+
+/* next_from: the start of the next line after p that begins with "From ",
+ * or NULL.
+ *
+ * This is what counting an mbox comes down to, so with SSE2 it looks at
+ * sixteen bytes at a time for a newline followed by an F, and only
+ * compares the rest where that matched. Without, memchr() does the
+ * jumping from one newline to the next. */
+static const char * next_from (const char *p, const char *end)
+{
+#ifdef __SSE2__
+  const __m128i nl = _mm_set1_epi8('\n'), f = _mm_set1_epi8('F');
+  __m128i a, b;
+  unsigned int m, i;
+
+  for (; end - p >= 17; p += 16)
+  {
+    a = _mm_loadu_si128((const __m128i *) p);
+    b = _mm_loadu_si128((const __m128i *) (p + 1));
+    m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, nl), _mm_cmpeq_epi8(b, f)));
+
+    for (; m != 0; m &= m - 1)
+    {
+      i = __builtin_ctz(m);
+      if (end - (p + i + 1) >= 5 && !memcmp(p + i + 1, "From ", 5))
+        return p + i + 1;
+    }
+  }
+#endif
+
+  while ((p = (const char *) memchr(p, '\n', end - p)) != NULL)
+  {
+    p++;
+    if (end - p >= 5 && !memcmp(p, "From ", 5))
+      return p;
+  }
+
+  return NULL;
+}
+
+/* mbox_read: whether the message whose "From " line is at p has an R in
+ * its Status: header. Only the header is looked at, up to the first
+ * empty line. */
+static bool mbox_read (const char *p, const char *end)
+{
+  const char *eol;
+
+  for (;;)
+  {
+    if ((eol = (const char *) memchr(p, '\n', end - p)) == NULL)
+      return false;
+    p = eol + 1;
+
+    /* The end of the header */
+    if (p == end || *p == '\n')
+      return false;
+
+    if (end - p >= 7 && !memcmp(p, "Status:", 7))
+    {
+      eol = (const char *) memchr(p, '\n', end - p);
+      return memchr(p + 7, 'R', (eol ? eol : end) - (p + 7)) != NULL;
+    }
+  }
+}
+
+/* Maildir file names start with the delivery time in seconds since the
+ * epoch, which is ten digits wide until the year 2286. */
+#define STAMP_DIGITS 10
+#define DAY (24 * 60 * 60)
+
+/* age_message: file one message into the histogram by the timestamp at
+ * the front of its name.
+ *
+ * This runs once per message, so it is kept free of data-dependent
+ * branches: once a non-digit has been seen, 'ok' drops to zero, further
+ * iterations re-read name[0] (so we never look past the terminating NUL)
+ * and leave the stamp alone. The compiler unrolls the whole thing into
+ * straight-line code with conditional moves. */
+static inline void age_message (struct mdt_ages *a, const char *name, time_t now)
+{
+  unsigned long stamp = 0;
+  unsigned int i, d, b, ok = 1;
+  long age;
+
+  for (i = 0; i < STAMP_DIGITS; i++)
+  {
+    d = (unsigned char) name[i * ok] - '0';
+    ok &= (d <= 9);
+    stamp = ok ? stamp * 10 + d : stamp;
+  }
+
+  age = (long) (now - (time_t) stamp);
+  b = (age >= DAY) + (age >= 7 * DAY) + (age >= 30 * DAY);
+  b = stamp ? b : MDT_AGE_UNDATED;
+  a->bucket[b]++;
+
+  a->oldest = (stamp && (time_t) stamp < a->oldest) ? (time_t) stamp : a->oldest;
+  a->newest = ((time_t) stamp > a->newest) ? (time_t) stamp : a->newest;
+}
+
+void mdt_age_message (struct mdt_ages *a, const char *name, time_t now)
+{
+  age_message (a, name, now);
+}
+
+/* stamp: note down the modification time in st.
+ *
+ * A directory changed within the second we started in may change again
+ * in that same second without its mtime moving, on filesystems that
+ * only keep seconds. Such stamps are left at zero so that the next
+ * mdt_refresh() looks again for sure. */
+static void stamp (struct scan *s, const struct stat *st, struct timespec *ts)
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  *ts = st->st_mtim;
+#else
+  ts->tv_sec = st->st_mtime;
+  ts->tv_nsec = 0;
+#endif
+
+  settle (s, ts);
+}
+
+static inline void settle (struct scan *s, struct timespec *ts)
+{
+  if (ts->tv_sec >= s->started)
+    ts->tv_sec = ts->tv_nsec = 0;
+}
+
+/* dir_stamp: stamp of the directory 'sub' below path (len bytes). */
+static int dir_stamp (struct scan *s, char *path, size_t len, const char *sub,
+                      struct timespec *ts)
+{
+  struct stat st;
+
+  strcpy (path + len, sub);
+  if (stat(path, &st) != 0)
+  {
+    ts->tv_sec = ts->tv_nsec = 0;
+    return -1;
+  }
+
+  stamp (s, &st, ts);
+  return 0;
+}
+
+static inline bool same_time (const struct timespec *a, const struct timespec *b)
+{
+  return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static void warn (struct scan *s, const char *fmt, const char *what)
+{
+  char msg [PATH_MAX + 64];
+
+  if (s->opts->warn == NULL)
+    return;
+
+  snprintf (msg, sizeof(msg), fmt, what);
+  s->opts->warn (s->opts->warn_arg, msg);
+}
+
+/* mdt_root_name: like basename(), but without modifying path; the name
+ * is cut short to fit in 'buf'. */
+const char * mdt_root_name (const char *path, char *buf, size_t size)
+{
+  const char *end = path + strlen(path), *start;
+  size_t len;
+
+  while (end > path + 1 && end[-1] == '/')
+    end--;
+
+  for (start = end; start > path && start[-1] != '/'; start--)
+    ;
+
+  /* Just "/" */
+  if (start == end && *start == '/')
+    end++;
+
+  len = end - start;
+  if (len >= size)
+    len = size - 1;
+  memcpy (buf, start, len);
+  buf[len] = '\0';
+  return buf;
+}
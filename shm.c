@@ -0,0 +1,427 @@
+/* shm.c: publish folder counts in a memory-mapped file, and read them
+ * back. See maildirtree.c for full copyright.
+ *
+ * The file is a header, a table of folders as parallel arrays (the same
+ * ones struct mdt_tree has, with the digests if the publisher was given
+ * --digest), and a blob of names. It is guarded by a
+ * sequence counter in the header: the publisher makes it odd before it
+ * touches anything and even again when it is done, so a reader that
+ * sees the same even number before and after copying what it needs has
+ * a consistent snapshot. Once mapped, reading takes no system calls.
+ *
+ * When the folders outgrow the file, the publisher writes a bigger one,
+ * renames it over the old and sets 'moved' in the old one's header;
+ * readers seeing that open the file again. */
+
+#include "config.h"
+
+#include "maildirtree.h"
+#include "snprintf.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+
+#define SHM_MAGIC   "MDTSHM\0"
+#define SHM_VERSION 2
+
+/* Columns, in the order they are laid out after the header */
+enum { COL_PARENT, COL_SIZE, COL_DEPTH, COL_NAME, COL_PATH, COL_READ, COL_UNREAD, COLUMNS };
+
+struct shm_header
+{
+  char magic [8];
+  uint32_t version;
+  uint32_t seq;            /* odd while being written */
+  uint32_t moved;          /* a newer file has replaced this one */
+  uint32_t capacity;       /* room for this many folders */
+  uint64_t names_capacity; /* and this many bytes of names */
+  uint64_t size;           /* of the whole file */
+  uint64_t column [COLUMNS];  /* file offsets of the uint32_t columns */
+  uint64_t digest;         /* and of the digests, 0 if there are none */
+  uint64_t flags;          /* and of the flag bytes */
+  uint64_t names;          /* and of the names */
+
+  /* Everything below only means something while seq is even. */
+  int64_t updated;         /* time of the last change */
+  uint32_t count, names_len;
+  uint32_t total_read, total_unread, folders_unread;
+  uint32_t pad;
+};
+
+struct shm_map
+{
+  int fd;
+  struct shm_header *h;
+  size_t size;
+};
+
+static int shm_create (const char *, const struct mdt_tree *, struct shm_map *);
+static void shm_write (struct shm_map *, const struct mdt_tree *);
+static struct mdt_tree * shm_snapshot (const struct shm_header *, size_t);
+static int shm_open_map (const char *, struct shm_map *);
+static void shm_close (struct shm_map *);
+static inline uint32_t *column (const struct shm_header *, int);
+static void on_signal (int);
+
+static volatile sig_atomic_t stop = 0;
+
+/* publish_main: scan 'path', publish it to 'file', then keep it current
+ * every 'interval' seconds until killed. */
+int publish_main (const char *path, const char *file, unsigned int interval)
+{
+  struct mdt_tree *t;
+  struct shm_map map;
+  long changed;
+
+  options.stamps = true;
+
+  if ((t = mdt_scan(path, &options)) == NULL)
+  {
+    printf ("maildirtree: %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  if (shm_create(file, t, &map) != 0)
+  {
+    printf ("maildirtree: %s: %s\n", file, strerror(errno));
+    return 1;
+  }
+
+  signal (SIGINT, &on_signal);
+  signal (SIGTERM, &on_signal);
+
+  while (!stop)
+  {
+    sleep (interval);
+
+    if ((changed = mdt_refresh(&t, path, &options)) < 0)
+    {
+      fprintf (stderr, "maildirtree: %s: %s\n", path, strerror(errno));
+      continue;
+    }
+
+    if (changed == 0)
+      continue;
+
+    if (t->count > map.h->capacity || t->names_len > map.h->names_capacity)
+    {
+      struct shm_map bigger;
+
+      if (shm_create(file, t, &bigger) != 0)
+      {
+        fprintf (stderr, "maildirtree: %s: %s\n", file, strerror(errno));
+        continue;
+      }
+
+      __atomic_store_n (&map.h->moved, 1, __ATOMIC_RELEASE);
+      shm_close (&map);
+      map = bigger;
+    }
+    else
+      shm_write (&map, t);
+  }
+
+  shm_close (&map);
+  mdt_free (t);
+
+  return 0;
+}
+
+/* read_shm_main: print what a publisher put in 'file', like a scan. */
+int read_shm_main (const char *file)
+{
+  struct shm_map map;
+  struct mdt_tree *t;
+
+  for (;;)
+  {
+    if (shm_open_map(file, &map) != 0)
+    {
+      printf ("maildirtree: %s: %s\n", file, strerror(errno));
+      return 1;
+    }
+
+    t = shm_snapshot (map.h, map.size);
+
+    if (t == NULL && errno == ESTALE)
+    {
+      shm_close (&map);
+      continue;
+    }
+
+    break;
+  }
+
+  shm_close (&map);
+
+  if (t == NULL)
+  {
+    printf ("maildirtree: %s: %s\n", file, strerror(errno));
+    return 1;
+  }
+
+  if (options.digest && t->digest == NULL)
+  {
+    printf ("maildirtree: %s: published without --digest\n", file);
+    free (t);
+    return 1;
+  }
+
+  if (options.digest)
+    print_digests (stdout, t);
+  else
+    report (stdout, t, file, NULL);
+  free (t);
+
+  return 0;
+}
+
+/* shm_create: write a fresh file with room to spare for 't', and
+ * atomically put it in place of 'file'. */
+static int shm_create (const char *file, const struct mdt_tree *t, struct shm_map *map)
+{
+  struct shm_header h;
+  char *tmp;
+  size_t len = strlen(file) + 5, off;
+  int c, fd;
+  void *p;
+
+  memset (&h, 0, sizeof(h));
+  memcpy (h.magic, SHM_MAGIC, sizeof(h.magic));
+  h.version = SHM_VERSION;
+
+  /* Twice what we need now, so that it takes a while to outgrow. */
+  h.capacity = 2 * t->count + 64;
+  h.names_capacity = 2 * (uint64_t) t->names_len + 4096;
+
+  off = sizeof(struct shm_header);
+  for (c = 0; c < COLUMNS; c++)
+  {
+    h.column[c] = off;
+    off += (size_t) h.capacity * sizeof(uint32_t);
+  }
+  if (t->digest)
+  {
+    h.digest = off;
+    off += (size_t) h.capacity * sizeof(struct mdt_digest);
+  }
+  h.flags = off;
+  off += h.capacity;
+  h.names = off;
+  off += h.names_capacity;
+  h.size = off;
+
+  tmp = (char *) malloc (len);
+  snprintf (tmp, len, "%s.tmp", file);
+
+  if ((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+  {
+    free (tmp);
+    return -1;
+  }
+
+  if (ftruncate(fd, h.size) != 0 ||
+      (p = mmap(NULL, h.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    close (fd);
+    unlink (tmp);
+    free (tmp);
+    return -1;
+  }
+
+  memcpy (p, &h, sizeof(h));
+  map->fd = fd;
+  map->h = (struct shm_header *) p;
+  map->size = h.size;
+
+  shm_write (map, t);
+
+  if (rename(tmp, file) != 0)
+  {
+    shm_close (map);
+    unlink (tmp);
+    free (tmp);
+    return -1;
+  }
+
+  free (tmp);
+  return 0;
+}
+
+/* shm_write: the writer's side of the sequence lock. */
+static void shm_write (struct shm_map *map, const struct mdt_tree *t)
+{
+  struct shm_header *h = map->h;
+  uint32_t seq = h->seq;
+  size_t n = t->count, names_len = t->names_len;
+
+  __atomic_store_n (&h->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  memcpy (column(h, COL_PARENT), t->parent, n * sizeof(uint32_t));
+  memcpy (column(h, COL_SIZE), t->size, n * sizeof(uint32_t));
+  memcpy (column(h, COL_DEPTH), t->depth, n * sizeof(uint32_t));
+  memcpy (column(h, COL_NAME), t->name, n * sizeof(uint32_t));
+  memcpy (column(h, COL_PATH), t->path, n * sizeof(uint32_t));
+  memcpy (column(h, COL_READ), t->read, n * sizeof(uint32_t));
+  memcpy (column(h, COL_UNREAD), t->unread, n * sizeof(uint32_t));
+  if (h->digest)
+    memcpy ((char *) h + h->digest, t->digest, n * sizeof(struct mdt_digest));
+  memcpy ((char *) h + h->flags, t->flags, n);
+  memcpy ((char *) h + h->names, t->names, names_len);
+
+  h->count = n;
+  h->names_len = names_len;
+  h->total_read = t->total_read;
+  h->total_unread = t->total_unread;
+  h->folders_unread = t->folders_unread;
+  h->updated = time(NULL);
+
+  __atomic_store_n (&h->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* shm_snapshot: the reader's side. Copies the folders out into a tree
+ * of our own, trying again for as long as the publisher is busy.
+ * Fails with ESTALE if the file was replaced, EINVAL if it is not ours. */
+static struct mdt_tree * shm_snapshot (const struct shm_header *h, size_t size)
+{
+  struct mdt_tree *t;
+  uint32_t seq, n, names_len;
+  size_t digests;
+  unsigned int tries = 0;
+  char *p;
+  int c;
+
+  if (size < sizeof(struct shm_header) || memcmp(h->magic, SHM_MAGIC, sizeof(h->magic)) ||
+      h->version != SHM_VERSION || h->size > size)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  /* Enough room for anything the file can hold */
+  digests = h->digest ? sizeof(struct mdt_digest) : 0;
+  t = (struct mdt_tree *) malloc (sizeof(struct mdt_tree) +
+        (size_t) h->capacity * (COLUMNS * sizeof(uint32_t) + digests + 1) + h->names_capacity);
+  if (t == NULL)
+    return NULL;
+
+  for (;;)
+  {
+    if (__atomic_load_n (&h->moved, __ATOMIC_ACQUIRE))
+    {
+      free (t);
+      errno = ESTALE;
+      return NULL;
+    }
+
+    seq = __atomic_load_n (&h->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      goto again;
+
+    n = h->count;
+    names_len = h->names_len;
+    if (n == 0 || n > h->capacity || names_len > h->names_capacity)
+      goto again;
+
+    memset (t, 0, sizeof(struct mdt_tree));
+    t->count = n;
+    p = (char *) (t + 1);
+
+    /* The digests first, so that they stay aligned */
+    if (digests)
+    {
+      memcpy (p, (const char *) h + h->digest, n * digests);
+      p += n * digests;
+    }
+    for (c = 0; c < COLUMNS; c++)
+    {
+      memcpy (p, column(h, c), n * sizeof(uint32_t));
+      p += n * sizeof(uint32_t);
+    }
+    memcpy (p, (const char *) h + h->flags, n);
+    memcpy (p + n, (const char *) h + h->names, names_len);
+
+    t->total_read = h->total_read;
+    t->total_unread = h->total_unread;
+    t->folders_unread = h->folders_unread;
+
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    if (__atomic_load_n (&h->seq, __ATOMIC_RELAXED) == seq)
+      break;
+
+again:
+    /* The publisher holds the lock for microseconds; spin a little,
+     * then let it run. */
+    if (++tries % 64 == 0)
+      sched_yield ();
+  }
+
+  p = (char *) (t + 1);
+  if (digests)
+  {
+    t->digest = (struct mdt_digest *) p;
+    p += n * digests;
+  }
+  t->parent = (unsigned int *) p;
+  t->size   = t->parent + n;
+  t->depth  = t->size + n;
+  t->name   = t->depth + n;
+  t->path   = t->name + n;
+  t->read   = t->path + n;
+  t->unread = t->read + n;
+  t->flags  = (unsigned char *) (t->unread + n);
+  t->names  = (char *) (t->flags + n);
+  t->names_len = names_len;
+
+  return t;
+}
+
+static int shm_open_map (const char *file, struct shm_map *map)
+{
+  struct stat st;
+  void *p;
+
+  if ((map->fd = open(file, O_RDONLY)) < 0)
+    return -1;
+
+  if (fstat(map->fd, &st) != 0 ||
+      (p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, map->fd, 0)) == MAP_FAILED)
+  {
+    close (map->fd);
+    return -1;
+  }
+
+  map->h = (struct shm_header *) p;
+  map->size = st.st_size;
+  return 0;
+}
+
+static void shm_close (struct shm_map *map)
+{
+  munmap (map->h, map->size);
+  close (map->fd);
+}
+
+static inline uint32_t *column (const struct shm_header *h, int c)
+{
+  return (uint32_t *) ((char *) h + h->column[c]);
+}
+
+static void on_signal (int sig)
+{
+  (void) sig;
+  stop = 1;
+}
@@ -0,0 +1,130 @@
+/* sort.c: sorting folder names for libmaildirtree. See maildirtree.c for
+ * full copyright.
+ * (C) 2003 by Joshua Kwan. */
+
+#include "config.h"
+
+#include "libmaildirtree.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Below this many strings, insertion sort wins. */
+#define SMALL 16
+
+/* What is being sorted: items, and where their names are */
+struct sort
+{
+  const char *names;
+  const unsigned int *offset;   /* of each item, or NULL if the items
+                                 * are offsets themselves */
+};
+
+static void mkqsort (const struct sort *, unsigned int *, size_t, size_t);
+static void insertion_sort (const struct sort *, unsigned int *, size_t, size_t);
+static inline unsigned int key (const struct sort *, unsigned int, size_t);
+
+/* mdt_sort_names: multikey quicksort (Bentley and Sedgewick) of items
+ * by their names, all in one buffer.
+ *
+ * Each pass splits on a single character position, so the names are
+ * only ever read a byte at a time, front to back, and the common
+ * prefixes that folder names are full of are compared once per
+ * partition instead of once per strcmp(). */
+void mdt_sort_names (unsigned int *items, size_t n, const char *names,
+                     const unsigned int *offset)
+{
+  struct sort s;
+
+  s.names = names;
+  s.offset = offset;
+  mkqsort (&s, items, n, 0);
+}
+
+static void mkqsort (const struct sort *s, unsigned int *a, size_t n, size_t depth)
+{
+  unsigned int k0, k1, k2, v, k, t;
+  size_t lt, gt, i;
+
+  while (n > SMALL)
+  {
+    /* Median of three for the pivot character */
+    k0 = key(s, a[0], depth);
+    k1 = key(s, a[n / 2], depth);
+    k2 = key(s, a[n - 1], depth);
+    v = (k0 < k1) ? ((k1 < k2) ? k1 : (k0 < k2) ? k2 : k0)
+                  : ((k0 < k2) ? k0 : (k1 < k2) ? k2 : k1);
+
+    /* Three-way partition: [0, lt) below, [lt, gt) equal, [gt, n) above */
+    lt = i = 0;
+    gt = n;
+    while (i < gt)
+    {
+      k = key(s, a[i], depth);
+
+      if (k < v)
+      {
+        t = a[lt]; a[lt++] = a[i]; a[i++] = t;
+      }
+      else if (k > v)
+      {
+        t = a[--gt]; a[gt] = a[i]; a[i] = t;
+      }
+      else
+        i++;
+    }
+
+    mkqsort (s, a, lt, depth);
+    mkqsort (s, a + gt, n - gt, depth);
+
+    /* The equal ones all ended here, and are all the same. */
+    if (v == 0)
+      return;
+
+    a += lt;
+    n = gt - lt;
+    depth++;
+  }
+
+  insertion_sort (s, a, n, depth);
+}
+
+/* The first 'depth' characters of all of a[] are known to be equal. */
+static void insertion_sort (const struct sort *s, unsigned int *a, size_t n, size_t depth)
+{
+  size_t i, j, d;
+  unsigned int t, kt, kj;
+
+  for (i = 1; i < n; i++)
+  {
+    t = a[i];
+
+    for (j = i; j > 0; j--)
+    {
+      for (d = depth; ; d++)
+      {
+        kt = key(s, t, d);
+        kj = key(s, a[j - 1], d);
+        if (kt != kj || kt == 0)
+          break;
+      }
+
+      if (kj <= kt)
+        break;
+
+      a[j] = a[j - 1];
+    }
+
+    a[j] = t;
+  }
+}
+
+/* The sort key of one character: the terminating NUL first, then the
+ * dot, then everything else in byte order. */
+static inline unsigned int key (const struct sort *s, unsigned int item, size_t depth)
+{
+  unsigned int off = s->offset ? s->offset[item] : item;
+  unsigned int c = (unsigned char) s->names[off + depth];
+
+  return (c == '.') ? 1 : c + (c != 0);
+}
@@ -0,0 +1,414 @@
+/* stream.c: --stream, printing the tree of a huge Maildir without ever
+ * holding it as a tree. See maildirtree.c for full copyright.
+ *
+ * While scanning, each folder is kept only as its counts followed by its
+ * name, back to back in one buffer. Afterwards the names are sorted with
+ * the dot lowest, which puts every folder right before its subfolders,
+ * and the tree falls out of one forward pass over them: how many leading
+ * components a name shares with the one before says how deep it starts,
+ * and components not seen before that are not the folder itself are
+ * dummies. The only state carried along is one pipe-or-not per level.
+ *
+ * Whether a folder is the last of its siblings is only known once its
+ * subtree is over, so a backward pass first leaves one bit per line
+ * saying so. */
+
+#include "config.h"
+
+#include "maildirtree.h"
+#include "snprintf.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+struct stream
+{
+  /* Counts and names of all folders but the root */
+  char *buf;
+  size_t len, alloc;
+  size_t rec;                  /* bytes of counts before each name */
+
+  unsigned int *names;         /* offsets of the names in buf */
+  size_t count, names_alloc;
+
+  struct mdt_counts root;
+  bool have_root;
+  unsigned int total_read, total_unread, folders_unread, folders_partial;
+  struct mdt_ages total_ages;
+  unsigned int max_depth;
+};
+
+static int collect (void *, const char *, const struct mdt_counts *);
+static void emit_tree (FILE *, struct stream *, const char *);
+static void emit_summary (FILE *, struct stream *, const char *, const char *);
+static void get_counts (const struct stream *, size_t, struct mdt_counts *);
+static unsigned int common_depth (const char *, const char *);
+static unsigned int shared (const struct stream *, size_t, unsigned int);
+static void mboxes_first (struct stream *);
+static inline bool is_mbox (const struct stream *, size_t);
+static inline size_t component (const char **, const char **);
+
+/* stream_report: report() for the Maildir at 'dir', straight from the
+ * scan. Returns -1 with errno set if it could not be read, otherwise
+ * how many folders the deadline cut short. */
+int stream_report (FILE *out, const char *dir, const char *fake)
+{
+  struct stream s;
+  char name [NAME_MAX + 1];
+  int r;
+
+  memset (&s, 0, sizeof(s));
+  mdt_clear_ages (&s.total_ages);
+  s.rec = 2 * sizeof(unsigned int) + 1 + (options.ages ? sizeof(struct mdt_ages) : 0);
+
+  if ((r = mdt_walk(dir, &options, &collect, &s)) != 0)
+  {
+    if (r > 0)
+      errno = r;
+    free (s.buf);
+    free (s.names);
+    return -1;
+  }
+
+  mdt_sort_names (s.names, s.count, s.buf, NULL);
+  mboxes_first (&s);
+
+  if (!fake)
+    fake = mdt_root_name (dir, name, sizeof(name));
+
+  if (!summary)
+    emit_tree (out, &s, fake);
+  else
+    emit_summary (out, &s, dir, fake);
+
+  free (s.buf);
+  free (s.names);
+  return (int) s.folders_partial;
+}
+
+/* collect: mdt_walk() callback; the root's counts are kept aside, every
+ * other folder is appended to the buffer. */
+static int collect (void *arg, const char *name, const struct mdt_counts *c)
+{
+  struct stream *s = (struct stream *) arg;
+  unsigned int counts[2], depth = 0;
+  const char *p, *start;
+  size_t len = 0, n;
+
+  s->total_read += c->read;
+  s->total_unread += c->unread;
+  if (c->unread > 0)
+    s->folders_unread++;
+  if (c->flags & MDT_PARTIAL)
+    s->folders_partial++;
+  if (options.ages)
+    mdt_add_ages (&s->total_ages, &c->ages);
+
+  /* The root always comes first. */
+  if (!s->have_root)
+  {
+    s->root = *c;
+    s->have_root = true;
+    return 0;
+  }
+
+  for (p = name; (n = component(&p, &start)) > 0; depth++)
+    len += n + 1;
+  if (depth == 0)
+    return 0;
+  if (depth > s->max_depth)
+    s->max_depth = depth;
+
+  if (s->len + s->rec + len > s->alloc)
+  {
+    size_t want = s->alloc ? s->alloc * 2 : 65536;
+    char *nbuf;
+
+    while (want < s->len + s->rec + len)
+      want *= 2;
+
+    /* Offsets into it are unsigned ints. */
+    if (want > UINT_MAX || (nbuf = (char *) realloc (s->buf, want)) == NULL)
+      return ENOMEM;
+
+    s->buf = nbuf;
+    s->alloc = want;
+  }
+
+  if (s->count == s->names_alloc)
+  {
+    size_t want = s->names_alloc ? s->names_alloc * 2 : 4096;
+    unsigned int *nnames;
+
+    if ((nnames = (unsigned int *) realloc (s->names, want * sizeof(unsigned int))) == NULL)
+      return ENOMEM;
+
+    s->names = nnames;
+    s->names_alloc = want;
+  }
+
+  counts[0] = c->read;
+  counts[1] = c->unread;
+  memcpy (s->buf + s->len, counts, sizeof(counts));
+  s->buf[s->len + sizeof(counts)] = c->flags;
+  if (options.ages)
+    memcpy (s->buf + s->len + sizeof(counts) + 1, &c->ages, sizeof(struct mdt_ages));
+  s->len += s->rec;
+
+  /* Its components joined by single dots: ..Foo..Bar is the same
+   * folder as .Foo.Bar, and has to sort right next to it. */
+  s->names[s->count++] = s->len;
+  for (p = name; (n = component(&p, &start)) > 0; )
+  {
+    memcpy (s->buf + s->len, start, n);
+    s->len += n;
+    s->buf[s->len++] = '.';
+  }
+  s->buf[s->len - 1] = '\0';
+
+  return 0;
+}
+
+static void emit_tree (FILE *out, struct stream *s, const char *root)
+{
+  unsigned char *last;
+  bool *seen, *more;
+  unsigned int d, common, depth, top = 0;
+  size_t i, lines = 0, line;
+  const char *cur, *p, *start;
+  char comp [NAME_MAX + 1];
+  struct mdt_counts c;
+
+  /* How many lines there are, dummies included */
+  for (i = 0; i < s->count; i++)
+  {
+    cur = s->buf + s->names[i];
+    depth = common_depth(cur, cur);
+    common = shared(s, i, depth);
+    lines += depth - common;
+  }
+
+  last = (unsigned char *) calloc ((lines + 7) / 8 + 1, 1);
+  seen = (bool *) calloc (s->max_depth + 2, sizeof(bool));
+  more = (bool *) calloc (s->max_depth + 2, sizeof(bool));
+  if (last == NULL || seen == NULL || more == NULL)
+  {
+    free (last); free (seen); free (more);
+    fprintf (stderr, "maildirtree: out of memory\n");
+    return;
+  }
+
+  /* Backwards: a line is the last of its siblings if no sibling was
+   * seen after it. Whatever was seen deeper than it belonged to it. */
+  line = lines;
+  for (i = s->count; i-- > 0; )
+  {
+    cur = s->buf + s->names[i];
+    depth = common_depth(cur, cur);
+    common = shared(s, i, depth);
+
+    for (d = depth; d > common; d--)
+    {
+      line--;
+      if (!seen[d])
+        last[line / 8] |= 1 << (line % 8);
+      seen[d] = true;
+
+      while (top > d)
+        seen[top--] = false;
+      top = d;
+    }
+  }
+
+  print_root (out, root, &s->root, options.ages);
+
+  /* Forwards again, printing */
+  line = 0;
+  for (i = 0; i < s->count; i++)
+  {
+    cur = s->buf + s->names[i];
+    depth = common_depth(cur, cur);
+    common = shared(s, i, depth);
+    get_counts (s, i, &c);
+
+    for (p = cur, d = 0; d < depth; d++)
+    {
+      size_t len = component(&p, &start);
+      bool is_last;
+
+      if (d < common)
+        continue;
+
+      if (len > NAME_MAX)
+        len = NAME_MAX;
+      memcpy (comp, start, len);
+      comp[len] = '\0';
+
+      is_last = (last[line / 8] >> (line % 8)) & 1;
+      line++;
+      more[d + 1] = !is_last;
+
+      print_line (out, more, d + 1, is_last, comp,
+                  (d + 1 == depth) ? &c : NULL, NULL, options.ages);
+    }
+  }
+
+  print_totals (out, NULL, s->total_read, s->total_unread, s->folders_unread);
+  print_partial (out, s->folders_partial);
+
+  if (options.ages)
+  {
+    fprintf (out, "Ages:");
+    print_ages (out, &s->total_ages);
+    putc('\n', out);
+  }
+
+  free (last);
+  free (seen);
+  free (more);
+}
+
+static void emit_summary (FILE *out, struct stream *s, const char *dir, const char *root)
+{
+  unsigned int printed, n = 0;
+  char path [PATH_MAX];
+  const char *p, *start;
+  size_t i, len, at;
+  struct mdt_counts c;
+
+  print_totals (out, dir, s->total_read, s->total_unread, s->folders_unread);
+  print_partial (out, s->folders_partial);
+
+  if (s->total_unread > 0)
+  {
+    printed = fprintf (out, "Unread messages in: ");
+
+    if (s->root.unread > 0)
+      print_unread (out, root, &printed, ++n == s->folders_unread);
+
+    for (i = 0; i < s->count; i++)
+    {
+      get_counts (s, i, &c);
+      if (c.unread == 0)
+        continue;
+
+      /* Foo/Bar for Foo.Bar */
+      for (p = s->buf + s->names[i], at = 0; (len = component(&p, &start)) > 0; )
+      {
+        if (at + len + 2 > sizeof(path))
+          break;
+        if (at > 0)
+          path[at++] = '/';
+        memcpy (path + at, start, len);
+        at += len;
+      }
+      path[at] = '\0';
+
+      print_unread (out, path, &printed, ++n == s->folders_unread);
+    }
+  }
+
+  if (options.ages)
+  {
+    fprintf (out, "%sAges:", s->total_unread > 0 ? "\n" : "");
+    print_ages (out, &s->total_ages);
+    putc('\n', out);
+  }
+}
+
+/* get_counts: the counts stored in front of the i-th name */
+static void get_counts (const struct stream *s, size_t i, struct mdt_counts *c)
+{
+  const char *rec = s->buf + s->names[i] - s->rec;
+  unsigned int counts[2];
+
+  memcpy (counts, rec, sizeof(counts));
+  c->read = counts[0];
+  c->unread = counts[1];
+  c->flags = (unsigned char) rec[sizeof(counts)];
+  if (options.ages)
+    memcpy (&c->ages, rec + sizeof(counts) + 1, sizeof(struct mdt_ages));
+}
+
+/* common_depth: how many leading components a and b share. Given the
+ * same name twice, that is its depth. */
+static unsigned int common_depth (const char *a, const char *b)
+{
+  const char *sa, *sb;
+  size_t la, lb;
+  unsigned int d = 0;
+
+  for (;;)
+  {
+    la = component(&a, &sa);
+    lb = component(&b, &sb);
+
+    if (la == 0 || la != lb || memcmp(sa, sb, la) != 0)
+      return d;
+    d++;
+  }
+}
+
+/* shared: the leading components of the i-th name, 'depth' of them,
+ * already printed for the one before. Never the folder itself: two
+ * folders can have the same name once their dots are squeezed out (an
+ * mbox Foo next to a Maildir .Foo), and each gets a line of its own.
+ * Nor an mbox, which has no subfolders, as in mdt_insert(). */
+static unsigned int shared (const struct stream *s, size_t i, unsigned int depth)
+{
+  const char *prev, *cur = s->buf + s->names[i];
+  unsigned int common;
+
+  if (i == 0)
+    return 0;
+
+  prev = s->buf + s->names[i - 1];
+  common = common_depth(prev, cur);
+  if (is_mbox(s, i - 1) && common == common_depth(prev, prev))
+    common--;
+
+  return (common < depth) ? common : depth - 1;
+}
+
+/* mboxes_first: of folders with the same name, the mboxes, so that
+ * subfolders follow the Maildir one, as in mdt_finish(). */
+static void mboxes_first (struct stream *s)
+{
+  unsigned int v;
+  size_t i, k;
+
+  for (i = 1; i < s->count; i++)
+    for (k = i; k > 0 && is_mbox(s, k) && !is_mbox(s, k - 1) &&
+                !strcmp(s->buf + s->names[k], s->buf + s->names[k - 1]); k--)
+    {
+      v = s->names[k];
+      s->names[k] = s->names[k - 1];
+      s->names[k - 1] = v;
+    }
+}
+
+/* is_mbox: whether the i-th folder is one, going by its flags byte */
+static inline bool is_mbox (const struct stream *s, size_t i)
+{
+  return (s->buf[s->names[i] - s->rec + 2 * sizeof(unsigned int)] & MDT_MBOX) != 0;
+}
+
+/* component: the next dot-separated component at *p, skipping empty
+ * ones as mdt_insert() does. Its start goes in *start and its length is
+ * returned, 0 at the end of the name. */
+static inline size_t component (const char **p, const char **start)
+{
+  const char *q = *p, *e;
+
+  while (*q == '.')
+    q++;
+  for (e = q; *e && *e != '.'; e++)
+    ;
+
+  *start = q;
+  *p = e;
+  return e - q;
+}
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+# imapd.py: a stand-in IMAP server for make check, talking on its
+# standard input and output so that maildirtree can run it with --tunnel:
+#
+#   maildirtree -x 'python3 tests/imapd.py [--list-status]' imap://joe@test
+#
+# It has INBOX with a few folders, one of them \Noselect, one sent as a
+# literal and one with a quote in its name; one that STATUS says is
+# gone; and 300 more, so that STATUS commands go out in several
+# pipelined batches. Only LOGIN "joe" "s\"ecret" is let in. With
+# --list-status it offers LIST-STATUS once logged in. On LOGOUT it says
+# on standard error how many STATUS commands it was sent.
+
+import re
+import sys
+
+LOGIN = 'LOGIN "joe" "s\\"ecret"'
+
+# name, flags, messages, unseen
+BOXES = [("INBOX", "", 10, 3),
+         ("INBOX/Work", "", 5, 5),
+         ("INBOX/Lists", "\\Noselect", 0, 0),
+         ("INBOX/Lists/linux kernel", "", 100, 40),
+         ('INBOX/Odd"name', "", 2, 1),
+         ("Gone", "", 1, 1)]
+BOXES += [("INBOX/Many/f%03d" % i, "", i, i % 3) for i in range(300)]
+
+GONE = "Gone"
+
+
+def quote(name):
+    return '"' + name.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def unquote(s):
+    return re.sub(r'\\(.)', r'\1', s)
+
+
+def main():
+    list_status = "--list-status" in sys.argv[1:]
+    out = sys.stdout.buffer
+    logged_in = False
+    statuses = 0
+
+    def say(line):
+        out.write(line.encode() + b"\r\n")
+
+    say("* OK stand-in ready")
+    out.flush()
+
+    for raw in sys.stdin.buffer:
+        line = raw.decode().rstrip("\r\n")
+        tag, _, cmd = line.partition(" ")
+        verb = cmd.split(" ", 1)[0].upper()
+
+        if verb == "CAPABILITY":
+            caps = "IMAP4rev1"
+            if list_status and logged_in:
+                caps += " LIST-EXTENDED LIST-STATUS"
+            say("* CAPABILITY " + caps)
+            say(tag + " OK done")
+        elif verb == "LOGIN":
+            if cmd != LOGIN:
+                say(tag + " NO wrong user or password")
+            else:
+                logged_in = True
+                say(tag + " OK logged in")
+        elif not logged_in:
+            say(tag + " BAD log in first")
+        elif verb == "LIST":
+            for name, flags, messages, unseen in BOXES:
+                if name.startswith("INBOX/Lists/"):
+                    say('* LIST (%s) "/" {%d}' % (flags, len(name)))
+                    say(name)
+                else:
+                    say('* LIST (%s) "/" %s' % (flags, quote(name)))
+                if "RETURN" in cmd and not flags and name != GONE:
+                    say("* STATUS %s (MESSAGES %d UNSEEN %d)"
+                        % (quote(name), messages, unseen))
+            say(tag + " OK list")
+        elif verb == "STATUS":
+            statuses += 1
+            name = unquote(re.match(r'STATUS "((?:[^"\\]|\\.)*)"', cmd).group(1))
+            if name == GONE:
+                say(tag + " NO no such mailbox")
+            else:
+                for n, flags, messages, unseen in BOXES:
+                    if n == name:
+                        say("* STATUS %s (MESSAGES %d UNSEEN %d)"
+                            % (quote(n), messages, unseen))
+                say(tag + " OK status")
+        elif verb == "LOGOUT":
+            sys.stderr.write("statuses %d\n" % statuses)
+            # The client may well hang up without waiting for these.
+            try:
+                say("* BYE")
+                say(tag + " OK bye")
+                out.flush()
+            except (BrokenPipeError, ConnectionResetError):
+                pass
+            return
+        else:
+            say(tag + " BAD unknown command")
+
+        out.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,385 @@
+#!/bin/sh
+# smoke.sh: "make check". Builds a small maildir and checks that the
+# modes which should agree with a plain scan of it do.
+#
+#   sh tests/smoke.sh ./maildirtree
+
+mdt=${1:-./maildirtree}
+here=`dirname "$0"`
+tmp=`mktemp -d ${TMPDIR:-/tmp}/mdtcheck.XXXXXX` || exit 1
+trap 'rm -rf "$tmp"' 0
+failed=0
+
+# check NAME COMMAND...: run a check, saying how it went
+check ()
+{
+  name=$1
+  shift
+  if "$@" >"$tmp/log" 2>&1; then
+    echo "ok    $name"
+  else
+    echo "FAIL  $name"
+    sed 's/^/      /' "$tmp/log"
+    failed=1
+  fi
+}
+
+# same A B: whether two outputs agree, showing how they do not
+same ()
+{
+  diff "$1" "$2"
+}
+
+# folder DIR READ UNREAD: a Maildir folder with that many messages
+folder ()
+{
+  mkdir -p "$1/cur" "$1/new" "$1/tmp"
+  i=0
+  while [ $i -lt $2 ]; do
+    : > "$1/cur/10000$i.M${i}P1.check:2,S"
+    i=`expr $i + 1`
+  done
+  i=0
+  while [ $i -lt $3 ]; do
+    : > "$1/new/20000$i.M${i}P2.check"
+    i=`expr $i + 1`
+  done
+}
+
+# names TREE: the folders in a printed tree, one a line, in its order
+names ()
+{
+  sed -n '/-- /{s/.*-- //; s/  *(.*//; s/ *$//; p;}' "$1"
+}
+
+# ask SOCKET: send the requests on stdin to the daemon on SOCKET, and
+# print what it answers until it hangs up (needs python3)
+ask ()
+{
+  python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(sys.stdin.buffer.read())
+while True:
+    d = s.recv(4096)
+    if not d:
+        break
+    sys.stdout.buffer.write(d)
+' "$1"
+}
+
+# listening PID SOCKET: wait for the daemon PID to listen on SOCKET
+listening ()
+{
+  i=0
+  while [ ! -S "$2" ] && [ $i -lt 50 ] && kill -0 $1 2>/dev/null; do
+    sleep 1
+    i=`expr $i + 1`
+  done
+}
+
+md=$tmp/Mail
+folder "$md" 3 2
+folder "$md/.Drafts" 1 0
+folder "$md/.Lists" 0 0
+folder "$md/.Lists.linux" 40 7
+folder "$md/.Lists.linux-kernel" 12 0
+folder "$md/.Lists.linux.stable" 2 1
+folder "$md/.Work.Old" 5 0
+folder "$md/.Work.Old.2019" 9 3
+folder "$md/.Sent Items" 11 0
+folder "$md/.Zed" 0 4
+
+# --stream: the same tree and summary without the tree in memory
+"$mdt" "$md" >"$tmp/tree"
+"$mdt" -t "$md" >"$tmp/stream"
+check "--stream tree" same "$tmp/tree" "$tmp/stream"
+"$mdt" -s "$md" >"$tmp/tree"
+"$mdt" -s -t "$md" >"$tmp/stream"
+check "--stream summary" same "$tmp/tree" "$tmp/stream"
+
+# An mbox Foo next to a Maildir .Foo: both are shown, the same way
+dup=$tmp/Dup
+folder "$dup" 0 0
+folder "$dup/.Foo" 1 1
+folder "$dup/.Foo.Bar" 2 0
+printf 'From a@b  Thu Jan  1 00:00:00 1970\n\nx\n' > "$dup/Foo"
+"$mdt" -m "$dup" >"$tmp/tree"
+"$mdt" -m -t "$dup" >"$tmp/stream"
+check "--stream keeps Foo and .Foo" test `grep -c -- '-- Foo ' "$tmp/stream"` -eq 2
+check "tree keeps Foo and .Foo" same "$tmp/tree" "$tmp/stream"
+
+# --jobs: the same tree, however the folders were split up
+"$mdt" "$md" >"$tmp/tree"
+for n in 2 4 16; do
+  "$mdt" -j $n "$md" >"$tmp/jobs"
+  check "--jobs $n" same "$tmp/tree" "$tmp/jobs"
+done
+
+# --sort: the folders of each level by unread or total messages, most
+# first, and by name where those are the same
+"$mdt" -o unread "$md" >"$tmp/tree"
+names "$tmp/tree" >"$tmp/order"
+printf '%s\n' Zed Drafts Lists linux stable linux-kernel 'Sent Items' \
+  Work Old 2019 >"$tmp/expected"
+check "--sort unread" same "$tmp/expected" "$tmp/order"
+"$mdt" -o total "$md" >"$tmp/tree"
+names "$tmp/tree" >"$tmp/order"
+printf '%s\n' 'Sent Items' Zed Drafts Lists linux stable linux-kernel \
+  Work Old 2019 >"$tmp/expected"
+check "--sort total" same "$tmp/expected" "$tmp/order"
+"$mdt" -o total -j 4 "$md" >"$tmp/jobs"
+check "--sort total with --jobs 4" same "$tmp/tree" "$tmp/jobs"
+
+# --rollup: each folder with subfolders shows what they hold with it,
+# Work, which is not a folder itself, too
+"$mdt" -u "$md" >"$tmp/tree"
+check "--rollup Lists" grep -q -- '-- Lists .*(0/0)  *\[8/62\]$' "$tmp/tree"
+check "--rollup linux" grep -q -- '-- linux .*(7/47)  *\[8/50\]$' "$tmp/tree"
+check "--rollup Work" grep -q -- '-- Work  *\[3/17\]$' "$tmp/tree"
+check "--rollup no more" test `grep -c '\]$' "$tmp/tree"` -eq 4
+
+# --ages: a message in each bucket, by the time its name was made at
+old=$tmp/Old
+now=`date +%s`
+mkdir -p "$old/cur" "$old/new" "$old/tmp"
+for s in 3600 172800 864000 8640000; do
+  : > "$old/cur/`expr $now - $s`.M${s}P1.check:2,S"
+done
+"$mdt" -a "$old" >"$tmp/tree"
+"$mdt" -a -t "$old" >"$tmp/stream"
+check "--ages buckets" grep -q '(0/4)  <1d:1 <7d:1 <30d:1 older:1 ' "$tmp/tree"
+check "--ages with --stream" same "$tmp/tree" "$tmp/stream"
+
+# --unique: messages hard-linked into another folder are told apart
+# from those that are not, however many threads count them
+uq=$tmp/Unique
+folder "$uq" 1 1
+folder "$uq/.A" 0 0
+: > "$uq/.A/new/300000.M0P3.check"
+ln "$uq/cur/100000.M0P1.check:2,S" "$uq/.A/cur/100000.M0P1.check:2,S"
+ln "$uq/new/200000.M0P2.check" "$uq/.A/new/200000.M0P2.check"
+"$mdt" -U "$uq" >"$tmp/tree"
+check "--unique" grep -q '^3 distinct messages, and 2 more hard links to them\.$' "$tmp/tree"
+"$mdt" -U -j 2 "$uq" >"$tmp/jobs"
+check "--unique with --jobs 2" same "$tmp/tree" "$tmp/jobs"
+
+# --audit: a message in both new and cur, and files in tmp from deliveries
+# that started long ago, going by their names
+au=$tmp/Inbox
+folder "$au" 1 1
+folder "$au/.B" 0 0
+: > "$au/new/100000.M0P1.check"
+: > "$au/.B/tmp/1000.M1P1.check"
+: > "$au/.B/tmp/2000.M2P1.check"
+: > "$au/.B/tmp/`date +%s`.M3P1.check"
+"$mdt" -A "$au" >"$tmp/tree"
+sed -n '/^Audit:/,/^$/{/./p;}' "$tmp/tree" >"$tmp/audit"
+cat >"$tmp/expected" <<EOF
+Audit: 1 message in both new and cur, 2 files in tmp for over 36 hours:
+  Inbox: 1 in both, 0 stale
+  B: 0 in both, 2 stale
+EOF
+check "--audit" same "$tmp/expected" "$tmp/audit"
+"$mdt" -A -j 2 "$au" >"$tmp/jobs"
+check "--audit with --jobs 2" same "$tmp/tree" "$tmp/jobs"
+
+# --deadline: out of time before anything is counted, every folder is
+# still shown, flagged, a Maildir one without a dot and an mbox too.
+# Under --checkpoint the library gives up by itself; otherwise the scan
+# is given up on, which may be before it could list anything at all.
+late=$tmp/Late
+folder "$late" 1 1
+folder "$late/.A" 1 0
+folder "$late/Plain" 0 1
+printf 'From a@b  Thu Jan  1 00:00:00 1970\n\nx\n' > "$late/Box"
+"$mdt" -m -T 0 -c "$tmp/late" "$late" >"$tmp/late-walk"
+check "--deadline lists every folder" test `grep -c -- '-- .*+)$' "$tmp/late-walk"` -eq 3
+"$mdt" -m -T 0 "$late" >"$tmp/late-thread"
+if grep -q -- '-- ' "$tmp/late-thread"; then
+  check "--deadline given up on lists the same" same "$tmp/late-walk" "$tmp/late-thread"
+else
+  echo "skip  --deadline given up on (before listing)"
+fi
+
+# --history and --since: what each run counted comes back, a message
+# that came and went as well
+hist=$tmp/Hist
+folder "$hist" 2 1
+folder "$hist/.A" 0 5
+"$mdt" -H "$tmp/history" "$hist" >/dev/null
+: > "$hist/new/300000.M0P3.check"
+"$mdt" -H "$tmp/history" "$hist" >/dev/null
+rm "$hist/new/300000.M0P3.check"
+"$mdt" -H "$tmp/history" "$hist" >/dev/null
+"$mdt" -H "$tmp/history" "$hist" >/dev/null
+"$mdt" -H "$tmp/history" -w 1h "$hist" >"$tmp/since"
+sed -n 's/.*  //p' "$tmp/since" >"$tmp/series"
+printf '%s\n' 'not there' '(1/3)' '(2/4)' '(1/3)' >"$tmp/expected"
+check "--history and --since" same "$tmp/expected" "$tmp/series"
+"$mdt" -H "$tmp/history" -w 1h -l 1 >"$tmp/since"
+check "--since --top" grep -q "  +5  *+5 unread  $hist/A (5/5)\$" "$tmp/since"
+
+# --shard and --merge: three shards add up to one scan
+"$mdt" "$md" >"$tmp/tree"
+for k in 1 2 3; do
+  "$mdt" -c "$tmp/part$k" -k $k/3 "$md"
+done
+"$mdt" -g "$tmp/part1" "$tmp/part2" "$tmp/part3" >"$tmp/merged"
+check "--shard 3 and --merge" same "$tmp/tree" "$tmp/merged"
+
+# --digest: the same digests from a journal, from shards and from a
+# published file as from a plain scan
+"$mdt" -z "$md" >"$tmp/digest"
+"$mdt" -z -c "$tmp/journal" "$md" >"$tmp/journalled"
+check "--digest with --checkpoint" same "$tmp/digest" "$tmp/journalled"
+"$mdt" -z -c "$tmp/journal" -r "$md" >"$tmp/journalled"
+check "--digest with --resume" same "$tmp/digest" "$tmp/journalled"
+for k in 1 2 3; do
+  "$mdt" -z -c "$tmp/zpart$k" -k $k/3 "$md"
+done
+"$mdt" -z -g "$tmp/zpart1" "$tmp/zpart2" "$tmp/zpart3" >"$tmp/merged"
+check "--digest with --merge" same "$tmp/digest" "$tmp/merged"
+"$mdt" -z -P "$tmp/shm" "$md" &
+pid=$!
+i=0
+while [ ! -f "$tmp/shm" ] && [ $i -lt 50 ]; do
+  sleep 1
+  i=`expr $i + 1`
+done
+"$mdt" -z -R "$tmp/shm" >"$tmp/published"
+kill $pid
+wait $pid
+sed '/^$/d' "$tmp/digest" >"$tmp/digest.lines"
+check "--digest with --publish" same "$tmp/digest.lines" "$tmp/published"
+
+# Tar archives: the same tree as the maildir extracted, whether they
+# hold its directory or only its insides. Compression needs the tool
+# here and the library in maildirtree, or is skipped.
+"$mdt" "$md" >"$tmp/tree"
+(cd "$tmp" && tar cf dir.tar Mail)
+(cd "$md" && tar cf "$tmp/Mail.tar" .)
+for z in gzip zstd; do
+  if command -v $z >/dev/null 2>&1; then
+    $z -c "$tmp/dir.tar" >"$tmp/dir.tar.$z"
+    $z -c "$tmp/Mail.tar" >"$tmp/Mail.tar.$z"
+  fi
+done
+mv "$tmp/Mail.tar.gzip" "$tmp/Mail.tgz" 2>/dev/null
+mv "$tmp/Mail.tar.zstd" "$tmp/Mail.tar.zst" 2>/dev/null
+
+for a in dir.tar Mail.tar dir.tar.gzip Mail.tgz dir.tar.zstd Mail.tar.zst; do
+  if [ ! -f "$tmp/$a" ]; then
+    echo "skip  archive $a (no compressor)"
+  elif "$mdt" "$tmp/$a" >"$tmp/archive" 2>&1 || ! grep -q "not supported" "$tmp/archive"; then
+    check "archive $a" same "$tmp/tree" "$tmp/archive"
+  else
+    echo "skip  archive $a (not built in)"
+  fi
+done
+
+# Only the archive suffix comes off a name
+cp "$tmp/Mail.tar" "$tmp/my.thing.tar"
+"$mdt" "$tmp/my.thing.tar" >"$tmp/archive"
+check "archive name my.thing.tar" grep -q '^my\.thing  ' "$tmp/archive"
+
+# Dovecot indexes: the counts of one synced when cur/ and new/ last
+# changed (10 messages, 4 seen), but those of the directories once
+# cur/ has changed since. The fixtures are little-endian.
+if [ "`printf '\001\000' | od -An -d | tr -d ' '`" = 1 ]; then
+  dc=$tmp/Dovecot
+  folder "$dc" 3 2
+  for i in current stale; do
+    cp "$here/dovecot-$i.index" "$dc/dovecot.index"
+    TZ=UTC touch -t 202311142213.20 "$dc/cur" "$dc/new"
+    "$mdt" -D "$dc" >"$tmp/dovecot-$i"
+  done
+  check "--dovecot current index" grep -q '(6/10)$' "$tmp/dovecot-current"
+  check "--dovecot stale index" grep -q '(2/5)$' "$tmp/dovecot-stale"
+else
+  echo "skip  --dovecot (big-endian)"
+fi
+
+# --daemon: each request answered from the tree in memory, as a scan
+# would count it
+if command -v python3 >/dev/null 2>&1; then
+  "$mdt" -d -S "$tmp/sock" "$md" &
+  pid=$!
+  listening $pid "$tmp/sock"
+  printf 'ROOTS\nTOTALS\nFOLDER 0 Lists/linux\nUNREAD 0\nQUIT\n' |
+    ask "$tmp/sock" >"$tmp/answers"
+  printf 'TREE %s\nQUIT\n' "$md" | ask "$tmp/sock" >"$tmp/answer-tree"
+  kill $pid
+  wait $pid
+  cat >"$tmp/expected" <<EOF
+OK 1
+0 $md
+.
+OK 17 100 5
+OK 7 47
+OK 5
+2 5 Mail
+7 47 Lists/linux
+1 3 Lists/linux/stable
+3 12 Work/Old/2019
+4 4 Zed
+.
+OK bye
+EOF
+  check "--daemon ROOTS, TOTALS, FOLDER and UNREAD" same "$tmp/expected" "$tmp/answers"
+  "$mdt" "$md" | sed '$d' >"$tmp/tree"
+  sed '1d; /^\.$/,$d' "$tmp/answer-tree" >"$tmp/daemon-tree"
+  check "--daemon TREE" same "$tmp/tree" "$tmp/daemon-tree"
+else
+  echo "skip  --daemon (no python3)"
+fi
+
+# --spool: the daemon serves each user's maildir, or the Maildir in it,
+# and nothing else there
+if command -v python3 >/dev/null 2>&1; then
+  spool=$tmp/spool
+  folder "$spool/alice" 1 1
+  folder "$spool/bob/Maildir" 0 2
+  mkdir -p "$spool/carol/Mail"
+  : > "$spool/notes"
+  "$mdt" -d -S "$tmp/spool.sock" -L "$spool" &
+  pid=$!
+  listening $pid "$tmp/spool.sock"
+  printf 'ROOTS\nTOTALS 1\nTOTALS %s\nQUIT\n' "$spool/alice" |
+    ask "$tmp/spool.sock" >"$tmp/answers"
+  kill $pid
+  wait $pid
+  cat >"$tmp/expected" <<EOF
+OK 2
+0 $spool/alice
+1 $spool/bob/Maildir
+.
+OK 2 2 1
+OK 1 2 1
+OK bye
+EOF
+  check "--spool" same "$tmp/expected" "$tmp/answers"
+else
+  echo "skip  --spool (no python3)"
+fi
+
+# IMAP, against tests/imapd.py over --tunnel: LIST-STATUS and pipelined
+# STATUS commands give the same tree, the first without any STATUS.
+if command -v python3 >/dev/null 2>&1; then
+  MAILDIRTREE_IMAP_PASSWORD='s"ecret'
+  export MAILDIRTREE_IMAP_PASSWORD
+  "$mdt" -x "python3 $here/imapd.py --list-status" imap://joe@test \
+    >"$tmp/list-status" 2>"$tmp/list-status.err"
+  "$mdt" -x "python3 $here/imapd.py" imap://joe@test \
+    >"$tmp/status" 2>"$tmp/status.err"
+  check "IMAP LIST-STATUS" grep -q '^test  *(3/10)$' "$tmp/list-status"
+  check "IMAP LIST-STATUS sends no STATUS" grep -q '^statuses 0$' "$tmp/list-status.err"
+  check "IMAP pipelined STATUS" same "$tmp/list-status" "$tmp/status"
+  check "IMAP STATUS for every mailbox" grep -q '^statuses 305$' "$tmp/status.err"
+  check "IMAP quoted name" grep -q -- '-- Odd"name  *(1/2)$' "$tmp/status"
+else
+  echo "skip  IMAP (no python3)"
+fi
+
+exit $failed
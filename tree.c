@@ -0,0 +1,690 @@
+/* tree.c: building folder hierarchies for libmaildirtree. See
+ * maildirtree.c for full copyright.
+ * (C) 2003 by Joshua Kwan. */
+
+#include "config.h"
+
+#include "libmaildirtree.h"
+#include "probes.h"
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+/* The tree as it is being built. Folders turn up in whatever order
+ * readdir() feels like, so while scanning they are only numbered in
+ * order of appearance and chained to their parents by index;
+ * mdt_finish() then lays them out in preorder. */
+struct mdt_builder
+{
+  size_t count, alloc;
+  unsigned int *parent, *first, *next, *tail;
+  unsigned int *name, *path, *read, *unread;
+  unsigned char *flags;
+  struct mdt_ages *ages;
+  struct mdt_stamps *stamps;
+  struct mdt_audit *audit;
+  struct mdt_digest *digest;
+
+  /* Offset 0 always holds an empty string. */
+  char *names;
+  size_t names_len, names_alloc;
+
+  /* Open-addressed (parent, name) -> folder index, so that finding a
+   * child does not mean a walk along tens of thousands of siblings.
+   * The root is never anybody's child, so 0 marks a free slot. */
+  unsigned int *hash;
+  size_t hash_size;
+
+  unsigned int columns;
+  int sort;
+  int error;
+};
+
+static unsigned int new_folder (struct mdt_builder *, unsigned int, const char *, size_t);
+static unsigned int add_name (struct mdt_builder *, const char *, size_t);
+static unsigned int find_child (struct mdt_builder *, unsigned int, const char *, size_t);
+static int grow (struct mdt_builder *);
+static int rehash (struct mdt_builder *);
+static inline size_t hash_name (unsigned int, const char *, size_t);
+static void sort_children (struct mdt_builder *, unsigned int *, unsigned int *);
+static void sort_by_count (struct mdt_builder *, unsigned int *, unsigned int *, size_t);
+
+struct mdt_builder * mdt_builder_new (const char *root, unsigned int columns)
+{
+  struct mdt_builder *b;
+
+  if ((b = (struct mdt_builder *) calloc (1, sizeof(struct mdt_builder))) == NULL)
+    return NULL;
+
+  b->columns = columns;
+
+  /* Nothing else can go at offset 0, see add_name(). */
+  b->names_len = 1;
+  if ((b->names = (char *) malloc (4096)) == NULL)
+  {
+    free (b);
+    return NULL;
+  }
+  b->names[0] = '\0';
+  b->names_alloc = 4096;
+
+  if (new_folder (b, MDT_NONE, root, strlen(root)) == MDT_NONE)
+  {
+    mdt_builder_free (b);
+    return NULL;
+  }
+
+  return b;
+}
+
+void mdt_builder_sort (struct mdt_builder *b, int sort)
+{
+  b->sort = sort;
+}
+
+void mdt_builder_free (struct mdt_builder *b)
+{
+  if (b == NULL)
+    return;
+
+  free (b->parent);
+  free (b->first);
+  free (b->next);
+  free (b->tail);
+  free (b->name);
+  free (b->path);
+  free (b->read);
+  free (b->unread);
+  free (b->flags);
+  free (b->ages);
+  free (b->stamps);
+  free (b->audit);
+  free (b->digest);
+  free (b->names);
+  free (b->hash);
+  free (b);
+}
+
+/* mdt_insert (formerly insert_tree)
+ *
+ * Folders implied by .Foo.Bar where .Foo does not exist are created as
+ * dummies, which keeps print_tree from showing 0/0 for them.
+ *
+ * Two directories can come down to the same name, like an mbox Foo
+ * next to a Maildir .Foo; each gets a folder of its own rather than one
+ * overwriting the other's counts. An mbox is never anybody's parent. */
+unsigned int mdt_insert (struct mdt_builder *b, const char *dirName,
+                         const struct mdt_counts *counts)
+{
+  unsigned int i = 0, next, path = 0;
+  const char *test, *end, *rest;
+  size_t len;
+
+  if (b->error)
+    return MDT_NONE;
+
+  if (*dirName && (path = add_name(b, dirName, strlen(dirName))) == 0)
+    return MDT_NONE;
+
+  /* Ignore the first null token of dirName if it's leading by a dot. */
+  if (*dirName == '.')
+    dirName++;
+
+  /* Walk the dot-separated components; empty ones are skipped just
+   * like strtok() used to. */
+  for (test = dirName; *test; test = *end ? end + 1 : end)
+  {
+    end = strchr(test, '.');
+    if (end == NULL)
+      end = test + strlen(test);
+
+    if ((len = end - test) == 0)
+      continue;
+
+    for (rest = end; *rest == '.'; rest++)
+      ;
+
+    /* Only a dummy can become this folder. */
+    next = find_child(b, i, test, len);
+    if (next != MDT_NONE && *rest == '\0' &&
+        ((counts->flags & MDT_MBOX) || !(b->flags[next] & MDT_DUMMY)))
+      next = MDT_NONE;
+
+    /* Additional recursion impossible, must create */
+    if (next == MDT_NONE && (next = new_folder(b, i, test, len)) == MDT_NONE)
+      return MDT_NONE;
+
+    i = next;
+  }
+
+  /* This is only valid on the innermost node */
+  b->path[i] = path;
+  b->read[i] = counts->read;
+  b->unread[i] = counts->unread;
+  b->flags[i] = counts->flags & ~MDT_DUMMY;
+
+  if (b->columns & MDT_AGES)
+    b->ages[i] = counts->ages;
+  if (b->columns & MDT_STAMPS)
+    b->stamps[i] = counts->stamps;
+  if (b->columns & MDT_AUDIT)
+    b->audit[i] = counts->audit;
+  if (b->columns & MDT_DIGEST)
+    b->digest[i] = counts->digest;
+
+  PROBE2 (tree__insert, dirName, i);
+  return i;
+}
+
+/* mdt_finish: lay the folders out in preorder, in one block.
+ *
+ * The walk follows the first-child/next-sibling chains without a stack,
+ * climbing back up through the parents, so deep trees cost nothing
+ * extra. Subtree sizes, depths and the totals then each fall out of a
+ * single linear pass over the finished arrays. */
+struct mdt_tree * mdt_finish (struct mdt_builder *b)
+{
+  struct mdt_tree *t;
+  unsigned int *order, *where, v;
+  size_t n = b->count, i, size;
+  char *p;
+
+  if (b->error)
+  {
+    mdt_builder_free (b);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  /* The arrays, widest first so that each stays aligned. */
+  size = sizeof(struct mdt_tree);
+  if (b->columns & MDT_AGES)
+    size += n * sizeof(struct mdt_ages);
+  if (b->columns & MDT_STAMPS)
+    size += n * sizeof(struct mdt_stamps);
+  if (b->columns & MDT_DIGEST)
+    size += n * sizeof(struct mdt_digest);
+  if (b->columns & MDT_AUDIT)
+    size += n * sizeof(struct mdt_audit);
+  size += 7 * n * sizeof(unsigned int) + n + b->names_len;
+
+  order = (unsigned int *) malloc (2 * n * sizeof(unsigned int));
+  if (order == NULL || (t = (struct mdt_tree *) malloc (size)) == NULL)
+  {
+    free (order);
+    mdt_builder_free (b);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  where = order + n;
+
+  sort_children (b, order, where);
+
+  /* Preorder: go down if we can, otherwise sideways, otherwise up
+   * until sideways works again. */
+  i = 0;
+  v = 0;
+  for (;;)
+  {
+    where[v] = i;
+    order[i++] = v;
+
+    if (b->first[v] != MDT_NONE)
+    {
+      v = b->first[v];
+      continue;
+    }
+
+    while (v != 0 && b->next[v] == MDT_NONE)
+      v = b->parent[v];
+
+    if (v == 0)
+      break;
+
+    v = b->next[v];
+  }
+  assert (i == n);
+
+  memset (t, 0, sizeof(struct mdt_tree));
+  t->count = n;
+  p = (char *) (t + 1);
+
+  if (b->columns & MDT_AGES)
+  {
+    t->ages = (struct mdt_ages *) p;
+    p += n * sizeof(struct mdt_ages);
+  }
+  if (b->columns & MDT_STAMPS)
+  {
+    t->stamps = (struct mdt_stamps *) p;
+    p += n * sizeof(struct mdt_stamps);
+  }
+  if (b->columns & MDT_DIGEST)
+  {
+    t->digest = (struct mdt_digest *) p;
+    p += n * sizeof(struct mdt_digest);
+  }
+  if (b->columns & MDT_AUDIT)
+  {
+    t->audit = (struct mdt_audit *) p;
+    p += n * sizeof(struct mdt_audit);
+  }
+
+  t->parent = (unsigned int *) p;
+  t->size   = t->parent + n;
+  t->depth  = t->size + n;
+  t->name   = t->depth + n;
+  t->path   = t->name + n;
+  t->read   = t->path + n;
+  t->unread = t->read + n;
+  t->flags  = (unsigned char *) (t->unread + n);
+  t->names  = (char *) (t->flags + n);
+
+  for (i = 0; i < n; i++)
+  {
+    v = order[i];
+    t->parent[i] = (v == 0) ? MDT_NONE : where[b->parent[v]];
+    t->name[i] = b->name[v];
+    t->path[i] = b->path[v];
+    t->read[i] = b->read[v];
+    t->unread[i] = b->unread[v];
+    t->flags[i] = b->flags[v];
+    if (t->ages)
+      t->ages[i] = b->ages[v];
+    if (t->stamps)
+      t->stamps[i] = b->stamps[v];
+    if (t->audit)
+      t->audit[i] = b->audit[v];
+    if (t->digest)
+      t->digest[i] = b->digest[v];
+  }
+  memcpy (t->names, b->names, b->names_len);
+  t->names_len = b->names_len;
+
+  free (order);
+  mdt_builder_free (b);
+
+  /* Parents come before their children... */
+  t->depth[0] = 0;
+  for (i = 1; i < n; i++)
+    t->depth[i] = t->depth[t->parent[i]] + 1;
+
+  /* ...so sizes can be summed up going backwards. */
+  for (i = 0; i < n; i++)
+    t->size[i] = 1;
+  for (i = n - 1; i > 0; i--)
+    t->size[t->parent[i]] += t->size[i];
+
+  mdt_update_totals (t);
+
+  return t;
+}
+
+void mdt_update_totals (struct mdt_tree *t)
+{
+  size_t i;
+
+  t->total_read = t->total_unread = t->folders_unread = 0;
+  t->folders_partial = t->folders_audit = 0;
+  mdt_clear_ages (&t->total_ages);
+  memset (&t->total_audit, 0, sizeof(t->total_audit));
+
+  for (i = 0; i < t->count; i++)
+  {
+    t->total_read += t->read[i];
+    t->total_unread += t->unread[i];
+    t->folders_unread += (t->unread[i] > 0);
+    t->folders_partial += (t->flags[i] & MDT_PARTIAL) != 0;
+    if (t->ages)
+      mdt_add_ages (&t->total_ages, &t->ages[i]);
+    if (t->audit)
+    {
+      t->total_audit.duplicates += t->audit[i].duplicates;
+      t->total_audit.stale += t->audit[i].stale;
+      t->folders_audit += (t->audit[i].duplicates || t->audit[i].stale);
+    }
+  }
+}
+
+/* mdt_rollup: in preorder every folder comes before its subfolders, so
+ * going backwards every folder comes after them, by which time they
+ * have all handed it their sums. That makes one pass, with no stack. */
+void mdt_rollup (const struct mdt_tree *t, unsigned int *read, unsigned int *unread)
+{
+  size_t i;
+
+  memcpy (read, t->read, t->count * sizeof(unsigned int));
+  memcpy (unread, t->unread, t->count * sizeof(unsigned int));
+
+  for (i = t->count; i-- > 1; )
+  {
+    read[t->parent[i]] += read[i];
+    unread[t->parent[i]] += unread[i];
+  }
+}
+
+void mdt_free (struct mdt_tree *tree)
+{
+  free (tree);
+}
+
+/* new_folder: append a dummy folder called name (len bytes, not
+ * necessarily terminated) below parent. */
+static unsigned int new_folder (struct mdt_builder *b, unsigned int parent,
+                                const char *name, size_t len)
+{
+  unsigned int i, off;
+  size_t slot;
+
+  if (b->count == b->alloc && grow(b) != 0)
+    return MDT_NONE;
+
+  if ((off = add_name(b, name, len)) == 0)
+    return MDT_NONE;
+
+  i = b->count++;
+
+  b->name[i] = off;
+  b->path[i] = 0;
+  b->parent[i] = parent;
+  b->first[i] = b->next[i] = b->tail[i] = MDT_NONE;
+
+  /* This will be set for real later if this actually exists,
+   * but prevents junk if this is not the case (i.e. .Foo.Bar where
+   * .Foo is non-existent. */
+  b->read[i] = b->unread[i] = 0;
+  b->flags[i] = MDT_DUMMY;
+  if (b->columns & MDT_AGES)
+    mdt_clear_ages (&b->ages[i]);
+  if (b->columns & MDT_STAMPS)
+    memset (&b->stamps[i], 0, sizeof(struct mdt_stamps));
+  if (b->columns & MDT_AUDIT)
+    memset (&b->audit[i], 0, sizeof(struct mdt_audit));
+  if (b->columns & MDT_DIGEST)
+    memset (&b->digest[i], 0, sizeof(struct mdt_digest));
+
+  if (parent == MDT_NONE)
+    return i;
+
+  /* Children keep the order they were found in. */
+  if (b->tail[parent] == MDT_NONE)
+    b->first[parent] = i;
+  else
+    b->next[b->tail[parent]] = i;
+  b->tail[parent] = i;
+
+  if (2 * b->count > b->hash_size && rehash(b) != 0)
+    return MDT_NONE;
+
+  slot = hash_name(parent, name, len) & (b->hash_size - 1);
+  while (b->hash[slot] != 0)
+    slot = (slot + 1) & (b->hash_size - 1);
+  b->hash[slot] = i;
+
+  return i;
+}
+
+/* add_name: copy len bytes of name into the blob, terminated. Returns
+ * the offset, or 0 (where only the empty string lives) if memory ran
+ * out. */
+static unsigned int add_name (struct mdt_builder *b, const char *name, size_t len)
+{
+  unsigned int off;
+
+  if (b->names_len + len + 1 > b->names_alloc)
+  {
+    size_t want = b->names_alloc * 2;
+    char *names;
+
+    while (want < b->names_len + len + 1)
+      want *= 2;
+
+    if (want > UINT_MAX || (names = (char *) realloc (b->names, want)) == NULL)
+    {
+      b->error = ENOMEM;
+      return 0;
+    }
+
+    b->names = names;
+    b->names_alloc = want;
+  }
+
+  off = b->names_len;
+  memcpy (b->names + off, name, len);
+  b->names[off + len] = '\0';
+  b->names_len += len + 1;
+
+  return off;
+}
+
+/* find_child: the folder called name (len bytes) below parent that
+ * could have subfolders; the first of them if there are several. */
+static unsigned int find_child (struct mdt_builder *b, unsigned int parent,
+                                const char *name, size_t len)
+{
+  size_t slot;
+  unsigned int i;
+  const char *other;
+
+  if (b->hash_size == 0)
+    return MDT_NONE;
+
+  slot = hash_name(parent, name, len) & (b->hash_size - 1);
+  while ((i = b->hash[slot]) != 0)
+  {
+    other = b->names + b->name[i];
+    if (b->parent[i] == parent && !(b->flags[i] & MDT_MBOX) &&
+        !strncmp(other, name, len) && other[len] == '\0')
+      return i;
+
+    slot = (slot + 1) & (b->hash_size - 1);
+  }
+
+  return MDT_NONE;
+}
+
+/* grow: make room for more folders in every array at once. */
+static int grow (struct mdt_builder *b)
+{
+  size_t n = b->alloc ? b->alloc * 2 : 64;
+  void *p;
+
+#define GROW(field, type) \
+  if ((p = realloc (b->field, n * sizeof(type))) == NULL) \
+    goto nomem; \
+  b->field = (type *) p;
+
+  GROW(parent, unsigned int);
+  GROW(first, unsigned int);
+  GROW(next, unsigned int);
+  GROW(tail, unsigned int);
+  GROW(name, unsigned int);
+  GROW(path, unsigned int);
+  GROW(read, unsigned int);
+  GROW(unread, unsigned int);
+  GROW(flags, unsigned char);
+  if (b->columns & MDT_AGES)
+  {
+    GROW(ages, struct mdt_ages);
+  }
+  if (b->columns & MDT_STAMPS)
+  {
+    GROW(stamps, struct mdt_stamps);
+  }
+  if (b->columns & MDT_AUDIT)
+  {
+    GROW(audit, struct mdt_audit);
+  }
+  if (b->columns & MDT_DIGEST)
+  {
+    GROW(digest, struct mdt_digest);
+  }
+
+#undef GROW
+
+  b->alloc = n;
+  return 0;
+
+nomem:
+  b->error = ENOMEM;
+  return -1;
+}
+
+static int rehash (struct mdt_builder *b)
+{
+  size_t n = b->hash_size ? b->hash_size * 2 : 256, slot;
+  unsigned int *hash, i;
+
+  if ((hash = (unsigned int *) calloc (n, sizeof(unsigned int))) == NULL)
+  {
+    b->error = ENOMEM;
+    return -1;
+  }
+
+  for (i = 1; i < b->count; i++)
+  {
+    /* The one being added goes in after us. */
+    if (b->parent[i] == MDT_NONE || i == b->count - 1)
+      continue;
+
+    slot = hash_name(b->parent[i], b->names + b->name[i],
+                     strlen(b->names + b->name[i])) & (n - 1);
+    while (hash[slot] != 0)
+      slot = (slot + 1) & (n - 1);
+    hash[slot] = i;
+  }
+
+  free (b->hash);
+  b->hash = hash;
+  b->hash_size = n;
+  return 0;
+}
+
+/* FNV-1a over the name, seeded with the parent. */
+static inline size_t hash_name (unsigned int parent, const char *name, size_t len)
+{
+  size_t h = 2166136261u ^ parent, i;
+
+  for (i = 0; i < len; i++)
+  {
+    h ^= (unsigned char) name[i];
+    h *= 16777619u;
+  }
+
+  return h ^ (h >> 15);
+}
+
+/* sort_children: put the children of every folder in the order asked
+ * for. All folders are sorted together, then pushed onto the front of
+ * their parents' chains from last to first. 'items' and 'tmp' each have
+ * room for every folder. */
+static void sort_children (struct mdt_builder *b, unsigned int *items, unsigned int *tmp)
+{
+  size_t n = b->count - 1, i, k;
+  unsigned int v, p;
+
+  if (b->sort == MDT_SORT_NONE || n == 0)
+    return;
+
+  /* Everything but the root */
+  for (i = 0; i < n; i++)
+    items[i] = i + 1;
+
+  mdt_sort_names (items, n, b->names, b->name);
+
+  /* Of folders with the same name, mboxes go first, as --stream has
+   * them: there, subfolders belong to the last one. */
+  for (i = 1; i < n; i++)
+    for (k = i; k > 0 && (b->flags[items[k]] & MDT_MBOX) &&
+                !(b->flags[items[k - 1]] & MDT_MBOX) &&
+                !strcmp(b->names + b->name[items[k]], b->names + b->name[items[k - 1]]); k--)
+    {
+      v = items[k];
+      items[k] = items[k - 1];
+      items[k - 1] = v;
+    }
+  if (b->sort != MDT_SORT_NAME)
+    sort_by_count (b, items, tmp, n);
+
+  for (v = 0; v < b->count; v++)
+    b->first[v] = MDT_NONE;
+
+  for (i = n; i-- > 0; )
+  {
+    v = items[i];
+    p = b->parent[v];
+    b->next[v] = b->first[p];
+    b->first[p] = v;
+  }
+}
+
+/* sort_by_count: most messages first, keeping the order by name among
+ * equals. That takes a stable sort, and counts are just 32-bit keys, so
+ * this is an LSD radix sort a byte at a time, skipping bytes that are
+ * the same for everyone (all the high ones, usually). */
+static void sort_by_count (struct mdt_builder *b, unsigned int *items, unsigned int *tmp,
+                           size_t n)
+{
+  size_t count [4][256], i, sum, c;
+  unsigned int *from = items, *to = tmp, *swap, k;
+  int pass;
+
+#define COUNT_KEY(v) (~(b->unread[v] + (b->sort == MDT_SORT_TOTAL ? b->read[v] : 0)))
+
+  memset (count, 0, sizeof(count));
+  for (i = 0; i < n; i++)
+  {
+    k = COUNT_KEY(items[i]);
+    for (pass = 0; pass < 4; pass++)
+      count[pass][(k >> (8 * pass)) & 0xff]++;
+  }
+
+  for (pass = 0; pass < 4; pass++)
+  {
+    k = (COUNT_KEY(items[0]) >> (8 * pass)) & 0xff;
+    if (count[pass][k] == n)
+      continue;
+
+    for (c = 0, sum = 0; c < 256; c++)
+    {
+      i = count[pass][c];
+      count[pass][c] = sum;
+      sum += i;
+    }
+
+    for (i = 0; i < n; i++)
+      to[count[pass][(COUNT_KEY(from[i]) >> (8 * pass)) & 0xff]++] = from[i];
+
+    swap = from; from = to; to = swap;
+  }
+
+#undef COUNT_KEY
+
+  if (from != items)
+    memcpy (items, from, n * sizeof(unsigned int));
+}
+
+void mdt_clear_ages (struct mdt_ages *a)
+{
+  memset (a, 0, sizeof(*a));
+
+  /* Anything real is older than this. */
+  a->oldest = (time_t) LONG_MAX;
+}
+
+void mdt_add_ages (struct mdt_ages *to, const struct mdt_ages *from)
+{
+  int b;
+
+  for (b = 0; b < MDT_AGE_BUCKETS; b++)
+    to->bucket[b] += from->bucket[b];
+
+  if (from->oldest < to->oldest)
+    to->oldest = from->oldest;
+  if (from->newest > to->newest)
+    to->newest = from->newest;
+}
@@ -0,0 +1,490 @@
+/* watch.c: --watch, keeping the daemon's counts current from fanotify
+ * events on whole filesystems, rather than looking at the mtimes of
+ * every cur/ and new/ it has. See maildirtree.c for full copyright.
+ *
+ * An inotify watch per directory does not scale to a spool: two for
+ * every folder of every user soon runs into max_user_watches, and
+ * takes minutes to set up. A fanotify filesystem mark takes one call
+ * for everything, and with FAN_REPORT_DFID_NAME every entry created,
+ * deleted or moved is reported as the file handle of its directory and
+ * its name. So after the first scan, the handle of every cur/ and new/
+ * (and of every maildir itself) goes into a cache that tells whose
+ * directory it is, and each event turns into one message more or less
+ * in one folder. What happens in a maildir itself or the directory of
+ * one of its folders (folders, cur/ or new/ coming or going) has it
+ * scanned again instead, as does the kernel dropping events on the
+ * floor. A message delivered while its maildir is being scanned again
+ * can so be counted twice, until it is scanned once more. Directories
+ * elsewhere are none of our business and cost a lookup each.
+ *
+ * This needs CAP_SYS_ADMIN, and Linux 5.9 or later. */
+
+#include "config.h"
+
+#include "maildirtree.h"
+#include "snprintf.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#ifdef HAVE_SYS_FANOTIFY_H
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+#endif
+
+#if defined(HAVE_SYS_FANOTIFY_H) && defined(FAN_REPORT_DFID_NAME)
+
+#define EVENTS (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR)
+
+/* How a directory is known: the filesystem and the handle in it */
+#define MAX_KEY (sizeof(fsid_t) + sizeof(int) + MAX_HANDLE_SZ)
+
+struct dir
+{
+  uint32_t key, key_len;   /* in 'keys' */
+  unsigned int root, folder;
+  unsigned int next;       /* of the same root */
+  unsigned char which;     /* WATCH_*; WATCH_NONE once forgotten */
+};
+
+struct watch
+{
+  int fd;
+
+  struct dir *dirs;
+  size_t ndirs, dirs_alloc;
+  unsigned char *keys;
+  size_t keys_len, keys_alloc;
+
+  /* Open-addressed hash of dirs by key; 0 is free, else index + 1 */
+  unsigned int *hash;
+  size_t hash_size;
+
+  unsigned int *first;     /* first dir of every root */
+  size_t nroots;
+
+  fsid_t *marked;          /* filesystems marked so far */
+  size_t nmarked;
+};
+
+static int add_dir (struct watch *, char *, unsigned int, unsigned int, int);
+static bool mark (struct watch *, const char *, const fsid_t *);
+static struct dir * lookup (struct watch *, const unsigned char *, size_t);
+static bool grow (struct watch *);
+static size_t make_key (unsigned char *, const void *, const struct file_handle *);
+static inline size_t hash_key (const unsigned char *, size_t);
+
+/* watch_open: a fanotify group to watch with, or NULL with errno set if
+ * we may not have one. */
+struct watch * watch_open (void)
+{
+  struct watch *w;
+
+  if ((w = (struct watch *) calloc (1, sizeof(struct watch))) == NULL)
+    return NULL;
+
+  w->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC,
+                        O_RDONLY);
+  if (w->fd < 0)
+  {
+    free (w);
+    return NULL;
+  }
+
+  return w;
+}
+
+int watch_fd (const struct watch *w)
+{
+  return w->fd;
+}
+
+/* watch_add: look out for changes to root number 'root' at 'path',
+ * which has the folders of 't'. Returns -1 with errno set if they
+ * cannot be watched. */
+int watch_add (struct watch *w, unsigned int root, const char *path,
+               const struct mdt_tree *t)
+{
+  unsigned int *nfirst;
+  struct dirent *e;
+  DIR *d;
+  char *p;
+  size_t i, len, size = strlen(path) + NAME_MAX + 8;
+  int r = 0;
+
+  if (root >= w->nroots)
+  {
+    if ((nfirst = (unsigned int *) realloc (w->first, (root + 1) * sizeof(unsigned int))) == NULL)
+      return -1;
+    for (i = w->nroots; i <= root; i++)
+      nfirst[i] = MDT_NONE;
+    w->first = nfirst;
+    w->nroots = root + 1;
+  }
+
+  if ((p = (char *) malloc (size)) == NULL)
+    return -1;
+
+  snprintf (p, size, "%s", path);
+  if (add_dir(w, p, root, MDT_NONE, WATCH_ROOT) != 0)
+    r = -1;
+
+  /* Every folder's own directory, including any that is not one yet
+   * for lack of cur/ or new/ */
+  if (r == 0 && (d = opendir(path)) != NULL)
+  {
+    while ((e = readdir(d)) != NULL)
+    {
+      if (*e->d_name != '.' || !strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+        continue;
+#ifdef _DIRENT_HAVE_D_TYPE
+      if (e->d_type != DT_DIR && e->d_type != DT_UNKNOWN)
+        continue;
+#endif
+
+      snprintf (p, size, "%s/%s", path, e->d_name);
+      if (add_dir(w, p, root, MDT_NONE, WATCH_FOLDER) != 0 && errno != ENOENT &&
+          errno != ENOTDIR && errno != EOVERFLOW)
+        r = -1;
+    }
+    closedir (d);
+  }
+
+  for (i = 0; i < t->count && r == 0; i++)
+  {
+    /* Neither dummies nor mbox files have a cur/ or new/ */
+    if (t->flags[i] & (MDT_DUMMY | MDT_MBOX))
+      continue;
+
+    len = snprintf (p, size, "%s/%s", path, t->names + t->path[i]);
+
+    /* A folder may be gone already; its maildir will say so. */
+    memcpy (p + len, "/cur", 5);
+    if (add_dir(w, p, root, i, WATCH_CUR) != 0 && errno != ENOENT)
+      r = -1;
+    memcpy (p + len, "/new", 5);
+    if (add_dir(w, p, root, i, WATCH_NEW) != 0 && errno != ENOENT)
+      r = -1;
+  }
+
+  free (p);
+  return r;
+}
+
+/* watch_forget: stop telling anyone about root number 'root', until it
+ * is added again. */
+void watch_forget (struct watch *w, unsigned int root)
+{
+  unsigned int d;
+
+  if (root >= w->nroots)
+    return;
+
+  for (d = w->first[root]; d != MDT_NONE; d = w->dirs[d].next)
+    w->dirs[d].which = WATCH_NONE;
+  w->first[root] = MDT_NONE;
+}
+
+/* watch_read: hand whatever events there are to 'fn', as a message more
+ * (+1) or less (-1) in cur/ or new/ of a folder of a root. WATCH_ROOT
+ * with a folder of MDT_NONE says the root has to be scanned again, and
+ * with a root of MDT_NONE too, all of them. Returns -1 with errno set
+ * if the events cannot be read. */
+int watch_read (struct watch *w, void (*fn) (void *, unsigned int, unsigned int, int, int),
+                void *arg)
+{
+  char buf [65536] __attribute__ ((aligned (__alignof__ (struct fanotify_event_metadata))));
+  const struct fanotify_event_metadata *m;
+  const struct fanotify_event_info_fid *info;
+  const struct file_handle *fh;
+  const struct dir *d;
+  unsigned char key [MAX_KEY];
+  const char *name;
+  ssize_t len;
+
+  for (;;)
+  {
+    if ((len = read(w->fd, buf, sizeof(buf))) < 0)
+      return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+    for (m = (const struct fanotify_event_metadata *) buf; FAN_EVENT_OK(m, len);
+         m = FAN_EVENT_NEXT(m, len))
+    {
+      if (m->vers != FANOTIFY_METADATA_VERSION)
+      {
+        errno = EPROTO;
+        return -1;
+      }
+
+      if (m->mask & FAN_Q_OVERFLOW)
+      {
+        fn (arg, MDT_NONE, MDT_NONE, WATCH_ROOT, 0);
+        continue;
+      }
+
+      info = (const struct fanotify_event_info_fid *) ((const char *) m + m->metadata_len);
+      if (m->event_len < m->metadata_len + sizeof(*info) ||
+          info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+        continue;
+
+      fh = (const struct file_handle *) info->handle;
+      name = (const char *) fh->f_handle + fh->handle_bytes;
+
+      d = lookup(w, key, make_key(key, &info->fsid, fh));
+      if (d == NULL || d->which == WATCH_NONE)
+        continue;
+
+      if (d->which == WATCH_ROOT)
+      {
+        /* Folders, or cur/ and new/ themselves, come or go. Anything
+         * else there (Dovecot's files, say) leaves the counts alone,
+         * unless it might be an mbox. */
+        if (((m->mask & FAN_ONDIR) &&
+             (*name == '.' || !strcmp(name, "cur") || !strcmp(name, "new"))) ||
+            (options.mbox && !(m->mask & FAN_ONDIR) && *name != '.'))
+          fn (arg, d->root, MDT_NONE, WATCH_ROOT, 0);
+        continue;
+      }
+
+      if (d->which == WATCH_FOLDER)
+      {
+        if ((m->mask & FAN_ONDIR) && (!strcmp(name, "cur") || !strcmp(name, "new")))
+          fn (arg, d->root, MDT_NONE, WATCH_ROOT, 0);
+        continue;
+      }
+
+      /* Not messages, as far as counting goes */
+      if (*name == '.' || (m->mask & FAN_ONDIR))
+        continue;
+
+      if (m->mask & (FAN_CREATE | FAN_MOVED_TO))
+        fn (arg, d->root, d->folder, d->which, 1);
+      if (m->mask & (FAN_DELETE | FAN_MOVED_FROM))
+        fn (arg, d->root, d->folder, d->which, -1);
+    }
+  }
+}
+
+void watch_close (struct watch *w)
+{
+  close (w->fd);
+  free (w->dirs);
+  free (w->keys);
+  free (w->hash);
+  free (w->first);
+  free (w->marked);
+  free (w);
+}
+
+/* add_dir: cache the handle of the directory at 'path', marking its
+ * filesystem if that is new to us. */
+static int add_dir (struct watch *w, char *path, unsigned int root,
+                    unsigned int folder, int which)
+{
+  union
+  {
+    struct file_handle fh;
+    unsigned char buf [sizeof(struct file_handle) + MAX_HANDLE_SZ];
+  } h;
+  unsigned char key [MAX_KEY];
+  struct statfs sf;
+  struct dir *d;
+  unsigned char *nkeys;
+  size_t len, hh, mask;
+  int mount_id;
+
+  h.fh.handle_bytes = MAX_HANDLE_SZ;
+  if (name_to_handle_at(AT_FDCWD, path, &h.fh, &mount_id, 0) != 0 ||
+      statfs(path, &sf) != 0 || !mark(w, path, &sf.f_fsid))
+    return -1;
+
+  len = make_key(key, &sf.f_fsid, &h.fh);
+
+  /* Seen before, and forgotten since, most likely: a rescan */
+  if ((d = lookup(w, key, len)) == NULL)
+  {
+    if (!grow(w))
+      return -1;
+
+    if (w->keys_len + len > w->keys_alloc)
+    {
+      size_t want = w->keys_alloc ? w->keys_alloc * 2 : 65536;
+
+      if ((nkeys = (unsigned char *) realloc (w->keys, want)) == NULL)
+        return -1;
+      w->keys = nkeys;
+      w->keys_alloc = want;
+    }
+
+    d = &w->dirs[w->ndirs];
+    d->key = w->keys_len;
+    d->key_len = len;
+    memcpy (w->keys + w->keys_len, key, len);
+    w->keys_len += len;
+
+    mask = w->hash_size - 1;
+    for (hh = hash_key(key, len) & mask; w->hash[hh] != 0; hh = (hh + 1) & mask)
+      ;
+    w->hash[hh] = ++w->ndirs;
+  }
+  else if (d->which != WATCH_NONE)
+    return 0;
+
+  d->root = root;
+  d->folder = folder;
+  d->which = which;
+  d->next = w->first[root];
+  w->first[root] = d - w->dirs;
+
+  return 0;
+}
+
+/* mark: put a filesystem mark on the filesystem of 'path' (with fsid
+ * 'fsid') unless there is one already. */
+static bool mark (struct watch *w, const char *path, const fsid_t *fsid)
+{
+  fsid_t *nmarked;
+  size_t i;
+
+  for (i = 0; i < w->nmarked; i++)
+    if (!memcmp(&w->marked[i], fsid, sizeof(fsid_t)))
+      return true;
+
+  if (fanotify_mark(w->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, EVENTS, AT_FDCWD, path) != 0)
+    return false;
+
+  if ((nmarked = (fsid_t *) realloc (w->marked, (w->nmarked + 1) * sizeof(fsid_t))) == NULL)
+    return false;
+  w->marked = nmarked;
+  w->marked[w->nmarked++] = *fsid;
+
+  return true;
+}
+
+static struct dir * lookup (struct watch *w, const unsigned char *key, size_t len)
+{
+  size_t hh, mask = w->hash_size - 1;
+  struct dir *d;
+
+  if (w->hash_size == 0)
+    return NULL;
+
+  for (hh = hash_key(key, len) & mask; w->hash[hh] != 0; hh = (hh + 1) & mask)
+  {
+    d = &w->dirs[w->hash[hh] - 1];
+    if (d->key_len == len && !memcmp(w->keys + d->key, key, len))
+      return d;
+  }
+
+  return NULL;
+}
+
+/* grow: make room for one more dir, keeping the hash at most half full */
+static bool grow (struct watch *w)
+{
+  struct dir *ndirs;
+  unsigned int *nhash;
+  size_t size, i, hh;
+
+  if (w->ndirs == w->dirs_alloc)
+  {
+    w->dirs_alloc = w->dirs_alloc ? w->dirs_alloc * 2 : 4096;
+    if ((ndirs = (struct dir *) realloc (w->dirs, w->dirs_alloc * sizeof(struct dir))) == NULL)
+      return false;
+    w->dirs = ndirs;
+  }
+
+  if (2 * (w->ndirs + 1) <= w->hash_size)
+    return true;
+
+  size = w->hash_size ? w->hash_size * 2 : 8192;
+  if ((nhash = (unsigned int *) calloc (size, sizeof(unsigned int))) == NULL)
+    return false;
+
+  for (i = 0; i < w->ndirs; i++)
+  {
+    for (hh = hash_key(w->keys + w->dirs[i].key, w->dirs[i].key_len) & (size - 1);
+         nhash[hh] != 0; hh = (hh + 1) & (size - 1))
+      ;
+    nhash[hh] = i + 1;
+  }
+
+  free (w->hash);
+  w->hash = nhash;
+  w->hash_size = size;
+
+  return true;
+}
+
+/* make_key: the filesystem, then the handle's type and bytes */
+static size_t make_key (unsigned char *key, const void *fsid, const struct file_handle *fh)
+{
+  size_t len = fh->handle_bytes > MAX_HANDLE_SZ ? MAX_HANDLE_SZ : fh->handle_bytes;
+
+  memcpy (key, fsid, sizeof(fsid_t));
+  memcpy (key + sizeof(fsid_t), &fh->handle_type, sizeof(int));
+  memcpy (key + sizeof(fsid_t) + sizeof(int), fh->f_handle, len);
+
+  return sizeof(fsid_t) + sizeof(int) + len;
+}
+
+/* FNV-1a */
+static inline size_t hash_key (const unsigned char *key, size_t len)
+{
+  size_t v = 2166136261u;
+
+  while (len--)
+    v = (v ^ *key++) * 16777619u;
+
+  return v;
+}
+
+#else /* no fanotify */
+
+struct watch * watch_open (void)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+int watch_fd (const struct watch *w)
+{
+  (void) w;
+  return -1;
+}
+
+int watch_add (struct watch *w, unsigned int root, const char *path,
+               const struct mdt_tree *t)
+{
+  (void) w; (void) root; (void) path; (void) t;
+  errno = ENOSYS;
+  return -1;
+}
+
+void watch_forget (struct watch *w, unsigned int root)
+{
+  (void) w; (void) root;
+}
+
+int watch_read (struct watch *w, void (*fn) (void *, unsigned int, unsigned int, int, int),
+                void *arg)
+{
+  (void) w; (void) fn; (void) arg;
+  errno = ENOSYS;
+  return -1;
+}
+
+void watch_close (struct watch *w)
+{
+  (void) w;
+}
+
+#endif